@@ -0,0 +1,228 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains encoding and decoding of rotated boxes (x, y, w, h, r) as deltas relative to anchors,
+ * which are used by the regression heads of rotated object detectors. Decoding can output polygons directly
+ * so that they can be passed to the (batched) IoU functions, or be fused with the IoU against the targets
+ * (decode_iou_batch) so that the decoded polygons are never stored. The gradients are chained through
+ * poly2_from_xywhr_grad.
+ *
+ * Encodings (a is the anchor, d = sqrt(wa^2 + ha^2)):
+ *      Standard: ((x-xa)/d, (y-ya)/d, log(w/wa), log(h/ha), r-ra)
+ *      SinCos: ((x-xa)/d, (y-ya)/d, log(w/wa), log(h/ha), cos(r)-cos(ra), sin(r)-sin(ra))
+ *
+ * Boxes and anchors are stored as arrays of 5 values, deltas as arrays of box_code_size(encoding) values.
+ * The functions on single boxes are available in GPU, while the batch functions are only available in CPU.
+ */
+
+#ifndef DGAL_BOX_CODER_HPP
+#define DGAL_BOX_CODER_HPP
+
+#include "dgal/geometry.hpp"
+#include "dgal/geometry_batch.hpp"
+#include "dgal/geometry_grad.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+enum class BoxEncoding : int
+{
+    Standard = 0,
+    SinCos = 1
+};
+
+CUDA_CALLABLE_MEMBER inline uint8_t box_code_size(const BoxEncoding encoding)
+{
+    return encoding == BoxEncoding::SinCos ? 6 : 5;
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void encode_box(const scalar_t *box, const scalar_t *anchor, scalar_t *delta,
+    const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    scalar_t diag = sqrt(anchor[2] * anchor[2] + anchor[3] * anchor[3]);
+    delta[0] = (box[0] - anchor[0]) / diag;
+    delta[1] = (box[1] - anchor[1]) / diag;
+    delta[2] = log(box[2] / anchor[2]);
+    delta[3] = log(box[3] / anchor[3]);
+    if (encoding == BoxEncoding::SinCos)
+    {
+        delta[4] = cos(box[4]) - cos(anchor[4]);
+        delta[5] = sin(box[4]) - sin(anchor[4]);
+    }
+    else
+        delta[4] = box[4] - anchor[4];
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void decode_box(const scalar_t *delta, const scalar_t *anchor, scalar_t *box,
+    const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    scalar_t diag = sqrt(anchor[2] * anchor[2] + anchor[3] * anchor[3]);
+    box[0] = anchor[0] + delta[0] * diag;
+    box[1] = anchor[1] + delta[1] * diag;
+    box[2] = anchor[2] * exp(delta[2]);
+    box[3] = anchor[3] * exp(delta[3]);
+    if (encoding == BoxEncoding::SinCos)
+        box[4] = atan2(sin(anchor[4]) + delta[5], cos(anchor[4]) + delta[4]);
+    else
+        box[4] = anchor[4] + delta[4];
+}
+
+// The gradient of the anchor is not calculated
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void decode_box_grad(const scalar_t *delta, const scalar_t *anchor, const scalar_t *grad,
+    scalar_t *grad_delta, const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    scalar_t diag = sqrt(anchor[2] * anchor[2] + anchor[3] * anchor[3]);
+    grad_delta[0] += grad[0] * diag;
+    grad_delta[1] += grad[1] * diag;
+    grad_delta[2] += grad[2] * anchor[2] * exp(delta[2]);
+    grad_delta[3] += grad[3] * anchor[3] * exp(delta[3]);
+    if (encoding == BoxEncoding::SinCos)
+    {
+        scalar_t c = cos(anchor[4]) + delta[4], s = sin(anchor[4]) + delta[5];
+        scalar_t r2 = c * c + s * s;
+        grad_delta[4] += -grad[4] * s / r2;
+        grad_delta[5] +=  grad[4] * c / r2;
+    }
+    else
+        grad_delta[4] += grad[4];
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+Poly2<scalar_t, 4> poly2_from_delta(const scalar_t *delta, const scalar_t *anchor,
+    const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    scalar_t box[5];
+    decode_box(delta, anchor, box, encoding);
+    return poly2_from_xywhr(box[0], box[1], box[2], box[3], box[4]);
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void poly2_from_delta_grad(const scalar_t *delta, const scalar_t *anchor, const Poly2<scalar_t, 4> &grad,
+    scalar_t *grad_delta, const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    scalar_t box[5], grad_box[5] = {0, 0, 0, 0, 0};
+    decode_box(delta, anchor, box, encoding);
+    poly2_from_xywhr_grad(box[0], box[1], box[2], box[3], box[4], grad,
+        grad_box[0], grad_box[1], grad_box[2], grad_box[3], grad_box[4]);
+    decode_box_grad(delta, anchor, grad_box, grad_delta, encoding);
+}
+
+///////////// batch versions //////////////
+
+template <typename scalar_t> inline
+void encode_boxes(const scalar_t *boxes, const scalar_t *anchors, size_t n, scalar_t *deltas,
+    const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    uint8_t code_size = box_code_size(encoding);
+    parallel_for(0, n, [&](size_t i) {
+        encode_box(boxes + i * 5, anchors + i * 5, deltas + i * code_size, encoding);
+    }, 1024);
+}
+
+template <typename scalar_t> inline
+void decode_boxes(const scalar_t *deltas, const scalar_t *anchors, size_t n, scalar_t *boxes,
+    const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    uint8_t code_size = box_code_size(encoding);
+    parallel_for(0, n, [&](size_t i) {
+        decode_box(deltas + i * code_size, anchors + i * 5, boxes + i * 5, encoding);
+    }, 1024);
+}
+
+// Decode deltas into polygons, which can be passed to iou_batch
+template <typename scalar_t> inline
+void decode_poly2_batch(const scalar_t *deltas, const scalar_t *anchors, size_t n, Poly2<scalar_t, 4> *polys,
+    const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    uint8_t code_size = box_code_size(encoding);
+    parallel_for(0, n, [&](size_t i) {
+        polys[i] = poly2_from_delta(deltas + i * code_size, anchors + i * 5, encoding);
+    }, 1024);
+}
+
+// Unlike the single versions, grad_deltas is overwritten rather than accumulated
+template <typename scalar_t> inline
+void decode_poly2_batch_grad(const scalar_t *deltas, const scalar_t *anchors, const Poly2<scalar_t, 4> *grads,
+    size_t n, scalar_t *grad_deltas, const BoxEncoding encoding = BoxEncoding::Standard)
+{
+    uint8_t code_size = box_code_size(encoding);
+    parallel_for(0, n, [&](size_t i) {
+        scalar_t *grad_delta = grad_deltas + i * code_size;
+        for (uint8_t k = 0; k < code_size; k++)
+            grad_delta[k] = 0;
+        poly2_from_delta_grad(deltas + i * code_size, anchors + i * 5, grads[i], grad_delta, encoding);
+    }, 1024);
+}
+
+// Decode deltas into polygons and calculate their IoU with the targets in one pass. The decoded polygons are not
+// stored, the xflags of each pair are packed into state for decode_iou_batch_grad (see iou_batch_packed).
+// Invalid pairs get zero IoU, and the PairStatus of each pair is stored in status if it's not null
+template <typename scalar_t> inline
+void decode_iou_batch(const scalar_t *deltas, const scalar_t *anchors, const Quad2<scalar_t> *targets, size_t n,
+    scalar_t *ious, uint32_t *state, const BoxEncoding encoding = BoxEncoding::Standard, uint8_t *status = nullptr)
+{
+    uint8_t code_size = box_code_size(encoding);
+    parallel_for(0, n, [&](size_t k) {
+        Quad2<scalar_t> poly = poly2_from_delta(deltas + k * code_size, anchors + k * 5, encoding);
+        uint8_t nxk, xflags[8]; PairStatus sk;
+        ious[k] = _iou_checked(poly, targets[k], nxk, xflags, sk);
+        state[k] = _pack_flags4(xflags, nxk);
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+// Backward of decode_iou_batch, the polygons are decoded again and the gradient of the IoU is chained through
+// poly2_from_delta_grad. The gradient of the targets is not calculated, grad_deltas is overwritten
+template <typename scalar_t> inline
+void decode_iou_batch_grad(const scalar_t *deltas, const scalar_t *anchors, const Quad2<scalar_t> *targets,
+    size_t n, const scalar_t *grads, const uint32_t *state, scalar_t *grad_deltas,
+    const BoxEncoding encoding = BoxEncoding::Standard, uint8_t *status = nullptr)
+{
+    uint8_t code_size = box_code_size(encoding);
+    parallel_for(0, n, [&](size_t k) {
+        const scalar_t *delta = deltas + k * code_size;
+        scalar_t *grad_delta = grad_deltas + k * code_size;
+        for (uint8_t i = 0; i < code_size; i++)
+            grad_delta[i] = 0;
+
+        Quad2<scalar_t> poly = poly2_from_delta(delta, anchors + k * 5, encoding);
+        scalar_t area1, area2;
+        PairStatus sk = _check_operands(poly, targets[k], area1, area2);
+        if (sk == PairStatus::Ok)
+        {
+            Quad2<scalar_t> grad_poly, grad_target;
+            grad_poly.zero(); grad_poly.nvertices = poly.nvertices;
+            grad_target.zero(); grad_target.nvertices = targets[k].nvertices;
+            uint8_t xflags[8], nx = _unpack_flags4(state[k], xflags);
+            iou_grad(poly, targets[k], grads[k], nx, xflags, grad_poly, grad_target);
+            poly2_from_delta_grad(delta, anchors + k * 5, grad_poly, grad_delta, encoding);
+        }
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+} // namespace dgal
+
+#endif // DGAL_BOX_CODER_HPP
@@ -0,0 +1,208 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains broad-phase collision detection over axis-aligned boxes, which is used to reduce
+ * the number of pairs that are passed to the (exact but expensive) polygon operations.
+ *
+ * The pairs are found by sorting the boxes along x axis and sweeping, which costs O(NlogN + K)
+ * where K is the number of overlapping pairs in x projection. For sets that change over time,
+ * SpatialHash supports insertion and removal of boxes with queries against a uniform grid.
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_BROADPHASE_HPP
+#define DGAL_BROADPHASE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "dgal/geometry.hpp"
+
+namespace dgal {
+
+using IndexPair = std::pair<uint32_t, uint32_t>;
+
+template <typename scalar_t> inline
+std::vector<uint32_t> _sort_by_min_x(const AABox2<scalar_t> *boxes, size_t n)
+{
+    std::vector<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [boxes](uint32_t a, uint32_t b) {
+        return boxes[a].min_x < boxes[b].min_x;
+    });
+    return order;
+}
+
+// Find all overlapping pairs (i, j) with i < j within a set of boxes
+template <typename scalar_t> inline
+void find_overlaps(const AABox2<scalar_t> *boxes, size_t n, std::vector<IndexPair> &pairs)
+{
+    std::vector<uint32_t> order = _sort_by_min_x(boxes, n);
+    for (size_t a = 0; a < n; a++)
+    {
+        const AABox2<scalar_t> &ba = boxes[order[a]];
+        for (size_t b = a + 1; b < n && boxes[order[b]].min_x < ba.max_x; b++)
+            if (ba.intersects(boxes[order[b]]))
+                pairs.emplace_back(std::min(order[a], order[b]), std::max(order[a], order[b]));
+    }
+}
+
+// Find all overlapping pairs (i, j) where i indexes into boxes1 and j indexes into boxes2
+template <typename scalar_t> inline
+void find_overlaps(const AABox2<scalar_t> *boxes1, size_t n1, const AABox2<scalar_t> *boxes2, size_t n2,
+    std::vector<IndexPair> &pairs)
+{
+    std::vector<uint32_t> order1 = _sort_by_min_x(boxes1, n1);
+    std::vector<uint32_t> order2 = _sort_by_min_x(boxes2, n2);
+
+    // sweep both lists together, each box is tested against the boxes from the other
+    // list that start after it and before it ends
+    size_t a = 0, b = 0;
+    while (a < n1 && b < n2)
+    {
+        const AABox2<scalar_t> &ba = boxes1[order1[a]], &bb = boxes2[order2[b]];
+        if (ba.min_x < bb.min_x)
+        {
+            for (size_t k = b; k < n2 && boxes2[order2[k]].min_x < ba.max_x; k++)
+                if (ba.intersects(boxes2[order2[k]]))
+                    pairs.emplace_back(order1[a], order2[k]);
+            a++;
+        }
+        else
+        {
+            for (size_t k = a; k < n1 && boxes1[order1[k]].min_x < bb.max_x; k++)
+                if (bb.intersects(boxes1[order1[k]]))
+                    pairs.emplace_back(order1[k], order2[b]);
+            b++;
+        }
+    }
+}
+
+// Uniform grid over boxes that supports insertion and removal. The cell size should be
+// around the typical box size. Queries are const and safe to run from multiple threads.
+template <typename scalar_t> class SpatialHash
+{
+public:
+    explicit SpatialHash(scalar_t cell_size = 1) : _cell_size(cell_size) {}
+
+    scalar_t cell_size() const { return _cell_size; }
+    size_t size() const { return _size; }
+
+    void clear()
+    {
+        _cells.clear();
+        _boxes.clear();
+        _alive.clear();
+        _size = 0;
+    }
+
+    // insert a box and return its id, ids are assigned sequentially from 0
+    uint32_t insert(const AABox2<scalar_t> &box)
+    {
+        uint32_t id = _boxes.size();
+        _boxes.push_back(box);
+        _alive.push_back(true);
+        _size++;
+
+        int32_t x0, x1, y0, y1;
+        _cell_range(box, x0, x1, y0, y1);
+        for (int32_t x = x0; x <= x1; x++)
+            for (int32_t y = y0; y <= y1; y++)
+                _cells[_key(x, y)].push_back(id);
+        return id;
+    }
+
+    void remove(uint32_t id)
+    {
+        if (id >= _boxes.size() || !_alive[id]) return;
+        _alive[id] = false;
+        _size--;
+
+        int32_t x0, x1, y0, y1;
+        _cell_range(_boxes[id], x0, x1, y0, y1);
+        for (int32_t x = x0; x <= x1; x++)
+            for (int32_t y = y0; y <= y1; y++)
+            {
+                auto it = _cells.find(_key(x, y));
+                it->second.erase(std::find(it->second.begin(), it->second.end(), id));
+                if (it->second.empty())
+                    _cells.erase(it);
+            }
+    }
+
+    const AABox2<scalar_t>& box(uint32_t id) const { return _boxes[id]; }
+
+    // call visitor(id) once for each box intersecting the query box. Return early if visitor returns true
+    template <typename Visitor>
+    bool visit(const AABox2<scalar_t> &query, const Visitor &visitor) const
+    {
+        int32_t x0, x1, y0, y1;
+        _cell_range(query, x0, x1, y0, y1);
+        for (int32_t x = x0; x <= x1; x++)
+            for (int32_t y = y0; y <= y1; y++)
+            {
+                auto it = _cells.find(_key(x, y));
+                if (it == _cells.end()) continue;
+                for (uint32_t id : it->second)
+                {
+                    const AABox2<scalar_t> &b = _boxes[id];
+                    if (!query.intersects(b)) continue;
+
+                    // a box shared by several cells is only reported in the cell containing
+                    // the lower corner of the overlap, so no visited set is needed
+                    if (_cell(_max(query.min_x, b.min_x)) != x || _cell(_max(query.min_y, b.min_y)) != y)
+                        continue;
+                    if (visitor(id))
+                        return true;
+                }
+            }
+        return false;
+    }
+
+    void query(const AABox2<scalar_t> &box, std::vector<uint32_t> &result) const
+    {
+        visit(box, [&](uint32_t id) { result.push_back(id); return false; });
+    }
+
+private:
+    int32_t _cell(scalar_t v) const { return (int32_t)floor(v / _cell_size); }
+    static uint64_t _key(int32_t x, int32_t y) { return (uint64_t(uint32_t(x)) << 32) | uint32_t(y); }
+    void _cell_range(const AABox2<scalar_t> &box, int32_t &x0, int32_t &x1, int32_t &y0, int32_t &y1) const
+    {
+        x0 = _cell(box.min_x); x1 = _cell(box.max_x);
+        y0 = _cell(box.min_y); y1 = _cell(box.max_y);
+    }
+
+    scalar_t _cell_size;
+    size_t _size = 0;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> _cells;
+    std::vector<AABox2<scalar_t>> _boxes;
+    std::vector<bool> _alive;
+};
+
+} // namespace dgal
+
+#endif // DGAL_BROADPHASE_HPP
@@ -0,0 +1,110 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains detection of the instruction sets supported by the CPU, which is used for selecting
+ * kernels compiled for multiple instruction sets at runtime. The selection can be limited by setting the
+ * environment variable DGAL_ISA to one of "baseline", "sse4.2", "avx2" and "avx512".
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_DISPATCH_HPP
+#define DGAL_DISPATCH_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace dgal {
+
+// Instruction set levels, each level includes the previous ones
+enum class ISA : int
+{
+    Baseline = 0,
+    SSE42 = 1,
+    AVX2 = 2,
+    AVX512 = 3
+};
+
+constexpr int _nisas = 4;
+
+inline const char* isa_name(const ISA isa)
+{
+    switch (isa)
+    {
+        case ISA::SSE42: return "sse4.2";
+        case ISA::AVX2: return "avx2";
+        case ISA::AVX512: return "avx512";
+        default: return "baseline";
+    }
+}
+
+// Parse the name of an instruction set, return false if the name is unknown
+inline bool parse_isa(const char *name, ISA &isa)
+{
+    for (int i = 0; i < _nisas; i++)
+        if (std::strcmp(name, isa_name(ISA(i))) == 0)
+        {
+            isa = ISA(i);
+            return true;
+        }
+    return false;
+}
+
+// Check whether the CPU (and OS) supports the instruction set
+inline bool cpu_supports(const ISA isa)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    switch (isa)
+    {
+        case ISA::Baseline: return true;
+        case ISA::SSE42: return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+        case ISA::AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+                            && __builtin_cpu_supports("bmi2");
+        case ISA::AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")
+                              && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+    }
+    return false;
+#else
+    return isa == ISA::Baseline;
+#endif
+}
+
+// Select the highest instruction set that is compiled (bit i of compiled is set for ISA(i)), supported
+// by the CPU and not higher than DGAL_ISA if it's set. The baseline is assumed to be always compiled.
+inline ISA select_isa(uint32_t compiled)
+{
+    int limit = _nisas - 1;
+    const char *env = std::getenv("DGAL_ISA");
+    ISA requested;
+    if (env != nullptr && parse_isa(env, requested))
+        limit = int(requested);
+
+    for (int i = limit; i > 0; i--)
+        if ((compiled & (1u << i)) && cpu_supports(ISA(i)))
+            return ISA(i);
+    return ISA::Baseline;
+}
+
+} // namespace dgal
+
+#endif // DGAL_DISPATCH_HPP
@@ -0,0 +1,485 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains the rotated ellipse primitive, which is used for uncertainty regions (e.g. the covariance
+ * ellipse of a track).
+ *
+ * The overlap with a polygon is exact: the ellipse is mapped to the unit circle by an affine transform, where the
+ * circle overlap from sector.hpp applies, and the area is scaled back by the determinant of the transform.
+ *
+ * The overlap of two ellipses is calculated by Green's theorem over the arcs of each ellipse inside the other one.
+ * The crossings of the boundaries are the roots of a trigonometric polynomial, which are bracketed by sampling the
+ * boundary at _EllipseSamples points and refined to machine precision. Pairs of crossings between two samples are
+ * found by searching the local extrema of the polynomial, so only (nearly) tangent boundaries can be missed, where
+ * the overlap error is bounded by the area of the lens between the crossings.
+ *
+ * The functions on single shapes are available in GPU, while the batch functions are only available in CPU.
+ */
+
+#ifndef DGAL_ELLIPSE_HPP
+#define DGAL_ELLIPSE_HPP
+
+#include "dgal/geometry.hpp"
+#include "dgal/sector.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+template <typename scalar_t> struct Ellipse2 // Rotated ellipse in 2D surface
+{
+    // contract: a > 0, b > 0
+    Point2<scalar_t> center;
+    scalar_t a = 0, b = 0; // semi-axes along the rotated x and y axes
+    scalar_t rotation = 0;
+
+    // this operator is intended for gradient accumulation
+    CUDA_CALLABLE_MEMBER Ellipse2<scalar_t>& operator+= (const Ellipse2<scalar_t>& rhs)
+    {
+        center += rhs.center; a += rhs.a; b += rhs.b; rotation += rhs.rotation;
+        return *this;
+    }
+
+    CUDA_CALLABLE_MEMBER inline bool contains(const Point2<scalar_t>& p) const
+    {
+        scalar_t cr = cos(rotation), sr = sin(rotation);
+        scalar_t dx = p.x - center.x, dy = p.y - center.y;
+        scalar_t u = (cr*dx + sr*dy) / a, v = (cr*dy - sr*dx) / b;
+        return u*u + v*v < 1;
+    }
+
+    CUDA_CALLABLE_MEMBER inline void zero()
+    {
+        center.x = center.y = a = b = rotation = 0;
+    }
+};
+
+constexpr uint8_t _EllipseSamples = 16;
+
+// Create the ellipse of a 2D gaussian, the axes are scaled by the given number of standard deviations
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+Ellipse2<scalar_t> ellipse2_from_covariance(const scalar_t &x, const scalar_t &y,
+    const scalar_t &sxx, const scalar_t &sxy, const scalar_t &syy, const scalar_t &nsigma = 1)
+{
+    scalar_t mean = (sxx + syy) / 2, diff = hypot((sxx - syy) / 2, sxy);
+    Ellipse2<scalar_t> e;
+    e.center.x = x; e.center.y = y;
+    e.a = nsigma * sqrt(mean + diff);
+    e.b = nsigma * sqrt(_max(mean - diff, scalar_t(0)));
+    e.rotation = atan2(2 * sxy, sxx - syy) / 2;
+    return e;
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t area(const Ellipse2<scalar_t> &e)
+{
+    return _pi * e.a * e.b;
+}
+
+// Map the polygon into the frame where the ellipse is the unit circle
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+Poly2<scalar_t, MaxPoints> _to_unit_frame(const Poly2<scalar_t, MaxPoints> &p, const Ellipse2<scalar_t> &e)
+{
+    scalar_t cr = cos(e.rotation), sr = sin(e.rotation);
+    Poly2<scalar_t, MaxPoints> result;
+    result.nvertices = p.nvertices;
+    for (uint8_t i = 0; i < p.nvertices; i++)
+    {
+        scalar_t dx = p.vertices[i].x - e.center.x, dy = p.vertices[i].y - e.center.y;
+        result.vertices[i].x = (cr*dx + sr*dy) / e.a;
+        result.vertices[i].y = (cr*dy - sr*dx) / e.b;
+    }
+    return result;
+}
+
+// Calculate the area of the part of polygon p inside the ellipse e
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+scalar_t intersection_area(const Poly2<scalar_t, MaxPoints> &p, const Ellipse2<scalar_t> &e)
+{
+    Circle2<scalar_t> unit; unit.radius = 1;
+    return intersection_area(_to_unit_frame(p, e), unit) * e.a * e.b;
+}
+
+// Check whether polygon p and ellipse e overlap, the affine map to the unit frame shears the polygon
+// but keeps whether the shapes overlap
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+bool intersects(const Poly2<scalar_t, MaxPoints> &p, const Ellipse2<scalar_t> &e)
+{
+    Circle2<scalar_t> unit; unit.radius = 1;
+    return intersects(_to_unit_frame(p, e), unit);
+}
+
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+void intersection_area_grad(const Poly2<scalar_t, MaxPoints> &p, const Ellipse2<scalar_t> &e, const scalar_t &grad,
+    Poly2<scalar_t, MaxPoints> &grad_p, Ellipse2<scalar_t> &grad_e)
+{
+    grad_p.nvertices = p.nvertices;
+    Poly2<scalar_t, MaxPoints> pu = _to_unit_frame(p, e), grad_pu;
+    Circle2<scalar_t> unit, grad_unit; unit.radius = 1;
+    grad_pu.zero(); grad_unit.zero();
+    scalar_t ab = e.a * e.b;
+    intersection_area_grad(pu, unit, grad * ab, grad_pu, grad_unit);
+
+    scalar_t cr = cos(e.rotation), sr = sin(e.rotation);
+    scalar_t unit_area = intersection_area(pu, unit);
+    grad_e.a += grad * e.b * unit_area;
+    grad_e.b += grad * e.a * unit_area;
+    for (uint8_t i = 0; i < p.nvertices; i++)
+    {
+        const Point2<scalar_t> &u = pu.vertices[i], &g = grad_pu.vertices[i];
+        scalar_t gx = g.x / e.a, gy = g.y / e.b; // gradient w.r.t. the rotated offset
+        scalar_t vx = cr*gx - sr*gy, vy = sr*gx + cr*gy; // rotate back to world frame
+        grad_p.vertices[i].x += vx;
+        grad_p.vertices[i].y += vy;
+        grad_e.center.x -= vx;
+        grad_e.center.y -= vy;
+        grad_e.a -= g.x * u.x / e.a;
+        grad_e.b -= g.y * u.y / e.b;
+        grad_e.rotation += gx * u.y * e.b - gy * u.x * e.a;
+    }
+}
+
+// Boundary of an ellipse relative to the frame of another one: w(t) = p + M * (cos t, sin t),
+// where the other ellipse is the unit circle
+template <typename scalar_t> struct _EllipseInFrame
+{
+    scalar_t px, py, m00, m01, m10, m11;
+
+    CUDA_CALLABLE_MEMBER inline scalar_t eval(const scalar_t &c, const scalar_t &s) const
+    {
+        scalar_t wx = px + m00*c + m01*s, wy = py + m10*c + m11*s;
+        return wx*wx + wy*wy - 1;
+    }
+    CUDA_CALLABLE_MEMBER inline scalar_t eval(const scalar_t &t) const
+    {
+        return eval(cos(t), sin(t));
+    }
+};
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+_EllipseInFrame<scalar_t> _ellipse_in_frame(const Ellipse2<scalar_t> &e, const Ellipse2<scalar_t> &frame)
+{
+    scalar_t cf = cos(frame.rotation), sf = sin(frame.rotation);
+    scalar_t dr = e.rotation - frame.rotation, cd = cos(dr), sd = sin(dr);
+    scalar_t dx = e.center.x - frame.center.x, dy = e.center.y - frame.center.y;
+    _EllipseInFrame<scalar_t> f;
+    f.px = (cf*dx + sf*dy) / frame.a;
+    f.py = (cf*dy - sf*dx) / frame.b;
+    f.m00 = cd * e.a / frame.a; f.m01 = -sd * e.b / frame.a;
+    f.m10 = sd * e.a / frame.b; f.m11 = cd * e.b / frame.b;
+    return f;
+}
+
+// Refine the crossing of the unit circle bracketed in [lo, hi] with Newton's method, safeguarded by bisection
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t _ellipse_refine_crossing(const _EllipseInFrame<scalar_t> &f, scalar_t lo, scalar_t hi, scalar_t glo, scalar_t ghi)
+{
+    scalar_t t = (lo*ghi - hi*glo) / (ghi - glo);
+    for (uint8_t it = 0; it < 32; it++)
+    {
+        scalar_t c = cos(t), s = sin(t);
+        scalar_t wx = f.px + f.m00*c + f.m01*s, wy = f.py + f.m10*c + f.m11*s;
+        scalar_t g = wx*wx + wy*wy - 1;
+        scalar_t dg = 2 * (wx * (f.m01*c - f.m00*s) + wy * (f.m11*c - f.m10*s));
+        if (abs(g) <= Numeric<scalar_t>::eps() * abs(dg))
+            break;
+        if ((g <= 0) == (glo <= 0)) lo = t;
+        else hi = t;
+
+        t -= g / dg;
+        if (!(t > lo && t < hi)) // also catches dg == 0
+            t = (lo + hi) / 2;
+    }
+    return t;
+}
+
+// Find the crossings of the boundary of an ellipse with the unit circle (parameters of the ellipse),
+// returns the number of crossings
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+uint8_t _ellipse_crossings(const _EllipseInFrame<scalar_t> &f, scalar_t roots[4])
+{
+    const scalar_t step = 2 * _pi / _EllipseSamples, cstep = cos(step), sstep = sin(step);
+    scalar_t gs[_EllipseSamples];
+    scalar_t c = 1, s = 0;
+    for (uint8_t k = 0; k < _EllipseSamples; k++)
+    {
+        gs[k] = f.eval(c, s);
+        scalar_t cn = c*cstep - s*sstep, sn = s*cstep + c*sstep;
+        c = cn; s = sn;
+    }
+
+    // crossings bracketed by the samples
+    uint8_t nroots = 0;
+    for (uint8_t k = 0; k < _EllipseSamples && nroots < 4; k++)
+    {
+        scalar_t g0 = gs[k], g1 = gs[_mod_inc(k, _EllipseSamples)];
+        if ((g0 <= 0) != (g1 <= 0))
+            roots[nroots++] = _ellipse_refine_crossing(f, k * step, (k + 1) * step, g0, g1);
+    }
+
+    // two crossings between neighbouring samples show up as a local extremum close to zero, which is
+    // located by golden section search and splits them into two brackets
+    for (uint8_t k = 0; k < _EllipseSamples && nroots < 3; k++)
+    {
+        scalar_t gp = gs[_mod_dec(k, _EllipseSamples)], g0 = gs[k], gn = gs[_mod_inc(k, _EllipseSamples)];
+        scalar_t sign = g0 > 0 ? 1 : -1; // search for minimum if outside, maximum if inside
+        if ((gp <= 0) != (g0 <= 0) || (gn <= 0) != (g0 <= 0) || sign*gp < sign*g0 || sign*gn < sign*g0)
+            continue;
+        scalar_t curvature = gp - 2*g0 + gn;
+        if (sign * curvature <= 0 || abs(g0) > curvature * sign) // far from zero, no crossing
+            continue;
+
+        const scalar_t ratio = 0.3819660112501051;
+        scalar_t lo = (scalar_t(k) - 1) * step, hi = (scalar_t(k) + 1) * step;
+        scalar_t t1 = lo + ratio * (hi - lo), t2 = hi - ratio * (hi - lo);
+        scalar_t g1 = sign * f.eval(t1), g2 = sign * f.eval(t2);
+        for (uint8_t it = 0; it < 40 && g1 > 0 && g2 > 0; it++)
+        {
+            if (g1 < g2) { hi = t2; t2 = t1; g2 = g1; t1 = lo + ratio * (hi - lo); g1 = sign * f.eval(t1); }
+            else { lo = t1; t1 = t2; g1 = g2; t2 = hi - ratio * (hi - lo); g2 = sign * f.eval(t2); }
+        }
+        scalar_t tm = g1 < g2 ? t1 : t2, gm = sign * (g1 < g2 ? g1 : g2);
+        if ((gm <= 0) == (g0 <= 0))
+            continue;
+        roots[nroots++] = _ellipse_refine_crossing(f, (scalar_t(k) - 1) * step, tm, gp, gm);
+        roots[nroots++] = _ellipse_refine_crossing(f, tm, (scalar_t(k) + 1) * step, gm, gn);
+    }
+    return nroots;
+}
+
+// Parameter (in [0, 2pi)) of the point on the unit circle, which is the boundary point of f at parameter t
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t _ellipse_param_on_circle(const _EllipseInFrame<scalar_t> &f, const scalar_t &t)
+{
+    scalar_t c = cos(t), s = sin(t);
+    scalar_t theta = atan2(f.py + f.m10*c + f.m11*s, f.px + f.m00*c + f.m01*s);
+    return theta < 0 ? theta + 2 * _pi : theta;
+}
+
+// Insert a crossing into the sorted list, near duplicates are merged
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void _insert_crossing(scalar_t roots[8], uint8_t &n, const scalar_t &t)
+{
+    const scalar_t tol = sqrt(Numeric<scalar_t>::eps());
+    for (uint8_t k = 0; k < n; k++)
+    {
+        scalar_t d = abs(roots[k] - t);
+        if (d < tol || 2 * _pi - d < tol)
+            return;
+    }
+    uint8_t k = n++;
+    for (; k > 0 && roots[k-1] > t; k--)
+        roots[k] = roots[k-1];
+    roots[k] = t;
+}
+
+// Collect the parameter intervals between the crossings where the boundary is inside the unit circle
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+uint8_t _ellipse_arcs_from_crossings(const _EllipseInFrame<scalar_t> &f, const scalar_t roots[8],
+    const uint8_t nroots, scalar_t arcs[8][2])
+{
+    if (nroots == 0) // the boundary is either inside or outside
+    {
+        if (f.eval(scalar_t(0)) > 0)
+            return 0;
+        arcs[0][0] = 0; arcs[0][1] = 2 * _pi;
+        return 1;
+    }
+
+    uint8_t narcs = 0;
+    for (uint8_t k = 0; k < nroots; k++)
+    {
+        scalar_t t0 = roots[k], t1 = (k + 1 < nroots) ? roots[k+1] : roots[0] + 2 * _pi;
+        // the boundaries may be tangent at the middle point, then the value with the largest magnitude decides
+        scalar_t g = f.eval((t0 + t1) / 2);
+        if (abs(g) < sqrt(Numeric<scalar_t>::eps()))
+            for (uint8_t q = 1; q < 4; q += 2)
+            {
+                scalar_t gq = f.eval(t0 + (t1 - t0) * q / 4);
+                if (abs(gq) > abs(g)) g = gq;
+            }
+        if (g > 0)
+            continue;
+        if (narcs > 0 && arcs[narcs-1][1] == t0) // merge with the previous arc (after a tangent crossing)
+            arcs[narcs-1][1] = t1;
+        else
+        {
+            arcs[narcs][0] = t0; arcs[narcs][1] = t1;
+            narcs++;
+        }
+    }
+    return narcs;
+}
+
+// Find the parameter intervals of the boundary of each ellipse inside the other one. The crossings found
+// on both boundaries are merged, so that a lens missed by the sampling on one ellipse is still found
+// if it's resolved on the other one.
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void _ellipse_overlap_arcs(const Ellipse2<scalar_t> &e1, const Ellipse2<scalar_t> &e2,
+    scalar_t arcs1[8][2], uint8_t &n1, scalar_t arcs2[8][2], uint8_t &n2)
+{
+    _EllipseInFrame<scalar_t> f12 = _ellipse_in_frame(e1, e2), f21 = _ellipse_in_frame(e2, e1);
+    scalar_t found1[4], found2[4], roots1[8], roots2[8];
+    uint8_t nf1 = _ellipse_crossings(f12, found1), nf2 = _ellipse_crossings(f21, found2);
+    uint8_t nr1 = 0, nr2 = 0;
+    for (uint8_t k = 0; k < nf1; k++)
+    {
+        _insert_crossing(roots1, nr1, found1[k] < 0 ? found1[k] + scalar_t(2 * _pi) : found1[k]);
+        _insert_crossing(roots2, nr2, _ellipse_param_on_circle(f12, found1[k]));
+    }
+    for (uint8_t k = 0; k < nf2; k++)
+    {
+        _insert_crossing(roots2, nr2, found2[k] < 0 ? found2[k] + scalar_t(2 * _pi) : found2[k]);
+        _insert_crossing(roots1, nr1, _ellipse_param_on_circle(f21, found2[k]));
+    }
+
+    n1 = _ellipse_arcs_from_crossings(f12, roots1, nr1, arcs1);
+    n2 = _ellipse_arcs_from_crossings(f21, roots2, nr2, arcs2);
+    if (nr1 == 0 && nr2 == 0 && n1 > 0 && n2 > 0) // coincident ellipses
+        n2 = 0;
+}
+
+// Area contribution of the arcs by Green's theorem, with the origin at o
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t _ellipse_arcs_area(const Ellipse2<scalar_t> &e, const Point2<scalar_t> &o,
+    const scalar_t arcs[8][2], const uint8_t narcs)
+{
+    scalar_t cr = cos(e.rotation), sr = sin(e.rotation);
+    scalar_t ox = e.center.x - o.x, oy = e.center.y - o.y, result = 0;
+    for (uint8_t k = 0; k < narcs; k++)
+    {
+        scalar_t t0 = arcs[k][0], t1 = arcs[k][1];
+        scalar_t lx = e.a * (cos(t1) - cos(t0)), ly = e.b * (sin(t1) - sin(t0));
+        scalar_t dx = cr*lx - sr*ly, dy = sr*lx + cr*ly;
+        result += (e.a * e.b * (t1 - t0) + ox*dy - oy*dx) / 2;
+    }
+    return result;
+}
+
+// Gradient of the area enclosed by the arcs w.r.t. the ellipse parameters (by the boundary velocity)
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void _ellipse_arcs_area_grad(const Ellipse2<scalar_t> &e, const scalar_t arcs[8][2], const uint8_t narcs,
+    const scalar_t &grad, Ellipse2<scalar_t> &grad_e)
+{
+    scalar_t cr = cos(e.rotation), sr = sin(e.rotation);
+    for (uint8_t k = 0; k < narcs; k++)
+    {
+        scalar_t t0 = arcs[k][0], t1 = arcs[k][1];
+        scalar_t lx = e.a * (cos(t1) - cos(t0)), ly = e.b * (sin(t1) - sin(t0));
+        scalar_t dx = cr*lx - sr*ly, dy = sr*lx + cr*ly;
+        scalar_t s20 = sin(2*t0), s21 = sin(2*t1), st0 = sin(t0), st1 = sin(t1);
+        grad_e.center.x += grad * dy;
+        grad_e.center.y -= grad * dx;
+        grad_e.a += grad * e.b * ((t1 - t0) / 2 + (s21 - s20) / 4);
+        grad_e.b += grad * e.a * ((t1 - t0) / 2 - (s21 - s20) / 4);
+        grad_e.rotation += grad * (e.a*e.a - e.b*e.b) * (st1*st1 - st0*st0) / 2;
+    }
+}
+
+// Calculate the area of the intersection of two ellipses
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t intersection_area(const Ellipse2<scalar_t> &e1, const Ellipse2<scalar_t> &e2)
+{
+    scalar_t arcs1[8][2], arcs2[8][2]; uint8_t n1, n2;
+    _ellipse_overlap_arcs(e1, e2, arcs1, n1, arcs2, n2);
+    return _max(_ellipse_arcs_area(e1, e1.center, arcs1, n1)
+        + _ellipse_arcs_area(e2, e1.center, arcs2, n2), scalar_t(0));
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t iou(const Ellipse2<scalar_t> &e1, const Ellipse2<scalar_t> &e2)
+{
+    scalar_t area_i = intersection_area(e1, e2);
+    scalar_t area_u = area(e1) + area(e2) - area_i;
+    return area_i / area_u;
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void intersection_area_grad(const Ellipse2<scalar_t> &e1, const Ellipse2<scalar_t> &e2, const scalar_t &grad,
+    Ellipse2<scalar_t> &grad_e1, Ellipse2<scalar_t> &grad_e2)
+{
+    scalar_t arcs1[8][2], arcs2[8][2]; uint8_t n1, n2;
+    _ellipse_overlap_arcs(e1, e2, arcs1, n1, arcs2, n2);
+    _ellipse_arcs_area_grad(e1, arcs1, n1, grad, grad_e1);
+    _ellipse_arcs_area_grad(e2, arcs2, n2, grad, grad_e2);
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+void iou_grad(const Ellipse2<scalar_t> &e1, const Ellipse2<scalar_t> &e2, const scalar_t &grad,
+    Ellipse2<scalar_t> &grad_e1, Ellipse2<scalar_t> &grad_e2)
+{
+    scalar_t arcs1[8][2], arcs2[8][2]; uint8_t n1, n2;
+    _ellipse_overlap_arcs(e1, e2, arcs1, n1, arcs2, n2);
+    scalar_t area_i = _max(_ellipse_arcs_area(e1, e1.center, arcs1, n1)
+        + _ellipse_arcs_area(e2, e1.center, arcs2, n2), scalar_t(0));
+    scalar_t area_u = area(e1) + area(e2) - area_i;
+
+    // d(iou) = (d(area_i) * area_u - area_i * (d(area1) + d(area2) - d(area_i))) / area_u^2
+    scalar_t grad_i = grad * (area_u + area_i) / (area_u * area_u);
+    scalar_t grad_u = -grad * area_i / (area_u * area_u);
+    _ellipse_arcs_area_grad(e1, arcs1, n1, grad_i, grad_e1);
+    _ellipse_arcs_area_grad(e2, arcs2, n2, grad_i, grad_e2);
+    grad_e1.a += grad_u * _pi * e1.b; grad_e1.b += grad_u * _pi * e1.a;
+    grad_e2.a += grad_u * _pi * e2.b; grad_e2.b += grad_u * _pi * e2.a;
+}
+
+// Ellipses with non-positive (or NaN) semi-axes have no area, the pairs with them are degenerate
+template <typename scalar_t> inline
+bool _valid_operand(const Ellipse2<scalar_t> &e)
+{
+    return e.a > 0 && e.b > 0;
+}
+
+// Calculate the IoUs of n pairs of ellipses in parallel. Degenerate pairs get zero IoU,
+// and the PairStatus of each pair is stored in status if it's not null
+template <typename scalar_t> inline
+void iou_batch(const Ellipse2<scalar_t> *e1, const Ellipse2<scalar_t> *e2, size_t n, scalar_t *ious,
+    uint8_t *status = nullptr)
+{
+    parallel_for(0, n, [&](size_t i) {
+        PairStatus si = PairStatus::Degenerate;
+        ious[i] = 0;
+        if (_valid_operand(e1[i]) && _valid_operand(e2[i]))
+        {
+            ious[i] = iou(e1[i], e2[i]);
+            si = ious[i] > 0 ? PairStatus::Ok : PairStatus::Empty;
+        }
+        if (status != nullptr) status[i] = uint8_t(si);
+    }, 64);
+}
+
+// Calculate the gradients of iou_batch, the outputs are overwritten. Degenerate pairs get zero gradients
+template <typename scalar_t> inline
+void iou_batch_grad(const Ellipse2<scalar_t> *e1, const Ellipse2<scalar_t> *e2, size_t n, const scalar_t *grads,
+    Ellipse2<scalar_t> *grad_e1, Ellipse2<scalar_t> *grad_e2, uint8_t *status = nullptr)
+{
+    parallel_for(0, n, [&](size_t i) {
+        grad_e1[i].zero(); grad_e2[i].zero();
+        bool valid = _valid_operand(e1[i]) && _valid_operand(e2[i]);
+        if (valid)
+            iou_grad(e1[i], e2[i], grads[i], grad_e1[i], grad_e2[i]);
+        if (status != nullptr) status[i] = uint8_t(valid ? PairStatus::Ok : PairStatus::Degenerate);
+    }, 64);
+}
+
+} // namespace dgal
+
+#endif // DGAL_ELLIPSE_HPP
@@ -0,0 +1,350 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains an evaluator of (rotated) object detection metrics in the style of KITTI and DOTA.
+ * Frames are streamed into the evaluator and the matches are accumulated into score histograms, so
+ * the memory usage doesn't grow with the number of frames.
+ *
+ * Metrics:
+ *      .ap: average precision
+ *      .aos: average orientation similarity (ref "Are we ready for Autonomous Driving? The KITTI Vision Benchmark Suite")
+ *
+ * Ground truths with difficulty larger than the evaluated level are ignored, detections matched to
+ * them are neither true nor false positives. Ground truths with negative difficulty are always ignored.
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_EVALUATION_HPP
+#define DGAL_EVALUATION_HPP
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "dgal/geometry.hpp"
+#include "dgal/geometry_batch.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+template <typename scalar_t, uint8_t MaxPoints = 4> struct EvalDetection
+{
+    Poly2<scalar_t, MaxPoints> shape;
+    scalar_t score = 0; // contract: score is in [0, 1]
+    scalar_t alpha = 0; // observation angle, only used by AOS
+    int32_t label = 0;
+};
+
+template <typename scalar_t, uint8_t MaxPoints = 4> struct EvalAnnotation
+{
+    Poly2<scalar_t, MaxPoints> shape;
+    scalar_t alpha = 0;
+    int32_t label = 0;
+    int8_t difficulty = 0;
+};
+
+template <typename scalar_t, uint8_t MaxPoints = 4> struct EvalFrame
+{
+    const EvalDetection<scalar_t, MaxPoints> *detections = nullptr;
+    size_t ndetections = 0;
+    const EvalAnnotation<scalar_t, MaxPoints> *annotations = nullptr;
+    size_t nannotations = 0;
+};
+
+struct EvalMetrics
+{
+    double ap = 0, aos = 0;
+    size_t ngt = 0; // number of effective ground truths
+    size_t ntp = 0, nfp = 0;
+};
+
+template <typename scalar_t, uint8_t MaxPoints = 4> class APEvaluator
+{
+public:
+    using Detection = EvalDetection<scalar_t, MaxPoints>;
+    using Annotation = EvalAnnotation<scalar_t, MaxPoints>;
+    using Frame = EvalFrame<scalar_t, MaxPoints>;
+
+    APEvaluator(int32_t nclasses, const std::vector<scalar_t> &iou_thresholds,
+        int8_t ndifficulties = 1, size_t nbins = 1024)
+        : _nclasses(nclasses), _ndifficulties(ndifficulties), _nbins(nbins),
+          _thresholds(iou_thresholds), _acc(_accumulator_size())
+    {}
+
+    int32_t nclasses() const { return _nclasses; }
+    int8_t ndifficulties() const { return _ndifficulties; }
+    const std::vector<scalar_t>& iou_thresholds() const { return _thresholds; }
+
+    void reset() { _acc = Accumulator(_accumulator_size()); }
+
+    void add_frame(const Frame &frame)
+    {
+        Scratch scratch;
+        _process_frame(frame, scratch, _acc);
+    }
+
+    // process multiple frames in parallel, the results are identical to adding them one by one
+    void add_frames(const Frame *frames, size_t nframes)
+    {
+        ThreadPool &pool = ThreadPool::global();
+        size_t nchunks = std::min(pool.size(), nframes);
+        if (nchunks <= 1)
+        {
+            for (size_t i = 0; i < nframes; i++)
+                add_frame(frames[i]);
+            return;
+        }
+
+        std::vector<Accumulator> partial(nchunks, Accumulator(_accumulator_size()));
+        pool.parallel_for(0, nchunks, [&](size_t c)
+        {
+            Scratch scratch;
+            for (size_t i = c * nframes / nchunks; i < (c + 1) * nframes / nchunks; i++)
+                _process_frame(frames[i], scratch, partial[c]);
+        });
+        for (const auto &acc : partial)
+            _acc.merge(acc);
+    }
+
+    // merge results from another evaluator with the same configuration
+    void merge(const APEvaluator &other) { _acc.merge(other._acc); }
+
+    // nrecall is the number of sampled recall points (40 for KITTI, 11 for VOC07),
+    // use 0 for the area under the whole interpolated precision-recall curve.
+    // Throw std::out_of_range if the label, difficulty or threshold index is out of range
+    EvalMetrics evaluate(int32_t label, int8_t difficulty, size_t threshold_index, size_t nrecall = 40) const
+    {
+        if (label < 0 || label >= _nclasses)
+            throw std::out_of_range("label " + std::to_string(label) + " is out of range");
+        if (difficulty < 0 || difficulty >= _ndifficulties)
+            throw std::out_of_range("difficulty " + std::to_string(difficulty) + " is out of range");
+        if (threshold_index >= _thresholds.size())
+            throw std::out_of_range("threshold index " + std::to_string(threshold_index) + " is out of range");
+
+        EvalMetrics metrics;
+        metrics.ngt = _acc.ngt[label * _ndifficulties + difficulty];
+
+        // build the precision-recall curve from high scores to low scores
+        std::vector<double> recall, precision, similarity;
+        size_t offset = _bin_offset(label, difficulty, threshold_index);
+        double sim = 0;
+        for (size_t b = _nbins; b-- > 0;)
+        {
+            uint64_t tp = _acc.tp[offset + b], fp = _acc.fp[offset + b];
+            if (tp + fp == 0) continue;
+            metrics.ntp += tp;
+            metrics.nfp += fp;
+            sim += _acc.sim[offset + b];
+            recall.push_back(metrics.ngt > 0 ? double(metrics.ntp) / metrics.ngt : 0);
+            precision.push_back(double(metrics.ntp) / (metrics.ntp + metrics.nfp));
+            similarity.push_back(sim / (metrics.ntp + metrics.nfp));
+        }
+        if (metrics.ngt == 0 || recall.empty())
+            return metrics;
+
+        // make the precisions monotonic
+        for (size_t k = recall.size() - 1; k-- > 0;)
+        {
+            precision[k] = std::max(precision[k], precision[k+1]);
+            similarity[k] = std::max(similarity[k], similarity[k+1]);
+        }
+
+        if (nrecall > 0)
+        {
+            size_t k = 0;
+            for (size_t r = 1; r <= nrecall; r++)
+            {
+                double rthres = double(r) / nrecall;
+                while (k < recall.size() && recall[k] < rthres) k++;
+                if (k == recall.size()) break;
+                metrics.ap += precision[k];
+                metrics.aos += similarity[k];
+            }
+            metrics.ap /= nrecall;
+            metrics.aos /= nrecall;
+        }
+        else
+        {
+            double rlast = 0;
+            for (size_t k = 0; k < recall.size(); k++)
+            {
+                metrics.ap += (recall[k] - rlast) * precision[k];
+                metrics.aos += (recall[k] - rlast) * similarity[k];
+                rlast = recall[k];
+            }
+        }
+        return metrics;
+    }
+
+private:
+    struct Accumulator
+    {
+        std::vector<uint64_t> tp, fp, ngt;
+        std::vector<double> sim;
+
+        Accumulator(std::pair<size_t, size_t> size)
+            : tp(size.first), fp(size.first), ngt(size.second), sim(size.first) {}
+
+        void merge(const Accumulator &other)
+        {
+            for (size_t i = 0; i < tp.size(); i++)
+            {
+                tp[i] += other.tp[i];
+                fp[i] += other.fp[i];
+                sim[i] += other.sim[i];
+            }
+            for (size_t i = 0; i < ngt.size(); i++)
+                ngt[i] += other.ngt[i];
+        }
+    };
+
+    // buffers reused across frames
+    struct Scratch
+    {
+        std::vector<uint32_t> det_order, gt_order;
+        std::vector<Poly2<scalar_t, MaxPoints>> det_shapes, gt_shapes;
+        std::vector<SparseEntry<scalar_t>> ious;
+        std::vector<uint32_t> det_offsets;
+        std::vector<bool> taken;
+    };
+
+    std::pair<size_t, size_t> _accumulator_size() const
+    {
+        size_t ngroups = size_t(_nclasses) * _ndifficulties;
+        return {ngroups * _thresholds.size() * _nbins, ngroups};
+    }
+
+    size_t _bin_offset(int32_t label, int8_t difficulty, size_t threshold_index) const
+    {
+        return ((size_t(label) * _ndifficulties + difficulty) * _thresholds.size() + threshold_index) * _nbins;
+    }
+
+    size_t _bin(const scalar_t &score) const
+    {
+        if (!(score > 0)) return 0;
+        return std::min(_nbins - 1, size_t(score * _nbins));
+    }
+
+    static bool _ignored(const Annotation &gt, int8_t difficulty)
+    {
+        return gt.difficulty < 0 || gt.difficulty > difficulty;
+    }
+
+    void _process_frame(const Frame &frame, Scratch &s, Accumulator &acc) const
+    {
+        // sort the objects by label and then by score, so that each class is a contiguous range
+        const Detection *dets = frame.detections;
+        const Annotation *gts = frame.annotations;
+        s.det_order.resize(frame.ndetections);
+        std::iota(s.det_order.begin(), s.det_order.end(), 0);
+        std::sort(s.det_order.begin(), s.det_order.end(), [dets](uint32_t a, uint32_t b) {
+            return dets[a].label < dets[b].label ||
+                (dets[a].label == dets[b].label && dets[a].score > dets[b].score);
+        });
+        s.gt_order.resize(frame.nannotations);
+        std::iota(s.gt_order.begin(), s.gt_order.end(), 0);
+        std::stable_sort(s.gt_order.begin(), s.gt_order.end(), [gts](uint32_t a, uint32_t b) {
+            return gts[a].label < gts[b].label;
+        });
+        s.det_shapes.resize(frame.ndetections);
+        for (size_t i = 0; i < frame.ndetections; i++)
+            s.det_shapes[i] = dets[s.det_order[i]].shape;
+        s.gt_shapes.resize(frame.nannotations);
+        for (size_t i = 0; i < frame.nannotations; i++)
+            s.gt_shapes[i] = gts[s.gt_order[i]].shape;
+
+        size_t di = 0, gi = 0;
+        for (int32_t label = 0; label < _nclasses; label++)
+        {
+            while (di < frame.ndetections && dets[s.det_order[di]].label < label) di++;
+            while (gi < frame.nannotations && gts[s.gt_order[gi]].label < label) gi++;
+            size_t dend = di, gend = gi;
+            while (dend < frame.ndetections && dets[s.det_order[dend]].label == label) dend++;
+            while (gend < frame.nannotations && gts[s.gt_order[gend]].label == label) gend++;
+            size_t nd = dend - di, ng = gend - gi;
+
+            // the sparse ious are calculated once and shared by all thresholds and difficulties
+            s.ious.clear();
+            iou_sparse(s.det_shapes.data() + di, nd, s.gt_shapes.data() + gi, ng, s.ious);
+            s.det_offsets.assign(nd + 1, 0);
+            for (const auto &e : s.ious)
+                s.det_offsets[e.i + 1]++;
+            for (size_t k = 0; k < nd; k++)
+                s.det_offsets[k + 1] += s.det_offsets[k];
+
+            for (int8_t d = 0; d < _ndifficulties; d++)
+            {
+                size_t ngt = 0;
+                for (size_t j = gi; j < gend; j++)
+                    if (!_ignored(gts[s.gt_order[j]], d)) ngt++;
+                acc.ngt[label * _ndifficulties + d] += ngt;
+
+                for (size_t t = 0; t < _thresholds.size(); t++)
+                {
+                    size_t offset = _bin_offset(label, d, t);
+                    s.taken.assign(ng, false);
+                    for (size_t i = 0; i < nd; i++) // greedy matching in descending score
+                    {
+                        const Detection &det = dets[s.det_order[di + i]];
+                        int64_t best = -1; bool hit_ignored = false;
+                        scalar_t best_iou = 0;
+                        for (size_t k = s.det_offsets[i]; k < s.det_offsets[i + 1]; k++)
+                        {
+                            const auto &e = s.ious[k];
+                            if (e.value < _thresholds[t]) continue;
+                            if (_ignored(gts[s.gt_order[gi + e.j]], d))
+                                hit_ignored = true;
+                            else if (!s.taken[e.j] && e.value > best_iou)
+                            {
+                                best = e.j;
+                                best_iou = e.value;
+                            }
+                        }
+
+                        size_t bin = offset + _bin(det.score);
+                        if (best >= 0)
+                        {
+                            s.taken[best] = true;
+                            acc.tp[bin]++;
+                            acc.sim[bin] += (1 + cos(det.alpha - gts[s.gt_order[gi + best]].alpha)) / 2;
+                        }
+                        else if (!hit_ignored)
+                            acc.fp[bin]++;
+                    }
+                }
+            }
+            di = dend; gi = gend;
+        }
+    }
+
+    int32_t _nclasses;
+    int8_t _ndifficulties;
+    size_t _nbins;
+    std::vector<scalar_t> _thresholds;
+    Accumulator _acc;
+};
+
+} // namespace dgal
+
+#endif // DGAL_EVALUATION_HPP
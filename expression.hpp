@@ -0,0 +1,267 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a lazy expression layer over the geometry operations. The functions in namespace
+ * dgal::lazy have the same names as the eager ones but return expression nodes, and the reductions
+ * (area, dimension, iou) evaluate the whole chain at once. Intermediate polygons are skipped when a
+ * fused kernel exists:
+ *      area(intersect(a, b)): boundary integral (Green's theorem) over the edges of a clipped by b and
+ *          the edges of b clipped by a, the intersection polygon is not constructed. Configurations with
+ *          a vertex on an edge line of the other polygon (e.g. shared edges) fall back to the eager path
+ *      dimension(merge(a, b)): max distance between the vertices of a and b, the convex hull is
+ *          not constructed
+ *      area/dimension(poly2_from_xywhr(...)): calculated from w and h directly
+ * Other chains fall back to materializing the operands with eval().
+ *
+ * Example:
+ *      scalar_t a = lazy::area(lazy::intersect(lazy::poly2_from_xywhr(x1, y1, w1, h1, r1), p2));
+ */
+
+#ifndef DGAL_EXPRESSION_HPP
+#define DGAL_EXPRESSION_HPP
+
+#include <type_traits>
+#include "dgal/geometry.hpp"
+
+namespace dgal {
+namespace lazy {
+
+// Base of expression nodes, Derived::eval() materializes the polygon
+template <typename Derived> struct Expr
+{
+    CUDA_CALLABLE_MEMBER inline const Derived& derived() const { return static_cast<const Derived&>(*this); }
+};
+
+// Reference to an existing polygon
+template <typename scalar_t, uint8_t MaxPoints> struct PolyRef : Expr<PolyRef<scalar_t, MaxPoints>>
+{
+    using scalar_type = scalar_t;
+    static constexpr uint8_t max_points = MaxPoints;
+    const Poly2<scalar_t, MaxPoints> &p;
+
+    CUDA_CALLABLE_MEMBER inline explicit PolyRef(const Poly2<scalar_t, MaxPoints> &p_) : p(p_) {}
+    CUDA_CALLABLE_MEMBER inline const Poly2<scalar_t, MaxPoints>& eval() const { return p; }
+};
+
+template <typename scalar_t> struct XywhrExpr : Expr<XywhrExpr<scalar_t>>
+{
+    using scalar_type = scalar_t;
+    static constexpr uint8_t max_points = 4;
+    scalar_t x, y, w, h, r;
+
+    CUDA_CALLABLE_MEMBER inline XywhrExpr(scalar_t x_, scalar_t y_, scalar_t w_, scalar_t h_, scalar_t r_)
+        : x(x_), y(y_), w(w_), h(h_), r(r_) {}
+    CUDA_CALLABLE_MEMBER inline Poly2<scalar_t, 4> eval() const { return dgal::poly2_from_xywhr(x, y, w, h, r); }
+};
+
+template <typename A, typename B> struct IntersectExpr : Expr<IntersectExpr<A, B>>
+{
+    using scalar_type = typename A::scalar_type;
+    static constexpr uint8_t max_points = A::max_points + B::max_points;
+    A a; B b;
+
+    CUDA_CALLABLE_MEMBER inline IntersectExpr(const A &a_, const B &b_) : a(a_), b(b_) {}
+    CUDA_CALLABLE_MEMBER inline Poly2<scalar_type, max_points> eval() const
+    {
+        uint8_t xflags[max_points];
+        return dgal::intersect(a.eval(), b.eval(), xflags);
+    }
+};
+
+template <typename A, typename B> struct MergeExpr : Expr<MergeExpr<A, B>>
+{
+    using scalar_type = typename A::scalar_type;
+    static constexpr uint8_t max_points = A::max_points + B::max_points;
+    A a; B b;
+
+    CUDA_CALLABLE_MEMBER inline MergeExpr(const A &a_, const B &b_) : a(a_), b(b_) {}
+    CUDA_CALLABLE_MEMBER inline Poly2<scalar_type, max_points> eval() const
+    {
+        uint8_t mflags[max_points];
+        return dgal::merge(a.eval(), b.eval(), mflags);
+    }
+};
+
+// Wrap polygons as PolyRef and keep expressions unchanged
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+PolyRef<scalar_t, MaxPoints> _wrap(const Poly2<scalar_t, MaxPoints> &p) { return PolyRef<scalar_t, MaxPoints>(p); }
+template <typename Derived> CUDA_CALLABLE_MEMBER inline
+const Derived& _wrap(const Expr<Derived> &e) { return e.derived(); }
+
+template <typename T> using _wrap_t = typename std::decay<decltype(_wrap(std::declval<const T&>()))>::type;
+
+///////////// constructors and operations //////////////
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+XywhrExpr<scalar_t> poly2_from_xywhr(const scalar_t &x, const scalar_t &y,
+    const scalar_t &w, const scalar_t &h, const scalar_t &r)
+{
+    return XywhrExpr<scalar_t>(x, y, w, h, r);
+}
+
+template <typename T1, typename T2> CUDA_CALLABLE_MEMBER inline
+IntersectExpr<_wrap_t<T1>, _wrap_t<T2>> intersect(const T1 &a, const T2 &b)
+{
+    return IntersectExpr<_wrap_t<T1>, _wrap_t<T2>>(_wrap(a), _wrap(b));
+}
+
+template <typename T1, typename T2> CUDA_CALLABLE_MEMBER inline
+MergeExpr<_wrap_t<T1>, _wrap_t<T2>> merge(const T1 &a, const T2 &b)
+{
+    return MergeExpr<_wrap_t<T1>, _wrap_t<T2>>(_wrap(a), _wrap(b));
+}
+
+template <typename Derived> CUDA_CALLABLE_MEMBER inline
+auto eval(const Expr<Derived> &e) -> decltype(e.derived().eval()) { return e.derived().eval(); }
+
+///////////// fused kernels //////////////
+
+// Side of t w.r.t. the line a->b (same sign as _cross), snapped to zero when the distance is within the
+// rounding error of the coordinates, which is larger than the error of the cross product itself for
+// polygons built from xywhr
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t _side_filtered(const Point2<scalar_t> &a, const Point2<scalar_t> &b, const Point2<scalar_t> &t)
+{
+    scalar_t dx = b.x - a.x, dy = b.y - a.y;
+    scalar_t f = dx * (t.y - b.y) - dy * (t.x - b.x);
+    scalar_t scale = (abs(dx) + abs(dy)) * (abs(b.x) + abs(b.y) + abs(t.x) + abs(t.y));
+    return abs(f) <= Numeric<scalar_t>::eps() * scale ? 0 : f;
+}
+
+// Clip segment s->e by the convex polygon q, return the parameter range [t0, t1] inside q. degenerate is
+// set when an end point is on an edge line of q, since whether a (nearly) shared edge should be counted
+// by the clipping of p or of q can't be decided consistently from one side.
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+bool _clip_segment(const Point2<scalar_t> &s, const Point2<scalar_t> &e, const Poly2<scalar_t, MaxPoints> &q,
+    scalar_t &t0, scalar_t &t1, bool &degenerate)
+{
+    t0 = 0; t1 = 1;
+    for (uint8_t i = 0; i < q.nvertices; i++)
+    {
+        const Point2<scalar_t> &qa = q.vertices[i], &qb = q.vertices[_mod_inc(i, q.nvertices)];
+        scalar_t f0 = _side_filtered(qa, qb, s), f1 = _side_filtered(qa, qb, e);
+        if (f0 == 0 || f1 == 0)
+        {
+            degenerate = true;
+            return false;
+        }
+        if (f0 < 0 && f1 < 0) return false;
+        if (f0 < 0) t0 = _max(t0, f0 / (f0 - f1));
+        else if (f1 < 0) t1 = _min(t1, f0 / (f0 - f1));
+        if (t0 >= t1) return false;
+    }
+    return true;
+}
+
+// Sum of the shoelace terms of the edges of p clipped by q, the sum is incomplete if degenerate is set
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> CUDA_CALLABLE_MEMBER inline
+scalar_t _clipped_boundary_integral(const Poly2<scalar_t, MaxPoints1> &p, const Poly2<scalar_t, MaxPoints2> &q,
+    bool &degenerate)
+{
+    scalar_t sum = 0, t0, t1;
+    for (uint8_t i = 0; i < p.nvertices && !degenerate; i++)
+    {
+        const Point2<scalar_t> &s = p.vertices[i], &e = p.vertices[_mod_inc(i, p.nvertices)];
+        if (!_clip_segment(s, e, q, t0, t1, degenerate)) continue;
+        scalar_t dx = e.x - s.x, dy = e.y - s.y;
+        scalar_t x0 = s.x + t0 * dx, y0 = s.y + t0 * dy;
+        scalar_t x1 = s.x + t1 * dx, y1 = s.y + t1 * dy;
+        sum += x0 * y1 - x1 * y0;
+    }
+    return sum;
+}
+
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> CUDA_CALLABLE_MEMBER inline
+scalar_t intersection_area(const Poly2<scalar_t, MaxPoints1> &p1, const Poly2<scalar_t, MaxPoints2> &p2)
+{
+    bool degenerate = false;
+    scalar_t sum = _clipped_boundary_integral(p1, p2, degenerate);
+    if (!degenerate)
+        sum += _clipped_boundary_integral(p2, p1, degenerate);
+    if (degenerate)
+        return dgal::area(dgal::intersect(p1, p2));
+    return _max<scalar_t>(sum / 2, 0);
+}
+
+// The diameter of the hull is the max distance between any two vertices of the two polygons,
+// which is found by brute force on squared distances (faster than hull + rotating caliper for small polygons)
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> CUDA_CALLABLE_MEMBER inline
+scalar_t merged_dimension(const Poly2<scalar_t, MaxPoints1> &p1, const Poly2<scalar_t, MaxPoints2> &p2)
+{
+    scalar_t dmax = 0;
+    for (uint8_t i = 0; i < p1.nvertices; i++)
+    {
+        const Point2<scalar_t> &u = p1.vertices[i];
+        for (uint8_t j = i + 1; j < p1.nvertices; j++)
+            dmax = _max(dmax, (u.x - p1.vertices[j].x) * (u.x - p1.vertices[j].x)
+                            + (u.y - p1.vertices[j].y) * (u.y - p1.vertices[j].y));
+        for (uint8_t j = 0; j < p2.nvertices; j++)
+            dmax = _max(dmax, (u.x - p2.vertices[j].x) * (u.x - p2.vertices[j].x)
+                            + (u.y - p2.vertices[j].y) * (u.y - p2.vertices[j].y));
+    }
+    for (uint8_t i = 0; i < p2.nvertices; i++)
+        for (uint8_t j = i + 1; j < p2.nvertices; j++)
+            dmax = _max(dmax, (p2.vertices[i].x - p2.vertices[j].x) * (p2.vertices[i].x - p2.vertices[j].x)
+                            + (p2.vertices[i].y - p2.vertices[j].y) * (p2.vertices[i].y - p2.vertices[j].y));
+    return sqrt(dmax);
+}
+
+///////////// reductions //////////////
+
+template <typename Derived> CUDA_CALLABLE_MEMBER inline
+typename Derived::scalar_type area(const Expr<Derived> &e) { return dgal::area(e.derived().eval()); }
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t area(const XywhrExpr<scalar_t> &e) { return e.w * e.h; }
+
+template <typename A, typename B> CUDA_CALLABLE_MEMBER inline
+typename A::scalar_type area(const IntersectExpr<A, B> &e) { return intersection_area(e.a.eval(), e.b.eval()); }
+
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+scalar_t area(const Poly2<scalar_t, MaxPoints> &p) { return dgal::area(p); }
+
+template <typename Derived> CUDA_CALLABLE_MEMBER inline
+typename Derived::scalar_type dimension(const Expr<Derived> &e) { return dgal::dimension(e.derived().eval()); }
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t dimension(const XywhrExpr<scalar_t> &e) { return hypot(e.w, e.h); }
+
+template <typename A, typename B> CUDA_CALLABLE_MEMBER inline
+typename A::scalar_type dimension(const MergeExpr<A, B> &e) { return merged_dimension(e.a.eval(), e.b.eval()); }
+
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+scalar_t dimension(const Poly2<scalar_t, MaxPoints> &p) { return dgal::dimension(p); }
+
+// iou with the intersection area from the fused kernel
+template <typename T1, typename T2> CUDA_CALLABLE_MEMBER inline
+auto iou(const T1 &a, const T2 &b) -> typename _wrap_t<T1>::scalar_type
+{
+    auto ea = _wrap(a).eval();
+    auto eb = _wrap(b).eval();
+    auto area_i = intersection_area(ea, eb);
+    return area_i / (area(_wrap(a)) + area(_wrap(b)) - area_i);
+}
+
+} // namespace lazy
+} // namespace dgal
+
+#endif // DGAL_EXPRESSION_HPP
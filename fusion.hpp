@@ -0,0 +1,236 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains clustering and fusion of rotated detections, which is used for ensembling
+ * predictions from multiple models or test-time augmentations.
+ *
+ * Operations:
+ *      .cluster_iou: connected components of the graph whose edges are pairs with iou > threshold
+ *      .BoxFusion: weighted box fusion of rotated boxes (ref "Weighted boxes fusion: Ensembling boxes
+ *          from different object detection models"), with clusters found by cluster_iou
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_FUSION_HPP
+#define DGAL_FUSION_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "dgal/geometry.hpp"
+#include "dgal/geometry_batch.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+// Rotated box with detection attributes
+template <typename scalar_t> struct FusionBox
+{
+    scalar_t x = 0, y = 0, w = 0, h = 0, r = 0;
+    scalar_t score = 0;
+    int32_t label = 0;
+};
+
+// Union-find with path halving
+class _DisjointSet
+{
+public:
+    explicit _DisjointSet(size_t n) : _parent(n) { std::iota(_parent.begin(), _parent.end(), 0); }
+
+    uint32_t find(uint32_t i)
+    {
+        while (_parent[i] != i)
+            i = _parent[i] = _parent[_parent[i]];
+        return i;
+    }
+
+    void unite(uint32_t i, uint32_t j)
+    {
+        i = find(i); j = find(j);
+        if (i != j) _parent[std::max(i, j)] = std::min(i, j);
+    }
+
+private:
+    std::vector<uint32_t> _parent;
+};
+
+// Cluster polygons by single linkage over iou > threshold. The cluster ids are assigned
+// in the order of their first members. Return the number of clusters
+template <typename scalar_t, uint8_t MaxPoints> inline
+uint32_t cluster_iou(const Poly2<scalar_t, MaxPoints> *p, size_t n, const scalar_t &threshold,
+    uint32_t *cluster_ids)
+{
+    std::vector<SparseEntry<scalar_t>> edges;
+    iou_sparse(p, n, edges, threshold);
+
+    _DisjointSet sets(n);
+    for (const auto &e : edges)
+        sets.unite(e.i, e.j);
+
+    // roots are always the smallest index in the set, so they are visited first
+    uint32_t nclusters = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t root = sets.find(i);
+        cluster_ids[i] = (root == i) ? nclusters++ : cluster_ids[root];
+    }
+    return nclusters;
+}
+
+// Weighted box fusion with incremental input. Detections from each model are added
+// separately and fused once all models are added, classes are fused in parallel.
+// Detections from models with zero weight are ignored, so every cluster has a positive weight sum.
+template <typename scalar_t> class BoxFusion
+{
+public:
+    // throw std::invalid_argument if a weight is negative or all the weights are zero
+    BoxFusion(const std::vector<scalar_t> &model_weights, const scalar_t &iou_threshold = 0.55,
+        const scalar_t &skip_threshold = 0)
+        : _weights(model_weights), _iou_threshold(iou_threshold), _skip_threshold(skip_threshold)
+    {
+        for (const scalar_t &w : _weights)
+            if (!(w >= 0 && w < std::numeric_limits<scalar_t>::infinity()))
+                throw std::invalid_argument("the model weights should be finite and non-negative");
+        if (!(std::accumulate(_weights.begin(), _weights.end(), scalar_t(0)) > 0))
+            throw std::invalid_argument("at least one model weight should be positive");
+    }
+
+    size_t nmodels() const { return _weights.size(); }
+
+    void clear() { _entries.clear(); }
+
+    // add detections from the model with given index, throw std::out_of_range if the index is invalid
+    void add(uint32_t model, const FusionBox<scalar_t> *boxes, size_t n)
+    {
+        if (model >= _weights.size())
+            throw std::out_of_range("model " + std::to_string(model) + " is out of range");
+        if (_weights[model] == 0)
+            return;
+        for (size_t i = 0; i < n; i++)
+            if (boxes[i].score >= _skip_threshold)
+                _entries[boxes[i].label].push_back({boxes[i], model});
+    }
+
+    // fuse the detections, the results are grouped by label and sorted by score
+    std::vector<FusionBox<scalar_t>> fuse() const
+    {
+        std::vector<const std::vector<Entry>*> groups;
+        for (const auto &kv : _entries)
+            groups.push_back(&kv.second);
+
+        std::vector<std::vector<FusionBox<scalar_t>>> fused(groups.size());
+        parallel_for(0, groups.size(), [&](size_t g) {
+            fused[g] = _fuse_class(*groups[g]);
+        });
+
+        std::vector<FusionBox<scalar_t>> result;
+        for (const auto &f : fused)
+            result.insert(result.end(), f.begin(), f.end());
+        return result;
+    }
+
+private:
+    struct Entry
+    {
+        FusionBox<scalar_t> box;
+        uint32_t model;
+    };
+
+    std::vector<FusionBox<scalar_t>> _fuse_class(const std::vector<Entry> &entries) const
+    {
+        size_t n = entries.size();
+        std::vector<Quad2<scalar_t>> polys(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            const FusionBox<scalar_t> &b = entries[i].box;
+            polys[i] = poly2_from_xywhr(b.x, b.y, b.w, b.h, b.r);
+        }
+
+        std::vector<uint32_t> ids(n);
+        uint32_t nclusters = cluster_iou(polys.data(), n, _iou_threshold, ids.data());
+
+        // the angles are aligned to the member with highest weight, since the box is symmetric under rotation of pi
+        std::vector<int64_t> ref(nclusters, -1);
+        std::vector<scalar_t> wsum(nclusters, 0), msum(nclusters, 0);
+        std::vector<FusionBox<scalar_t>> result(nclusters);
+        for (size_t i = 0; i < n; i++)
+        {
+            scalar_t w = entries[i].box.score * _weights[entries[i].model];
+            if (ref[ids[i]] < 0 || w > entries[ref[ids[i]]].box.score * _weights[entries[ref[ids[i]]].model])
+                ref[ids[i]] = i;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            const FusionBox<scalar_t> &b = entries[i].box;
+            FusionBox<scalar_t> &f = result[ids[i]];
+            scalar_t mw = _weights[entries[i].model], w = b.score * mw;
+            scalar_t rref = entries[ref[ids[i]]].box.r;
+            scalar_t dr = b.r - rref;
+            dr -= _pi * round(dr / _pi);
+
+            f.x += w * b.x; f.y += w * b.y;
+            f.w += w * b.w; f.h += w * b.h;
+            f.r += w * (rref + dr);
+            f.score += w;
+            f.label = b.label;
+            wsum[ids[i]] += w;
+            msum[ids[i]] += mw;
+        }
+
+        scalar_t wtotal = std::accumulate(_weights.begin(), _weights.end(), scalar_t(0));
+        for (uint32_t c = 0; c < nclusters; c++)
+        {
+            FusionBox<scalar_t> &f = result[c];
+            if (wsum[c] > 0)
+            {
+                f.x /= wsum[c]; f.y /= wsum[c];
+                f.w /= wsum[c]; f.h /= wsum[c];
+                f.r /= wsum[c];
+            }
+            else // all members have zero score
+            {
+                f = entries[ref[c]].box;
+                f.score = 0;
+            }
+            // average score, penalized if not all the models agree
+            f.score = f.score / msum[c] * _min(msum[c], wtotal) / wtotal;
+        }
+
+        std::sort(result.begin(), result.end(), [](const FusionBox<scalar_t> &a, const FusionBox<scalar_t> &b) {
+            return a.score > b.score;
+        });
+        return result;
+    }
+
+    std::vector<scalar_t> _weights;
+    scalar_t _iou_threshold, _skip_threshold;
+    std::map<int32_t, std::vector<Entry>> _entries;
+};
+
+} // namespace dgal
+
+#endif // DGAL_FUSION_HPP
@@ -0,0 +1,417 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains batched kernels built on the geometry operations, taking arrays of shapes as input.
+ * Large batches are processed in parallel with the thread pool from parallel.hpp.
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_GEOMETRY_BATCH_HPP
+#define DGAL_GEOMETRY_BATCH_HPP
+
+#include <algorithm>
+#include <vector>
+#include "dgal/geometry.hpp"
+#include "dgal/geometry_grad.hpp"
+#include "dgal/broadphase.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+// An entry of sparse pairwise results, i and j are indices into the first and second input
+template <typename scalar_t> struct SparseEntry
+{
+    uint32_t i = 0, j = 0;
+    scalar_t value = 0;
+};
+
+// Check the inputs of a pairwise operation and calculate their areas, which the operations need anyway, so only
+// a few comparisons are added. Polygons with less than 3 vertices, clockwise or NaN vertices have no positive area
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+PairStatus _check_operands(const Poly2<scalar_t, MaxPoints1> &p1, const Poly2<scalar_t, MaxPoints2> &p2,
+    scalar_t &area1, scalar_t &area2)
+{
+    if (p1.nvertices > MaxPoints1 || p2.nvertices > MaxPoints2)
+        return PairStatus::CapacityExceeded;
+    area1 = area(p1); area2 = area(p2);
+    return (area1 > 0 && area2 > 0) ? PairStatus::Ok : PairStatus::Degenerate;
+}
+
+// IoU of a pair with its PairStatus, invalid pairs get zero IoU (and nx = 0) instead of NaN or an assertion.
+// The area of the intersection is stored in area_i if it's not null
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+scalar_t _iou_checked(const Poly2<scalar_t, MaxPoints1> &p1, const Poly2<scalar_t, MaxPoints2> &p2,
+    uint8_t &nx, uint8_t *xflags, PairStatus &status, scalar_t *area_i = nullptr)
+{
+    nx = 0;
+    if (area_i != nullptr) *area_i = 0;
+    scalar_t area1, area2;
+    status = _check_operands(p1, p2, area1, area2);
+    if (status != PairStatus::Ok)
+        return 0;
+
+    auto pi = intersect(p1, p2, xflags, &status);
+    if (status == PairStatus::CapacityExceeded)
+        return 0;
+    if (pi.nvertices == 0 && status == PairStatus::Ok)
+        status = PairStatus::Empty;
+
+    nx = pi.nvertices;
+    scalar_t area_x = area(pi);
+    if (area_i != nullptr) *area_i = area_x;
+    return area_x / (area1 + area2 - area_x);
+}
+
+// Evaluate IoU of candidate pairs in parallel, and keep the ones with iou > min_iou
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void _iou_candidates(const Poly2<scalar_t, MaxPoints1> *p1, const Poly2<scalar_t, MaxPoints2> *p2,
+    std::vector<IndexPair> &candidates, std::vector<SparseEntry<scalar_t>> &result, const scalar_t &min_iou)
+{
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<scalar_t> values(candidates.size());
+    parallel_for(0, candidates.size(), [&](size_t k) {
+        uint8_t nx; PairStatus status;
+        values[k] = _iou_checked(p1[candidates[k].first], p2[candidates[k].second], nx, nullptr, status);
+    }, 256);
+
+    for (size_t k = 0; k < candidates.size(); k++)
+        if (values[k] > min_iou)
+            result.push_back({.i = candidates[k].first, .j = candidates[k].second, .value = values[k]});
+}
+
+// Calculate IoU between all pairs of polygons from two sets whose bounding boxes overlap.
+// Only the pairs with iou > min_iou are stored, in the order of (i, j)
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void iou_sparse(const Poly2<scalar_t, MaxPoints1> *p1, size_t n1,
+    const Poly2<scalar_t, MaxPoints2> *p2, size_t n2,
+    std::vector<SparseEntry<scalar_t>> &result, const scalar_t &min_iou = 0)
+{
+    std::vector<AABox2<scalar_t>> boxes1(n1), boxes2(n2);
+    for (size_t i = 0; i < n1; i++)
+        boxes1[i] = aabox2_from_poly2(p1[i]);
+    for (size_t j = 0; j < n2; j++)
+        boxes2[j] = aabox2_from_poly2(p2[j]);
+
+    std::vector<IndexPair> candidates;
+    find_overlaps(boxes1.data(), n1, boxes2.data(), n2, candidates);
+    _iou_candidates(p1, p2, candidates, result, min_iou);
+}
+
+// Calculate IoU between all pairs (i < j) of polygons in a set whose bounding boxes overlap
+template <typename scalar_t, uint8_t MaxPoints> inline
+void iou_sparse(const Poly2<scalar_t, MaxPoints> *p, size_t n,
+    std::vector<SparseEntry<scalar_t>> &result, const scalar_t &min_iou = 0)
+{
+    std::vector<AABox2<scalar_t>> boxes(n);
+    for (size_t i = 0; i < n; i++)
+        boxes[i] = aabox2_from_poly2(p[i]);
+
+    std::vector<IndexPair> candidates;
+    find_overlaps(boxes.data(), n, candidates);
+    _iou_candidates(p, p, candidates, result, min_iou);
+}
+
+// Canonicalize polygons in place with canonicalize(), the PolyStatus flags of polys[k] are stored in status[k]
+template <typename scalar_t, uint8_t MaxPoints> inline
+void canonicalize_batch(Poly2<scalar_t, MaxPoints> *polys, size_t n, uint8_t *status, const scalar_t &tolerance = 1e-6)
+{
+    parallel_for(0, n, [&](size_t k) {
+        status[k] = canonicalize(polys[k], tolerance);
+    }, 1024);
+}
+
+// Project points to polylines, the k-th point is projected to polyline lines[line_indices[k]].
+// If hints is not null, the search starts from the given segments (e.g. the segments of last frame).
+// The segment indices are stored in segments if it's not null.
+template <typename scalar_t, uint8_t MaxPoints> inline
+void project_batch(const Polyline2<scalar_t, MaxPoints> *lines, const uint32_t *line_indices,
+    const Point2<scalar_t> *points, size_t n, scalar_t *s, scalar_t *offsets,
+    uint8_t *segments = nullptr, const uint8_t *hints = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        uint8_t idx;
+        const Polyline2<scalar_t, MaxPoints> &l = lines[line_indices[k]];
+        s[k] = hints == nullptr ? project(l, points[k], offsets[k], idx)
+                                : project(l, points[k], offsets[k], idx, hints[k]);
+        if (segments != nullptr) segments[k] = idx;
+    }, 1024);
+}
+
+// Calculate distances between pairs of polylines and polygons, the flags for gradient
+// calculation are stored if they are not null
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void distance_batch(const Polyline2<scalar_t, MaxPoints1> *lines, const Poly2<scalar_t, MaxPoints2> *polys,
+    const IndexPair *pairs, size_t n, scalar_t *distances, uint8_t *flags1 = nullptr, uint8_t *flags2 = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        uint8_t f1, f2;
+        distances[k] = distance(lines[pairs[k].first], polys[pairs[k].second], f1, f2);
+        if (flags1 != nullptr) flags1[k] = f1;
+        if (flags2 != nullptr) flags2[k] = f2;
+    }, 256);
+}
+
+// Calculate Hausdorff distances between the boundaries of p1[k] and p2[k]. If flags is not null, the two flags
+// of the k-th pair are stored at flags + 2 * k for hausdorff_distance_batch_grad
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void hausdorff_distance_batch(const Poly2<scalar_t, MaxPoints1> *p1, const Poly2<scalar_t, MaxPoints2> *p2, size_t n,
+    scalar_t *distances, uint8_t *flags = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        uint8_t f1, f2;
+        distances[k] = hausdorff_distance(p1[k], p2[k], f1, f2);
+        if (flags != nullptr) { flags[2*k] = f1; flags[2*k + 1] = f2; }
+    }, 256);
+}
+
+// Backward of hausdorff_distance_batch, the output gradients are overwritten rather than accumulated
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void hausdorff_distance_batch_grad(const Poly2<scalar_t, MaxPoints1> *p1, const Poly2<scalar_t, MaxPoints2> *p2,
+    size_t n, const scalar_t *grads, const uint8_t *flags,
+    Poly2<scalar_t, MaxPoints1> *grad_p1, Poly2<scalar_t, MaxPoints2> *grad_p2)
+{
+    parallel_for(0, n, [&](size_t k) {
+        grad_p1[k].zero(); grad_p2[k].zero();
+        hausdorff_distance_grad(p1[k], p2[k], grads[k], flags[2*k], flags[2*k + 1], grad_p1[k], grad_p2[k]);
+    }, 256);
+}
+
+// Calculate Chamfer distances between the boundaries of p1[k] and p2[k]. If flags is not null, the flags of the
+// k-th pair are stored at flags + k * (MaxPoints1 + MaxPoints2) for chamfer_distance_batch_grad
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void chamfer_distance_batch(const Poly2<scalar_t, MaxPoints1> *p1, const Poly2<scalar_t, MaxPoints2> *p2, size_t n,
+    scalar_t *distances, uint8_t *flags = nullptr)
+{
+    constexpr size_t stride = MaxPoints1 + MaxPoints2;
+    parallel_for(0, n, [&](size_t k) {
+        distances[k] = chamfer_distance(p1[k], p2[k], flags == nullptr ? nullptr : flags + k * stride);
+    }, 256);
+}
+
+// Backward of chamfer_distance_batch, the output gradients are overwritten rather than accumulated
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void chamfer_distance_batch_grad(const Poly2<scalar_t, MaxPoints1> *p1, const Poly2<scalar_t, MaxPoints2> *p2,
+    size_t n, const scalar_t *grads, const uint8_t *flags,
+    Poly2<scalar_t, MaxPoints1> *grad_p1, Poly2<scalar_t, MaxPoints2> *grad_p2)
+{
+    constexpr size_t stride = MaxPoints1 + MaxPoints2;
+    parallel_for(0, n, [&](size_t k) {
+        grad_p1[k].zero(); grad_p2[k].zero();
+        chamfer_distance_grad(p1[k], p2[k], grads[k], flags + k * stride, grad_p1[k], grad_p2[k]);
+    }, 256);
+}
+
+template <typename scalar_t, uint8_t MaxPoints> inline
+void moments_batch(const Poly2<scalar_t, MaxPoints> *polys, size_t n, Moments2<scalar_t> *result)
+{
+    parallel_for(0, n, [&](size_t k) {
+        result[k] = moments(polys[k]);
+    }, 1024);
+}
+
+// Backward of moments_batch, the output gradients are overwritten rather than accumulated
+template <typename scalar_t, uint8_t MaxPoints> inline
+void moments_batch_grad(const Poly2<scalar_t, MaxPoints> *polys, size_t n, const Moments2<scalar_t> *grads,
+    Poly2<scalar_t, MaxPoints> *grad_polys)
+{
+    parallel_for(0, n, [&](size_t k) {
+        grad_polys[k].zero();
+        grad_polys[k].nvertices = polys[k].nvertices;
+        moments_grad(polys[k], grads[k], grad_polys[k]);
+    }, 1024);
+}
+
+// Calculate IoU between p1[k] and p2[k]. If xflags is not null, the intersection flags of the k-th
+// pair are stored at xflags + k * (MaxPoints1 + MaxPoints2) and its count in nx[k], for iou_batch_grad.
+// Invalid pairs get zero IoU, and the PairStatus of each pair is stored in status if it's not null
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void iou_batch(const Poly2<scalar_t, MaxPoints1> *p1, const Poly2<scalar_t, MaxPoints2> *p2, size_t n,
+    scalar_t *ious, uint8_t *nx = nullptr, uint8_t *xflags = nullptr, uint8_t *status = nullptr)
+{
+    constexpr size_t stride = MaxPoints1 + MaxPoints2;
+    parallel_for(0, n, [&](size_t k) {
+        uint8_t nxk; PairStatus sk;
+        ious[k] = _iou_checked(p1[k], p2[k], nxk, xflags == nullptr ? nullptr : xflags + k * stride, sk);
+        if (nx != nullptr) nx[k] = nxk;
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+// Backward of iou_batch, the output gradients are overwritten rather than accumulated.
+// Pairs with degenerate inputs get zero gradients, and they are marked in status if it's not null
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+void iou_batch_grad(const Poly2<scalar_t, MaxPoints1> *p1, const Poly2<scalar_t, MaxPoints2> *p2, size_t n,
+    const scalar_t *grads, const uint8_t *nx, const uint8_t *xflags,
+    Poly2<scalar_t, MaxPoints1> *grad_p1, Poly2<scalar_t, MaxPoints2> *grad_p2, uint8_t *status = nullptr)
+{
+    constexpr size_t stride = MaxPoints1 + MaxPoints2;
+    parallel_for(0, n, [&](size_t k) {
+        grad_p1[k].zero(); grad_p1[k].nvertices = p1[k].nvertices;
+        grad_p2[k].zero(); grad_p2[k].nvertices = p2[k].nvertices;
+        scalar_t area1, area2;
+        PairStatus sk = _check_operands(p1[k], p2[k], area1, area2);
+        if (sk == PairStatus::Ok)
+            iou_grad(p1[k], p2[k], grads[k], nx[k], xflags + k * stride, grad_p1[k], grad_p2[k]);
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+// The *_batch_packed functions save the backward state of Quad2 pairs with 4 bits per flag, where flag i of a
+// list is stored in bits [4i, 4i+4). Quad2 flags are below 8, so unused slots are filled with 0xF and the
+// counts (nx, nm) are implied. The iou state of a pair is a 32-bit word of xflags, the giou state has the mflags
+// in the upper 32 bits and the diou state has dflag1 and dflag2 in bits [32, 36) and [36, 40).
+// Invalid pairs get zero values, empty flags and zero gradients, same as iou_batch
+constexpr uint32_t _empty_flags4 = 0xffffffff;
+
+CUDA_CALLABLE_MEMBER inline uint32_t _pack_flags4(const uint8_t *flags, uint8_t n)
+{
+    uint32_t packed = _empty_flags4;
+    for (uint8_t i = 0; i < n; i++)
+        packed = (packed & ~(uint32_t(0xf) << (4*i))) | (uint32_t(flags[i]) << (4*i));
+    return packed;
+}
+
+// unpack the flags and return their count
+CUDA_CALLABLE_MEMBER inline uint8_t _unpack_flags4(uint32_t packed, uint8_t flags[8])
+{
+    uint8_t n = 0;
+    for (; n < 8 && (packed & 0xf) != 0xf; n++, packed >>= 4)
+        flags[n] = packed & 0xf;
+    return n;
+}
+
+template <typename scalar_t> inline
+void iou_batch_packed(const Quad2<scalar_t> *p1, const Quad2<scalar_t> *p2, size_t n,
+    scalar_t *ious, uint32_t *state, uint8_t *status = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        uint8_t nxk, xflags[8]; PairStatus sk;
+        ious[k] = _iou_checked(p1[k], p2[k], nxk, xflags, sk);
+        state[k] = _pack_flags4(xflags, nxk);
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+template <typename scalar_t> inline
+void iou_batch_grad_packed(const Quad2<scalar_t> *p1, const Quad2<scalar_t> *p2, size_t n,
+    const scalar_t *grads, const uint32_t *state, Quad2<scalar_t> *grad_p1, Quad2<scalar_t> *grad_p2,
+    uint8_t *status = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        grad_p1[k].zero(); grad_p1[k].nvertices = p1[k].nvertices;
+        grad_p2[k].zero(); grad_p2[k].nvertices = p2[k].nvertices;
+        scalar_t area1, area2;
+        PairStatus sk = _check_operands(p1[k], p2[k], area1, area2);
+        if (sk == PairStatus::Ok)
+        {
+            uint8_t xflags[8], nx = _unpack_flags4(state[k], xflags);
+            iou_grad(p1[k], p2[k], grads[k], nx, xflags, grad_p1[k], grad_p2[k]);
+        }
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+template <typename scalar_t> inline
+void giou_batch_packed(const Quad2<scalar_t> *p1, const Quad2<scalar_t> *p2, size_t n,
+    scalar_t *gious, uint64_t *state, uint8_t *status = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        scalar_t area1, area2;
+        PairStatus sk = _check_operands(p1[k], p2[k], area1, area2);
+        gious[k] = 0;
+        state[k] = uint64_t(_empty_flags4) << 32 | _empty_flags4;
+        if (sk == PairStatus::Ok)
+        {
+            uint8_t nx, nm, xflags[8], mflags[8];
+            gious[k] = giou(p1[k], p2[k], nx, nm, xflags, mflags);
+            state[k] = uint64_t(_pack_flags4(mflags, nm)) << 32 | _pack_flags4(xflags, nx);
+            if (nx == 0) sk = PairStatus::Empty;
+        }
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+template <typename scalar_t> inline
+void giou_batch_grad_packed(const Quad2<scalar_t> *p1, const Quad2<scalar_t> *p2, size_t n,
+    const scalar_t *grads, const uint64_t *state, Quad2<scalar_t> *grad_p1, Quad2<scalar_t> *grad_p2,
+    uint8_t *status = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        grad_p1[k].zero(); grad_p1[k].nvertices = p1[k].nvertices;
+        grad_p2[k].zero(); grad_p2[k].nvertices = p2[k].nvertices;
+        scalar_t area1, area2;
+        PairStatus sk = _check_operands(p1[k], p2[k], area1, area2);
+        if (sk == PairStatus::Ok)
+        {
+            uint8_t xflags[8], mflags[8];
+            uint8_t nx = _unpack_flags4(uint32_t(state[k]), xflags);
+            uint8_t nm = _unpack_flags4(uint32_t(state[k] >> 32), mflags);
+            giou_grad(p1[k], p2[k], grads[k], nx, nm, xflags, mflags, grad_p1[k], grad_p2[k]);
+        }
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+template <typename scalar_t> inline
+void diou_batch_packed(const Quad2<scalar_t> *p1, const Quad2<scalar_t> *p2, size_t n,
+    scalar_t *dious, uint64_t *state, uint8_t *status = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        scalar_t area1, area2;
+        PairStatus sk = _check_operands(p1[k], p2[k], area1, area2);
+        dious[k] = 0;
+        state[k] = uint64_t(_empty_flags4) << 32 | _empty_flags4;
+        if (sk == PairStatus::Ok)
+        {
+            uint8_t nx, dflag1, dflag2, xflags[8];
+            dious[k] = diou(p1[k], p2[k], nx, dflag1, dflag2, xflags);
+            state[k] = uint64_t(dflag2 << 4 | dflag1) << 32 | _pack_flags4(xflags, nx);
+            if (nx == 0) sk = PairStatus::Empty;
+        }
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+template <typename scalar_t> inline
+void diou_batch_grad_packed(const Quad2<scalar_t> *p1, const Quad2<scalar_t> *p2, size_t n,
+    const scalar_t *grads, const uint64_t *state, Quad2<scalar_t> *grad_p1, Quad2<scalar_t> *grad_p2,
+    uint8_t *status = nullptr)
+{
+    parallel_for(0, n, [&](size_t k) {
+        grad_p1[k].zero(); grad_p1[k].nvertices = p1[k].nvertices;
+        grad_p2[k].zero(); grad_p2[k].nvertices = p2[k].nvertices;
+        scalar_t area1, area2;
+        PairStatus sk = _check_operands(p1[k], p2[k], area1, area2);
+        if (sk == PairStatus::Ok)
+        {
+            uint8_t xflags[8], nx = _unpack_flags4(uint32_t(state[k]), xflags);
+            uint8_t dflag1 = (state[k] >> 32) & 0xf, dflag2 = (state[k] >> 36) & 0xf;
+            diou_grad(p1[k], p2[k], grads[k], nx, dflag1, dflag2, xflags, grad_p1[k], grad_p2[k]);
+        }
+        if (status != nullptr) status[k] = uint8_t(sk);
+    }, 256);
+}
+
+} // namespace dgal
+
+#endif // DGAL_GEOMETRY_BATCH_HPP
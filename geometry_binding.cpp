@@ -23,12 +23,34 @@
 #include <pybind11/stl.h>
 #include "dgal/geometry.hpp"
 #include "dgal/geometry_grad.hpp"
+#include "dgal/evaluation.hpp"
+#include "dgal/fusion.hpp"
+#include "dgal/visibility.hpp"
+#include "dgal/rtree.hpp"
+#include "dgal/placement.hpp"
+#include "dgal/box_coder.hpp"
+#include "dgal/geometry_batch.hpp"
+#include "dgal/ragged.hpp"
+#include "dgal/dispatch.hpp"
+#include "dgal/geometry_kernels.hpp"
+#include "dgal/server.hpp"
+#include "dgal/expression.hpp"
+#include "dgal/sector.hpp"
+#include "dgal/ellipse.hpp"
+#include "dgal/tiling.hpp"
+#include "dgal/sharding.hpp"
+#include "dgal/pair_cache.hpp"
+#include "dgal/polygon_store.hpp"
 
 namespace py = pybind11;
 using namespace std;
 using namespace dgal;
 using namespace pybind11::literals;
 typedef double T;
+typedef APEvaluator<T, 4> Evaluator;
+typedef Polyline2<T, 64> Polyline;
+typedef MappedRTree<T, 8> RTree;
+typedef MappedPolygonStore<T> PolygonStore;
 
 template <typename scalar_t, uint8_t MaxPoints> inline
 Poly2<scalar_t, MaxPoints> poly_from_points(const vector<Point2<scalar_t>> &points)
@@ -40,6 +62,130 @@ Poly2<scalar_t, MaxPoints> poly_from_points(const vector<Point2<scalar_t>> &poin
     return b;
 }
 
+template <typename scalar_t, uint8_t MaxPoints> inline
+Polyline2<scalar_t, MaxPoints> polyline_from_points(const vector<Point2<scalar_t>> &points)
+{
+    assert(points.size() <= MaxPoints);
+    return polyline2_from_points<scalar_t, MaxPoints>(points.data(), points.size());
+}
+
+// select the kernels for the current CPU on first use, their loops run on the global pool of the binding
+inline const dgal_kernels::KernelTable& kernels(ISA *selected = nullptr)
+{
+    static const dgal_kernels::KernelTable* tables[] = {
+        &dgal_kernels::kernels_baseline,
+#ifdef DGAL_HAS_KERNELS_SSE42
+        &dgal_kernels::kernels_sse42,
+#else
+        nullptr,
+#endif
+#ifdef DGAL_HAS_KERNELS_AVX2
+        &dgal_kernels::kernels_avx2,
+#else
+        nullptr,
+#endif
+#ifdef DGAL_HAS_KERNELS_AVX512
+        &dgal_kernels::kernels_avx512,
+#else
+        nullptr,
+#endif
+    };
+    static const ISA isa = []() {
+        uint32_t compiled = 0;
+        for (int i = 0; i < 4; i++)
+            if (tables[i] != nullptr) compiled |= 1u << i;
+        ISA isa = select_isa(compiled);
+        tables[int(isa)]->set_parallel_for(&dgal::pool_parallel_for);
+        return isa;
+    }();
+
+    if (selected != nullptr) *selected = isa;
+    return *tables[int(isa)];
+}
+
+// Run the job on the async executor and return a concurrent.futures.Future resolved with its result.
+// Cancelling the python future cancels the job if it hasn't started.
+template <typename Func>
+py::object submit_async(Func job)
+{
+    py::object future = py::module::import("concurrent.futures").attr("Future")();
+    // the callbacks can run on worker threads, so the python object is released with GIL held
+    std::shared_ptr<py::object> handle(new py::object(future), [](py::object *o) {
+        py::gil_scoped_acquire gil;
+        delete o;
+    });
+
+    Future<_async_result_t<Func>> task;
+    {
+        py::gil_scoped_release release;
+        task = AsyncExecutor::global().submit(std::move(job));
+    }
+    task.on_complete([task, handle]() {
+        py::gil_scoped_acquire gil;
+        if (handle->attr("cancelled")().cast<bool>()) return;
+        try
+        {
+            handle->attr("set_result")(py::cast(task.get()));
+        }
+        catch (const TaskCancelled&)
+        {
+            handle->attr("cancel")();
+        }
+        catch (const std::exception &e)
+        {
+            handle->attr("set_exception")(py::module::import("builtins").attr("RuntimeError")(e.what()));
+        }
+    });
+    future.attr("add_done_callback")(py::cpp_function([task](py::object f) {
+        if (f.attr("cancelled")().cast<bool>()) task.cancel();
+    }));
+    return future;
+}
+
+// iou_sparse of two sets of boxes, the candidate pairs are found here and evaluated by the kernels
+inline vector<tuple<uint32_t, uint32_t, T>> iou_sparse_boxes(const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2,
+    const T min_iou)
+{
+    vector<AABox2<T>> boxes1(p1.size()), boxes2(p2.size());
+    for (size_t i = 0; i < p1.size(); i++)
+        boxes1[i] = aabox2_from_poly2(p1[i]);
+    for (size_t j = 0; j < p2.size(); j++)
+        boxes2[j] = aabox2_from_poly2(p2[j]);
+
+    vector<IndexPair> candidates;
+    find_overlaps(boxes1.data(), boxes1.size(), boxes2.data(), boxes2.size(), candidates);
+    std::sort(candidates.begin(), candidates.end());
+    vector<T> values(candidates.size());
+    kernels().iou_pairs(p1.data(), p2.data(), candidates.data(), candidates.size(), values.data());
+
+    vector<tuple<uint32_t, uint32_t, T>> result;
+    for (size_t k = 0; k < candidates.size(); k++)
+        if (values[k] > min_iou)
+            result.emplace_back(candidates[k].first, candidates[k].second, values[k]);
+    return result;
+}
+
+// flatten rows with the same width into a contiguous array
+inline vector<T> flatten_rows(const vector<vector<T>> &rows, size_t width)
+{
+    vector<T> result;
+    result.reserve(rows.size() * width);
+    for (const auto &row : rows)
+    {
+        assert(row.size() == width);
+        result.insert(result.end(), row.begin(), row.end());
+    }
+    return result;
+}
+
+inline vector<vector<T>> split_rows(const vector<T> &values, size_t width)
+{
+    vector<vector<T>> result;
+    for (size_t i = 0; i < values.size(); i += width)
+        result.emplace_back(values.begin() + i, values.begin() + i + width);
+    return result;
+}
+
 PYBIND11_MODULE(dgal, m) {
     m.doc() = "Python binding of the builtin geometry library of dgal, mainly for testing";
 
@@ -92,11 +238,47 @@ PYBIND11_MODULE(dgal, m) {
             return vector<Point2<T>>(p.vertices, p.vertices + p.nvertices);})
         .def("__str__", py::overload_cast<const Poly2<T, 8>&>(&dgal::to_string<T, 8>))
         .def("__repr__", py::overload_cast<const Poly2<T, 8>&>(&dgal::pprint<T, 8>));
+    py::class_<Polyline>(m, "Polyline2")
+        .def(py::init<>())
+        .def(py::init(&polyline_from_points<T, 64>))
+        .def_readonly("nvertices", &Polyline::nvertices)
+        .def_property_readonly("vertices", [](const Polyline &l) {
+            return vector<Point2<T>>(l.vertices, l.vertices + l.nvertices);})
+        .def_property_readonly("lengths", [](const Polyline &l) {
+            return vector<T>(l.lengths, l.lengths + l.nvertices);})
+        .def("__str__", py::overload_cast<const Polyline&>(&dgal::to_string<T, 64>))
+        .def("__repr__", py::overload_cast<const Polyline&>(&dgal::pprint<T, 64>));
+    py::class_<Moments2<T>>(m, "Moments2")
+        .def(py::init<>())
+        .def_readwrite("area", &Moments2<T>::area)
+        .def_readwrite("centroid", &Moments2<T>::centroid)
+        .def_readwrite("cxx", &Moments2<T>::cxx)
+        .def_readwrite("cxy", &Moments2<T>::cxy)
+        .def_readwrite("cyy", &Moments2<T>::cyy);
 
     py::enum_<Algorithm>(m, "Algorithm")
         .value("Default", dgal::Algorithm::Default)
         .value("RotatingCaliper", dgal::Algorithm::RotatingCaliper)
         .value("SutherlandHodgeman", dgal::Algorithm::SutherlandHodgeman)
+        .value("RectangleFrame", dgal::Algorithm::RectangleFrame)
+        .value("EdgeChasing", dgal::Algorithm::EdgeChasing)
+        .export_values();
+    py::enum_<PolyStatus>(m, "PolyStatus", py::arithmetic())
+        .value("Ok", dgal::PolyStatus::Ok)
+        .value("Reversed", dgal::PolyStatus::Reversed)
+        .value("DuplicatesRemoved", dgal::PolyStatus::DuplicatesRemoved)
+        .value("CollinearRemoved", dgal::PolyStatus::CollinearRemoved)
+        .value("NonConvex", dgal::PolyStatus::NonConvex)
+        .value("Degenerate", dgal::PolyStatus::Degenerate);
+    py::enum_<PairStatus>(m, "PairStatus", py::arithmetic())
+        .value("Ok", dgal::PairStatus::Ok)
+        .value("Empty", dgal::PairStatus::Empty)
+        .value("Degenerate", dgal::PairStatus::Degenerate)
+        .value("CapacityExceeded", dgal::PairStatus::CapacityExceeded)
+        .value("FallbackUsed", dgal::PairStatus::FallbackUsed);
+    py::enum_<BoxEncoding>(m, "BoxEncoding")
+        .value("Standard", dgal::BoxEncoding::Standard)
+        .value("SinCos", dgal::BoxEncoding::SinCos)
         .export_values();
 
     // constructors
@@ -111,6 +293,7 @@ PYBIND11_MODULE(dgal, m) {
     m.def("aabox2_from_poly2", &dgal::aabox2_from_poly2<T, 8>, "Create bounding box of a polygon");
     m.def("poly2_from_aabox2", &dgal::poly2_from_aabox2<T>, "Convert axis aligned box to polygon representation");
     m.def("poly2_from_xywhr", &dgal::poly2_from_xywhr<T>, "Creat a box with specified box parameters");
+    m.def("point_from_s", &dgal::point_from_s<T, 64>, "Find the point on a polyline with arc length s");
 
     // functions
 
@@ -134,6 +317,11 @@ PYBIND11_MODULE(dgal, m) {
     m.def("centroid", py::overload_cast<const AABox2<T>&>(&dgal::centroid<T>), "Get the centroid point of axis aligned box");
     m.def("centroid", py::overload_cast<const Quad2<T>&>(&dgal::centroid<T, 4>), "Get the centroid point of box");
     m.def("centroid", py::overload_cast<const Poly2<T, 8>&>(&dgal::centroid<T, 8>), "Get the centroid point of polygon");
+    m.def("moments", py::overload_cast<const Quad2<T>&>(&dgal::moments<T, 4>),
+        "Get the area, area centroid and covariance of box");
+    m.def("moments", py::overload_cast<const Poly2<T, 8>&>(&dgal::moments<T, 8>),
+        "Get the area, area centroid and covariance of polygon");
+    m.def("length", &dgal::length<T, 64>, "Get the length of polyline");
 
     // operators
 
@@ -154,6 +342,20 @@ PYBIND11_MODULE(dgal, m) {
     m.def("distance", [](const Quad2<T>& box, const Point2<T>& p){
             uint8_t idx; distance(box, p, idx); return idx;
         }, "Get the distance from a point to a box");
+    m.def("distance", [](const Polyline& l, const Quad2<T>& box){ return dgal::distance(l, box); },
+        "Get the distance between a polyline and a box");
+    m.def("distance_", [](const Polyline& l, const Quad2<T>& box){
+            uint8_t flag1, flag2; T d = dgal::distance(l, box, flag1, flag2);
+            return make_tuple(d, flag1, flag2);
+        }, "Get the distance between a polyline and a box and return flags");
+    m.def("project", [](const Polyline& l, const Point2<T>& p){
+            T offset; uint8_t idx; T s = dgal::project(l, p, offset, idx);
+            return make_tuple(s, offset, idx);
+        }, "Get the arc length and lateral offset of a point projected to a polyline");
+    m.def("project", [](const Polyline& l, const Point2<T>& p, const uint8_t hint){
+            T offset; uint8_t idx; T s = dgal::project(l, p, offset, idx, hint);
+            return make_tuple(s, offset, idx);
+        }, "Get the arc length and lateral offset of a point projected to a polyline, starting from segment hint");
     m.def("intersect", py::overload_cast<const Line2<T>&, const Line2<T>&>(&dgal::intersect<T>),
         "Get the intersection point of two lines");
     m.def("intersect", [](const Quad2<T>& b1, const Quad2<T>& b2){ return dgal::intersect(b1, b2); },
@@ -172,12 +374,20 @@ PYBIND11_MODULE(dgal, m) {
                 case Algorithm::SutherlandHodgeman:
                     result = dgal::intersect(AlgorithmT::SutherlandHodgeman(), b1, b2, xflags);
                     break;
+                case Algorithm::RectangleFrame:
+                    result = dgal::intersect(AlgorithmT::RectangleFrame(), b1, b2, xflags);
+                    break;
+                case Algorithm::EdgeChasing:
+                    result = dgal::intersect(AlgorithmT::EdgeChasing(), b1, b2, xflags);
+                    break;
             }
             vector<uint8_t> xflags_v(xflags, xflags + result.nvertices);
             return make_tuple(result, xflags_v);
         }, "Get the intersection polygon of two boxes and return flags");
     m.def("intersect", py::overload_cast<const AABox2<T>&, const AABox2<T>&>(&dgal::intersect<T>),
         "Get the intersection box of two axis aligned boxes");
+    m.def("intersects", [](const Quad2<T>& b1, const Quad2<T>& b2){ return dgal::intersects(b1, b2); },
+        "Check whether two boxes overlap with positive area");
     m.def("merge", py::overload_cast<const AABox2<T>&, const AABox2<T>&>(&dgal::merge<T>),
         "Get bounding box of two axis aligned boxes");
     m.def("merge", [](const Quad2<T>& b1, const Quad2<T>& b2){ return dgal::merge(b1, b2); },
@@ -192,6 +402,10 @@ PYBIND11_MODULE(dgal, m) {
         "Get the max distance between two polygons");
     m.def("max_distance", py::overload_cast<const AABox2<T>&, const AABox2<T>&>(&dgal::max_distance<T>),
         "Get the max distance between two polygons");
+    m.def("hausdorff_distance", [](const Poly2<T, 8>& p1, const Poly2<T, 8>& p2) { return dgal::hausdorff_distance(p1, p2); },
+        "Get the Hausdorff distance between the boundaries of two polygons");
+    m.def("chamfer_distance", [](const Poly2<T, 8>& p1, const Poly2<T, 8>& p2) { return dgal::chamfer_distance(p1, p2); },
+        "Get the Chamfer distance between the boundaries of two polygons");
     m.def("iou", py::overload_cast<const AABox2<T>&, const AABox2<T>&>(&dgal::iou<T>),
         "Get the intersection over union of two axis aligned boxes");
     m.def("iou", py::overload_cast<const Quad2<T>&, const Quad2<T>&>(&dgal::iou<T, 4, 4>),
@@ -251,6 +465,18 @@ PYBIND11_MODULE(dgal, m) {
     m.def("distance_grad", [](const Quad2<T>& b, const Point2<T>& p, const T& grad, Quad2<T>& grad_b, Point2<T>& grad_p, const uint8_t& idx) {
         dgal::distance_grad(b, p, grad, grad_b, grad_p, idx);
     }, "Calculate the gradient of distance()");
+    m.def("distance_grad", [](const Polyline& l, const Quad2<T>& b, const T& grad, const uint8_t& flag1, const uint8_t& flag2) {
+            Polyline grad_l; Quad2<T> grad_b;
+            grad_l.zero(); grad_b.zero();
+            dgal::distance_grad(l, b, grad, flag1, flag2, grad_l, grad_b);
+            return make_tuple(grad_l, grad_b);
+        }, "Calculate the gradient of distance()");
+    m.def("project_grad", [](const Polyline& l, const Point2<T>& p, const T& grad_s, const T& grad_offset, const uint8_t& idx) {
+            Polyline grad_l; Point2<T> grad_p;
+            grad_l.zero();
+            dgal::project_grad(l, p, grad_s, grad_offset, idx, grad_l, grad_p);
+            return make_tuple(grad_l, grad_p);
+        }, "Calculate the gradient of project()");
     m.def("area_grad", py::overload_cast<const AABox2<T>&, const T&, AABox2<T>&>(&dgal::area_grad<T>), "Calculate gradient of area()");
     m.def("area_grad", py::overload_cast<const Quad2<T>&, const T&, Quad2<T>&>(&dgal::area_grad<T, 4>), "Calculate gradient of area()");
     m.def("area_grad", py::overload_cast<const Poly2<T, 8>&, const T&, Poly2<T, 8>&>(&dgal::area_grad<T, 8>), "Calculate gradient of area()");
@@ -265,6 +491,8 @@ PYBIND11_MODULE(dgal, m) {
     m.def("centroid_grad", py::overload_cast<const AABox2<T>&, const Point2<T>&, AABox2<T>&>(&dgal::centroid_grad<T>), "Calculate gradient of centroid()");
     m.def("centroid_grad", py::overload_cast<const Quad2<T>&, const Point2<T>&, Quad2<T>&>(&dgal::centroid_grad<T, 4>), "Calculate gradient of centroid()");
     m.def("centroid_grad", py::overload_cast<const Poly2<T, 8>&, const Point2<T>&, Poly2<T, 8>&>(&dgal::centroid_grad<T, 8>), "Calculate gradient of centroid()");
+    m.def("moments_grad", py::overload_cast<const Quad2<T>&, const Moments2<T>&, Quad2<T>&>(&dgal::moments_grad<T, 4>), "Calculate gradient of moments()");
+    m.def("moments_grad", py::overload_cast<const Poly2<T, 8>&, const Moments2<T>&, Poly2<T, 8>&>(&dgal::moments_grad<T, 8>), "Calculate gradient of moments()");
 
     // gradient of operators
 
@@ -312,4 +540,764 @@ PYBIND11_MODULE(dgal, m) {
         }, "Calculate gradient of diou()");
     m.def("diou_grad", py::overload_cast<const AABox2<T>&, const AABox2<T>&, const T&, AABox2<T>&, AABox2<T>&>(&dgal::diou_grad<T>),
         "Calculate gradient of diou()");
-}
\ No newline at end of file
+
+    // evaluation utilities from evaluation.hpp
+
+    py::class_<EvalDetection<T, 4>>(m, "EvalDetection")
+        .def(py::init<>())
+        .def(py::init([](const Quad2<T> &shape, T score, T alpha, int32_t label) {
+            return EvalDetection<T, 4>{shape, score, alpha, label};
+        }), "shape"_a, "score"_a, "alpha"_a = 0, "label"_a = 0)
+        .def_readwrite("shape", &EvalDetection<T, 4>::shape)
+        .def_readwrite("score", &EvalDetection<T, 4>::score)
+        .def_readwrite("alpha", &EvalDetection<T, 4>::alpha)
+        .def_readwrite("label", &EvalDetection<T, 4>::label);
+    py::class_<EvalAnnotation<T, 4>>(m, "EvalAnnotation")
+        .def(py::init<>())
+        .def(py::init([](const Quad2<T> &shape, T alpha, int32_t label, int8_t difficulty) {
+            return EvalAnnotation<T, 4>{shape, alpha, label, difficulty};
+        }), "shape"_a, "alpha"_a = 0, "label"_a = 0, "difficulty"_a = 0)
+        .def_readwrite("shape", &EvalAnnotation<T, 4>::shape)
+        .def_readwrite("alpha", &EvalAnnotation<T, 4>::alpha)
+        .def_readwrite("label", &EvalAnnotation<T, 4>::label)
+        .def_readwrite("difficulty", &EvalAnnotation<T, 4>::difficulty);
+    py::class_<EvalMetrics>(m, "EvalMetrics")
+        .def_readonly("ap", &EvalMetrics::ap)
+        .def_readonly("aos", &EvalMetrics::aos)
+        .def_readonly("ngt", &EvalMetrics::ngt)
+        .def_readonly("ntp", &EvalMetrics::ntp)
+        .def_readonly("nfp", &EvalMetrics::nfp);
+    py::class_<Evaluator>(m, "APEvaluator")
+        .def(py::init<int32_t, const vector<T>&, int8_t, size_t>(),
+            "nclasses"_a, "iou_thresholds"_a, "ndifficulties"_a = 1, "nbins"_a = 1024)
+        .def("reset", &Evaluator::reset)
+        .def("add_frame", [](Evaluator &e, const vector<EvalDetection<T, 4>> &dets,
+            const vector<EvalAnnotation<T, 4>> &gts) {
+                e.add_frame({dets.data(), dets.size(), gts.data(), gts.size()});
+            }, "Accumulate the matches of one frame", py::call_guard<py::gil_scoped_release>())
+        .def("add_frames", [](Evaluator &e, const vector<pair<vector<EvalDetection<T, 4>>,
+            vector<EvalAnnotation<T, 4>>>> &frames) {
+                vector<EvalFrame<T, 4>> views;
+                for (const auto &f : frames)
+                    views.push_back({f.first.data(), f.first.size(), f.second.data(), f.second.size()});
+                e.add_frames(views.data(), views.size());
+            }, "Accumulate the matches of multiple frames in parallel", py::call_guard<py::gil_scoped_release>())
+        .def("merge", &Evaluator::merge)
+        .def("evaluate", &Evaluator::evaluate, "label"_a, "difficulty"_a = 0, "threshold_index"_a = 0, "nrecall"_a = 40,
+            "Calculate AP and AOS of a class at a difficulty level and an IoU threshold");
+
+    // clustering and fusion utilities from fusion.hpp
+
+    py::class_<FusionBox<T>>(m, "FusionBox")
+        .def(py::init<>())
+        .def(py::init([](T x, T y, T w, T h, T r, T score, int32_t label) {
+            return FusionBox<T>{x, y, w, h, r, score, label};
+        }), "x"_a, "y"_a, "w"_a, "h"_a, "r"_a, "score"_a, "label"_a = 0)
+        .def_readwrite("x", &FusionBox<T>::x)
+        .def_readwrite("y", &FusionBox<T>::y)
+        .def_readwrite("w", &FusionBox<T>::w)
+        .def_readwrite("h", &FusionBox<T>::h)
+        .def_readwrite("r", &FusionBox<T>::r)
+        .def_readwrite("score", &FusionBox<T>::score)
+        .def_readwrite("label", &FusionBox<T>::label);
+    py::class_<BoxFusion<T>>(m, "BoxFusion")
+        .def(py::init<const vector<T>&, const T&, const T&>(),
+            "model_weights"_a, "iou_threshold"_a = 0.55, "skip_threshold"_a = 0)
+        .def("clear", &BoxFusion<T>::clear)
+        .def("add", [](BoxFusion<T> &f, uint32_t model, const vector<FusionBox<T>> &boxes) {
+                f.add(model, boxes.data(), boxes.size());
+            }, "Add detections from a model")
+        .def("fuse", &BoxFusion<T>::fuse, "Fuse the detections added", py::call_guard<py::gil_scoped_release>());
+    m.def("cluster_iou", [](const vector<Quad2<T>> &boxes, const T threshold) {
+            vector<uint32_t> ids(boxes.size());
+            dgal::cluster_iou(boxes.data(), boxes.size(), threshold, ids.data());
+            return ids;
+        }, "Cluster boxes connected by iou larger than the threshold", py::call_guard<py::gil_scoped_release>());
+
+    // visibility utilities from visibility.hpp
+
+    m.def("visibility", [](const vector<Quad2<T>> &boxes, const Point2<T> &viewpoint, const T max_range) {
+            vector<T> fractions(boxes.size());
+            vector<Point2<T>> polygon;
+            dgal::visibility(boxes.data(), boxes.size(), viewpoint, fractions.data(), &polygon, max_range);
+            return make_tuple(fractions, polygon);
+        }, "boxes"_a, "viewpoint"_a = Point2<T>(), "max_range"_a = 1e3,
+        "Get the visible fractions of boxes and the visibility polygon from a viewpoint");
+    m.def("visibility_batch", [](const vector<vector<Quad2<T>>> &scenes, const vector<Point2<T>> &viewpoints) {
+            vector<Quad2<T>> boxes;
+            vector<uint32_t> offsets {0};
+            for (const auto &s : scenes)
+            {
+                boxes.insert(boxes.end(), s.begin(), s.end());
+                offsets.push_back(boxes.size());
+            }
+            vector<T> fractions(boxes.size());
+            {
+                py::gil_scoped_release release;
+                dgal::visibility_batch(boxes.data(), offsets.data(), scenes.size(), viewpoints.data(), fractions.data());
+            }
+            vector<vector<T>> result;
+            for (size_t k = 0; k < scenes.size(); k++)
+                result.emplace_back(fractions.begin() + offsets[k], fractions.begin() + offsets[k+1]);
+            return result;
+        }, "Get the visible fractions of boxes in multiple scenes");
+
+    // persistent spatial index from rtree.hpp
+
+    m.def("write_rtree", [](const string &path, const vector<Poly2<T, 8>> &polys, const vector<uint64_t> &ids) {
+            return dgal::write_rtree(path, polys.data(), polys.size(), ids.empty() ? nullptr : ids.data());
+        }, "path"_a, "polys"_a, "ids"_a = vector<uint64_t>(),
+        "Build a packed R-tree over the polygons and save it to a file", py::call_guard<py::gil_scoped_release>());
+    py::class_<RTree>(m, "MappedRTree")
+        .def(py::init<>())
+        .def(py::init<const string&>())
+        .def("open", &RTree::open,
+            "Memory map an R-tree file, return false if the types don't match, raise RuntimeError if it is corrupted")
+        .def("close", &RTree::close)
+        .def_property_readonly("is_open", &RTree::is_open)
+        .def("__len__", &RTree::size)
+        .def("polygon", &RTree::polygon, py::return_value_policy::reference_internal,
+            "Get the polygon stored at index i (without copying)")
+        .def("id", &RTree::id, "Get the original id of the polygon stored at index i")
+        .def("query", [](const RTree &t, const AABox2<T> &box) {
+                vector<uint32_t> result;
+                t.query(box, result);
+                return result;
+            }, "Get the indices of polygons whose bounding box overlaps the query box")
+        .def("query", [](const RTree &t, const Point2<T> &p) {
+                vector<uint32_t> result;
+                t.query(p, result);
+                return result;
+            }, "Get the indices of polygons containing the point");
+
+    // collision-free placement from placement.hpp
+
+    py::class_<PlacementSampler<T>>(m, "PlacementSampler")
+        .def(py::init<T, uint64_t>(), "cell_size"_a = 4, "seed"_a = 0)
+        .def("clear", &PlacementSampler<T>::clear)
+        .def("add", [](PlacementSampler<T> &s, const vector<Quad2<T>> &boxes) {
+                s.add(boxes.data(), boxes.size());
+            }, "Add existing objects of the scene")
+        .def("__len__", &PlacementSampler<T>::size)
+        .def_property_readonly("boxes", &PlacementSampler<T>::boxes)
+        .def("collides", &PlacementSampler<T>::collides, "Check whether the box collides with the scene")
+        .def("place", [](PlacementSampler<T> &s, const vector<Quad2<T>> &objects, uint32_t ntrials,
+                         T max_shift, T max_rotation) {
+                vector<Quad2<T>> placed(objects.size());
+                vector<uint8_t> success(objects.size());
+                s.place(objects.data(), objects.size(), ntrials, max_shift, max_rotation, placed.data(), success.data());
+                return make_tuple(placed, vector<bool>(success.begin(), success.end()));
+            }, "objects"_a, "ntrials"_a = 10, "max_shift"_a = 0, "max_rotation"_a = 0,
+            "Place objects into the scene without collision, return the poses and whether each object is placed",
+            py::call_guard<py::gil_scoped_release>());
+
+    // box encoding from box_coder.hpp and batch iou from geometry_batch.hpp, the batch kernels are
+    // dispatched by the instruction set (see geometry_kernels.cpp)
+
+    m.def("encode_boxes", [](const vector<vector<T>> &boxes, const vector<vector<T>> &anchors, const BoxEncoding encoding) {
+            vector<T> boxes_v = flatten_rows(boxes, 5), anchors_v = flatten_rows(anchors, 5);
+            vector<T> deltas(boxes.size() * box_code_size(encoding));
+            dgal::encode_boxes(boxes_v.data(), anchors_v.data(), boxes.size(), deltas.data(), encoding);
+            return split_rows(deltas, box_code_size(encoding));
+        }, "boxes"_a, "anchors"_a, "encoding"_a = BoxEncoding::Standard, "Encode xywhr boxes as deltas to the anchors");
+    m.def("decode_boxes", [](const vector<vector<T>> &deltas, const vector<vector<T>> &anchors, const BoxEncoding encoding) {
+            vector<T> deltas_v = flatten_rows(deltas, box_code_size(encoding)), anchors_v = flatten_rows(anchors, 5);
+            vector<T> boxes(deltas.size() * 5);
+            dgal::decode_boxes(deltas_v.data(), anchors_v.data(), deltas.size(), boxes.data(), encoding);
+            return split_rows(boxes, 5);
+        }, "deltas"_a, "anchors"_a, "encoding"_a = BoxEncoding::Standard, "Decode deltas to the anchors as xywhr boxes");
+    m.def("decode_poly2", [](const vector<vector<T>> &deltas, const vector<vector<T>> &anchors, const BoxEncoding encoding) {
+            vector<T> deltas_v = flatten_rows(deltas, box_code_size(encoding)), anchors_v = flatten_rows(anchors, 5);
+            vector<Quad2<T>> polys(deltas.size());
+            kernels().decode_poly2_batch(deltas_v.data(), anchors_v.data(), deltas.size(), polys.data(), int(encoding));
+            return polys;
+        }, "deltas"_a, "anchors"_a, "encoding"_a = BoxEncoding::Standard, "Decode deltas to the anchors as polygons");
+    m.def("decode_poly2_grad", [](const vector<vector<T>> &deltas, const vector<vector<T>> &anchors,
+                                  const vector<Quad2<T>> &grads, const BoxEncoding encoding) {
+            vector<T> deltas_v = flatten_rows(deltas, box_code_size(encoding)), anchors_v = flatten_rows(anchors, 5);
+            vector<T> grad_deltas(deltas_v.size());
+            kernels().decode_poly2_batch_grad(deltas_v.data(), anchors_v.data(), grads.data(), deltas.size(),
+                grad_deltas.data(), int(encoding));
+            return split_rows(grad_deltas, box_code_size(encoding));
+        }, "deltas"_a, "anchors"_a, "grads"_a, "encoding"_a = BoxEncoding::Standard, "Calculate gradient of decode_poly2()");
+    m.def("decode_iou", [](const vector<vector<T>> &deltas, const vector<vector<T>> &anchors,
+                           const vector<Quad2<T>> &targets, const BoxEncoding encoding) {
+            size_t n = deltas.size();
+            if (anchors.size() != n || targets.size() != n)
+                throw std::invalid_argument("the numbers of deltas, anchors and targets don't match");
+            vector<T> deltas_v = flatten_rows(deltas, box_code_size(encoding)), anchors_v = flatten_rows(anchors, 5);
+            vector<T> ious(n);
+            vector<uint32_t> state(n);
+            kernels().decode_iou_batch(deltas_v.data(), anchors_v.data(), targets.data(), n, ious.data(), state.data(),
+                int(encoding), nullptr);
+            return make_tuple(ious, state);
+        }, "deltas"_a, "anchors"_a, "targets"_a, "encoding"_a = BoxEncoding::Standard,
+        "Get the iou of the decoded boxes with the targets and the bit-packed flags for decode_iou_grad()",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("decode_iou_grad", [](const vector<vector<T>> &deltas, const vector<vector<T>> &anchors,
+                                const vector<Quad2<T>> &targets, const vector<T> &grads, const vector<uint32_t> &state,
+                                const BoxEncoding encoding) {
+            size_t n = deltas.size();
+            if (anchors.size() != n || targets.size() != n || grads.size() != n || state.size() != n)
+                throw std::invalid_argument("the numbers of deltas, anchors, targets and gradients don't match");
+            vector<T> deltas_v = flatten_rows(deltas, box_code_size(encoding)), anchors_v = flatten_rows(anchors, 5);
+            vector<T> grad_deltas(deltas_v.size());
+            kernels().decode_iou_batch_grad(deltas_v.data(), anchors_v.data(), targets.data(), n, grads.data(),
+                state.data(), grad_deltas.data(), int(encoding), nullptr);
+            return split_rows(grad_deltas, box_code_size(encoding));
+        }, "deltas"_a, "anchors"_a, "targets"_a, "grads"_a, "state"_a, "encoding"_a = BoxEncoding::Standard,
+        "Calculate gradient of decode_iou() with regard to the deltas", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_batch_", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2) {
+            size_t n = p1.size(); assert(p2.size() == n);
+            vector<T> ious(n);
+            vector<uint8_t> nx(n), xflags(n * 8);
+            kernels().iou_batch(p1.data(), p2.data(), n, ious.data(), nx.data(), xflags.data(), nullptr);
+            vector<vector<uint8_t>> xflags_v;
+            for (size_t k = 0; k < n; k++)
+                xflags_v.emplace_back(xflags.begin() + k * 8, xflags.begin() + k * 8 + nx[k]);
+            return make_tuple(ious, xflags_v);
+        }, "Get the iou of pairs of boxes and return flags", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_batch_status", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2) {
+            size_t n = p1.size();
+            if (p2.size() != n)
+                throw std::invalid_argument("the numbers of boxes don't match");
+            vector<T> ious(n);
+            vector<uint8_t> nx(n), xflags(n * 8), status(n);
+            kernels().iou_batch(p1.data(), p2.data(), n, ious.data(), nx.data(), xflags.data(), status.data());
+            vector<vector<uint8_t>> xflags_v;
+            for (size_t k = 0; k < n; k++)
+                xflags_v.emplace_back(xflags.begin() + k * 8, xflags.begin() + k * 8 + nx[k]);
+            return make_tuple(ious, xflags_v, status);
+        }, "Get the iou of pairs of boxes and return flags and the PairStatus of each pair",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("iou_batch_grad", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2, const vector<T> &grads,
+                               const vector<vector<uint8_t>> &xflags_v) {
+            size_t n = p1.size();
+            vector<uint8_t> nx(n), xflags(n * 8);
+            for (size_t k = 0; k < n; k++)
+            {
+                nx[k] = xflags_v[k].size();
+                std::copy(xflags_v[k].begin(), xflags_v[k].end(), xflags.begin() + k * 8);
+            }
+            vector<Quad2<T>> grad_p1(n), grad_p2(n);
+            kernels().iou_batch_grad(p1.data(), p2.data(), n, grads.data(), nx.data(), xflags.data(),
+                grad_p1.data(), grad_p2.data(), nullptr);
+            return make_tuple(grad_p1, grad_p2);
+        }, "Calculate gradient of iou_batch_()", py::call_guard<py::gil_scoped_release>());
+    m.def("hausdorff_distance_batch", [](const vector<Poly2<T, 8>> &p1, const vector<Poly2<T, 8>> &p2) {
+            size_t n = p1.size();
+            if (p2.size() != n)
+                throw std::invalid_argument("the numbers of polygons don't match");
+            vector<T> distances(n);
+            vector<uint8_t> flags(n * 2);
+            dgal::hausdorff_distance_batch(p1.data(), p2.data(), n, distances.data(), flags.data());
+            return make_tuple(distances, flags);
+        }, "Get the Hausdorff distances between the boundaries of pairs of polygons and return flags",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("hausdorff_distance_batch_grad", [](const vector<Poly2<T, 8>> &p1, const vector<Poly2<T, 8>> &p2,
+                                              const vector<T> &grads, const vector<uint8_t> &flags) {
+            size_t n = p1.size();
+            if (p2.size() != n || grads.size() != n || flags.size() != n * 2)
+                throw std::invalid_argument("the numbers of polygons, gradients and flags don't match");
+            vector<Poly2<T, 8>> grad_p1(n), grad_p2(n);
+            dgal::hausdorff_distance_batch_grad(p1.data(), p2.data(), n, grads.data(), flags.data(),
+                grad_p1.data(), grad_p2.data());
+            return make_tuple(grad_p1, grad_p2);
+        }, "Calculate gradient of hausdorff_distance_batch()", py::call_guard<py::gil_scoped_release>());
+    m.def("chamfer_distance_batch", [](const vector<Poly2<T, 8>> &p1, const vector<Poly2<T, 8>> &p2) {
+            size_t n = p1.size();
+            if (p2.size() != n)
+                throw std::invalid_argument("the numbers of polygons don't match");
+            vector<T> distances(n);
+            vector<uint8_t> flags(n * 16);
+            dgal::chamfer_distance_batch(p1.data(), p2.data(), n, distances.data(), flags.data());
+            vector<vector<uint8_t>> flags_v;
+            for (size_t k = 0; k < n; k++)
+                flags_v.emplace_back(flags.begin() + k * 16, flags.begin() + k * 16 + p1[k].nvertices + p2[k].nvertices);
+            return make_tuple(distances, flags_v);
+        }, "Get the Chamfer distances between the boundaries of pairs of polygons and return flags",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("chamfer_distance_batch_grad", [](const vector<Poly2<T, 8>> &p1, const vector<Poly2<T, 8>> &p2,
+                                            const vector<T> &grads, const vector<vector<uint8_t>> &flags_v) {
+            size_t n = p1.size();
+            if (p2.size() != n || grads.size() != n || flags_v.size() != n)
+                throw std::invalid_argument("the numbers of polygons, gradients and flags don't match");
+            vector<uint8_t> flags(n * 16);
+            for (size_t k = 0; k < n; k++)
+            {
+                if (flags_v[k].size() != size_t(p1[k].nvertices + p2[k].nvertices))
+                    throw std::invalid_argument("the flags don't match the polygons");
+                std::copy(flags_v[k].begin(), flags_v[k].end(), flags.begin() + k * 16);
+            }
+            vector<Poly2<T, 8>> grad_p1(n), grad_p2(n);
+            dgal::chamfer_distance_batch_grad(p1.data(), p2.data(), n, grads.data(), flags.data(),
+                grad_p1.data(), grad_p2.data());
+            return make_tuple(grad_p1, grad_p2);
+        }, "Calculate gradient of chamfer_distance_batch()", py::call_guard<py::gil_scoped_release>());
+    m.def("moments_batch", [](const vector<Poly2<T, 8>> &polys) {
+            vector<Moments2<T>> result(polys.size());
+            dgal::moments_batch(polys.data(), polys.size(), result.data());
+            return result;
+        }, "Get the area moments of polygons", py::call_guard<py::gil_scoped_release>());
+    m.def("moments_batch_grad", [](const vector<Poly2<T, 8>> &polys, const vector<Moments2<T>> &grads) {
+            if (grads.size() != polys.size())
+                throw std::invalid_argument("the numbers of polygons and gradients don't match");
+            vector<Poly2<T, 8>> grad_polys(polys.size());
+            dgal::moments_batch_grad(polys.data(), polys.size(), grads.data(), grad_polys.data());
+            return grad_polys;
+        }, "Calculate gradient of moments_batch()", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_batch_packed", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2) {
+            size_t n = p1.size();
+            if (p2.size() != n)
+                throw std::invalid_argument("the numbers of boxes don't match");
+            vector<T> ious(n);
+            vector<uint32_t> state(n);
+            kernels().iou_batch_packed(p1.data(), p2.data(), n, ious.data(), state.data(), nullptr);
+            return make_tuple(ious, state);
+        }, "Get the iou of pairs of boxes and return the bit-packed flags for iou_batch_grad_packed()",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("iou_batch_grad_packed", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2, const vector<T> &grads,
+                                      const vector<uint32_t> &state) {
+            size_t n = p1.size();
+            if (p2.size() != n || grads.size() != n || state.size() != n)
+                throw std::invalid_argument("the numbers of boxes, gradients and states don't match");
+            vector<Quad2<T>> grad_p1(n), grad_p2(n);
+            kernels().iou_batch_grad_packed(p1.data(), p2.data(), n, grads.data(), state.data(),
+                grad_p1.data(), grad_p2.data(), nullptr);
+            return make_tuple(grad_p1, grad_p2);
+        }, "Calculate gradient of iou_batch_packed()", py::call_guard<py::gil_scoped_release>());
+    m.def("giou_batch_packed", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2) {
+            size_t n = p1.size();
+            if (p2.size() != n)
+                throw std::invalid_argument("the numbers of boxes don't match");
+            vector<T> gious(n);
+            vector<uint64_t> state(n);
+            dgal::giou_batch_packed(p1.data(), p2.data(), n, gious.data(), state.data());
+            return make_tuple(gious, state);
+        }, "Get the giou of pairs of boxes and return the bit-packed flags for giou_batch_grad_packed()",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("giou_batch_grad_packed", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2, const vector<T> &grads,
+                                       const vector<uint64_t> &state) {
+            size_t n = p1.size();
+            if (p2.size() != n || grads.size() != n || state.size() != n)
+                throw std::invalid_argument("the numbers of boxes, gradients and states don't match");
+            vector<Quad2<T>> grad_p1(n), grad_p2(n);
+            dgal::giou_batch_grad_packed(p1.data(), p2.data(), n, grads.data(), state.data(), grad_p1.data(), grad_p2.data());
+            return make_tuple(grad_p1, grad_p2);
+        }, "Calculate gradient of giou_batch_packed()", py::call_guard<py::gil_scoped_release>());
+    m.def("diou_batch_packed", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2) {
+            size_t n = p1.size();
+            if (p2.size() != n)
+                throw std::invalid_argument("the numbers of boxes don't match");
+            vector<T> dious(n);
+            vector<uint64_t> state(n);
+            dgal::diou_batch_packed(p1.data(), p2.data(), n, dious.data(), state.data());
+            return make_tuple(dious, state);
+        }, "Get the diou of pairs of boxes and return the bit-packed flags for diou_batch_grad_packed()",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("diou_batch_grad_packed", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2, const vector<T> &grads,
+                                       const vector<uint64_t> &state) {
+            size_t n = p1.size();
+            if (p2.size() != n || grads.size() != n || state.size() != n)
+                throw std::invalid_argument("the numbers of boxes, gradients and states don't match");
+            vector<Quad2<T>> grad_p1(n), grad_p2(n);
+            dgal::diou_batch_grad_packed(p1.data(), p2.data(), n, grads.data(), state.data(), grad_p1.data(), grad_p2.data());
+            return make_tuple(grad_p1, grad_p2);
+        }, "Calculate gradient of diou_batch_packed()", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_sparse", [](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2, const T min_iou) {
+            return iou_sparse_boxes(p1, p2, min_iou);
+        }, "p1"_a, "p2"_a, "min_iou"_a = 0, "Get (i, j, iou) of the pairs with iou > min_iou from two sets of boxes",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("canonicalize", [](Poly2<T, 8> p, const T tolerance) {
+            uint8_t status = dgal::canonicalize(p, tolerance);
+            return make_tuple(p, status);
+        }, "p"_a, "tolerance"_a = 1e-6, "Repair a polygon to counter-clockwise order without duplicate or collinear vertices, "
+        "return the polygon and its PolyStatus flags");
+    m.def("canonicalize_batch", [](vector<Poly2<T, 8>> polys, const T tolerance) {
+            vector<uint8_t> status(polys.size());
+            kernels().canonicalize_batch(polys.data(), polys.size(), status.data(), tolerance);
+            return make_tuple(polys, status);
+        }, "polys"_a, "tolerance"_a = 1e-6, "Repair polygons with canonicalize(), return the polygons and their PolyStatus flags",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("iou_batch_async", [](vector<Quad2<T>> p1, vector<Quad2<T>> p2) {
+            return submit_async([p1 = std::move(p1), p2 = std::move(p2)]() {
+                vector<T> ious(p1.size());
+                kernels().iou_batch(p1.data(), p2.data(), p1.size(), ious.data(), nullptr, nullptr, nullptr);
+                return ious;
+            });
+        }, "Get the iou of pairs of boxes asynchronously, return a concurrent.futures.Future");
+    m.def("iou_sparse_async", [](vector<Quad2<T>> p1, vector<Quad2<T>> p2, const T min_iou) {
+            return submit_async([p1 = std::move(p1), p2 = std::move(p2), min_iou]() {
+                return iou_sparse_boxes(p1, p2, min_iou);
+            });
+        }, "p1"_a, "p2"_a, "min_iou"_a = 0, "Asynchronous version of iou_sparse(), return a concurrent.futures.Future");
+    m.def("set_async_queue_depth", [](size_t n) { AsyncExecutor::global().set_max_pending(n); },
+        "Set the max number of unfinished asynchronous jobs, submission blocks when it's reached");
+    m.def("kernel_isa", []() {
+            ISA isa; kernels(&isa);
+            return string(isa_name(isa));
+        }, "Get the instruction set of the kernels selected for this CPU");
+
+    // ragged polygon batches from ragged.hpp
+
+    py::class_<RaggedPoly2<T>>(m, "RaggedPoly2")
+        .def(py::init<>())
+        .def(py::init([](const vector<vector<Point2<T>>> &polys) {
+                RaggedPoly2<T> r;
+                for (const auto &p : polys)
+                    r.push_back(p.data(), p.size());
+                return r;
+            }))
+        .def("push_back", [](RaggedPoly2<T> &r, const vector<Point2<T>> &points) {
+                r.push_back(points.data(), points.size());
+            }, "Append a polygon given by its vertices")
+        .def("__len__", &RaggedPoly2<T>::size)
+        .def("nvertices", &RaggedPoly2<T>::nvertices)
+        .def_readonly("offsets", &RaggedPoly2<T>::offsets)
+        .def_readonly("vertices", &RaggedPoly2<T>::vertices);
+    m.def("area_batch", [](const RaggedPoly2<T> &polys) {
+            vector<T> areas(polys.size());
+            dgal::area_batch(polys, areas.data());
+            return areas;
+        }, "Get the areas of polygons in a ragged batch", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_pairs", [](const RaggedPoly2<T> &p1, const RaggedPoly2<T> &p2, const vector<IndexPair> &pairs) {
+            vector<T> ious(pairs.size());
+            dgal::iou_pairs(p1, p2, pairs.data(), pairs.size(), ious.data());
+            return ious;
+        }, "Get the iou of the given pairs of polygons from two ragged batches", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_pairs_status", [](const RaggedPoly2<T> &p1, const RaggedPoly2<T> &p2, const vector<IndexPair> &pairs) {
+            vector<T> ious(pairs.size());
+            vector<uint8_t> status(pairs.size());
+            dgal::iou_pairs(p1, p2, pairs.data(), pairs.size(), ious.data(), status.data());
+            return make_tuple(ious, status);
+        }, "Get the iou and the PairStatus of the given pairs of polygons from two ragged batches",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("iou_sparse", [](const RaggedPoly2<T> &p1, const RaggedPoly2<T> &p2, const T min_iou) {
+            vector<SparseEntry<T>> entries;
+            dgal::iou_sparse(p1, p2, entries, min_iou);
+            vector<tuple<uint32_t, uint32_t, T>> result;
+            for (const auto &e : entries)
+                result.emplace_back(e.i, e.j, e.value);
+            return result;
+        }, "p1"_a, "p2"_a, "min_iou"_a = 0, "Get (i, j, iou) of the pairs with iou > min_iou from two ragged batches",
+        py::call_guard<py::gil_scoped_release>());
+
+    // shared polygon store from polygon_store.hpp
+
+    m.def("write_polygon_store", [](const string &path, const RaggedPoly2<T> &polys, const vector<uint64_t> &ids) {
+            if (!ids.empty() && ids.size() != polys.size())
+                throw std::invalid_argument("the numbers of polygons and ids don't match");
+            return dgal::write_polygon_store(path, polys, ids.empty() ? nullptr : ids.data());
+        }, "path"_a, "polys"_a, "ids"_a = vector<uint64_t>(),
+        "Save the polygons with their bounding boxes and edge lines to a store file", py::call_guard<py::gil_scoped_release>());
+    py::class_<PolygonStore>(m, "MappedPolygonStore")
+        .def(py::init<>())
+        .def(py::init<const string&>())
+        .def("open", &PolygonStore::open, "Memory map a polygon store file, return false if it is invalid")
+        .def("close", &PolygonStore::close)
+        .def_property_readonly("is_open", &PolygonStore::is_open)
+        .def("__len__", &PolygonStore::size)
+        .def("nvertices", &PolygonStore::nvertices)
+        .def("box", &PolygonStore::box)
+        .def("id", &PolygonStore::id, "Get the id of the polygon stored at index i")
+        .def("polygon", [](const PolygonStore &s, size_t i) {
+                vector<Point2<T>> points(s.nvertices(i));
+                for (uint32_t k = 0; k < points.size(); k++)
+                    points[k] = {.x = s.xs()[s.offsets()[i] + k], .y = s.ys()[s.offsets()[i] + k]};
+                return points;
+            }, "Get a copy of the vertices of polygon i")
+        .def("contains", &PolygonStore::contains, "Check whether polygon i contains the point");
+    m.def("area_batch", [](const PolygonStore &polys) {
+            vector<T> areas(polys.size());
+            dgal::area_batch(polys, areas.data());
+            return areas;
+        }, "Get the areas of polygons in a store", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_pairs", [](const PolygonStore &p1, const PolygonStore &p2, const vector<IndexPair> &pairs) {
+            vector<T> ious(pairs.size());
+            dgal::iou_pairs(p1, p2, pairs.data(), pairs.size(), ious.data());
+            return ious;
+        }, "Get the iou of the given pairs of polygons from two stores", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_pairs", [](const RaggedPoly2<T> &p1, const PolygonStore &p2, const vector<IndexPair> &pairs) {
+            vector<T> ious(pairs.size());
+            dgal::iou_pairs(p1, p2, pairs.data(), pairs.size(), ious.data());
+            return ious;
+        }, "Get the iou of the given pairs of polygons from a ragged batch and a store",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("iou_sparse", [](const RaggedPoly2<T> &p1, const PolygonStore &p2, const T min_iou) {
+            vector<SparseEntry<T>> entries;
+            dgal::iou_sparse(p1, p2, entries, min_iou);
+            vector<tuple<uint32_t, uint32_t, T>> result;
+            for (const auto &e : entries)
+                result.emplace_back(e.i, e.j, e.value);
+            return result;
+        }, "p1"_a, "p2"_a, "min_iou"_a = 0, "Get (i, j, iou) of the pairs with iou > min_iou between a ragged batch and a store",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("find_containing", [](const PolygonStore &polys, const vector<Point2<T>> &points) {
+            vector<IndexPair> result;
+            dgal::find_containing(polys, points.data(), points.size(), result);
+            return result;
+        }, "Get the (point index, polygon index) pairs where the polygon in the store contains the point",
+        py::call_guard<py::gil_scoped_release>());
+
+    // local batching server from server.hpp
+
+    py::class_<GeometryServer<T>>(m, "GeometryServer")
+        .def(py::init([](const string &path, size_t max_batch, double max_delay) {
+                return new GeometryServer<T>(path, max_batch, std::chrono::microseconds(int64_t(max_delay * 1e6)));
+            }), "path"_a, "max_batch"_a = 1 << 16, "max_delay"_a = 1e-3)
+        .def("listen", &GeometryServer<T>::listen, "Create the socket, return false if failed")
+        .def("run", &GeometryServer<T>::run, "Serve the clients until stop() is called",
+            py::call_guard<py::gil_scoped_release>())
+        .def("stop", &GeometryServer<T>::stop)
+        .def_property_readonly("nclients", &GeometryServer<T>::nclients)
+        .def_property_readonly("nbatches", &GeometryServer<T>::nbatches);
+    py::class_<GeometryClient<T>>(m, "GeometryClient")
+        .def(py::init<>())
+        .def("connect", &GeometryClient<T>::connect, "path"_a, "buffer_size"_a = 1 << 24,
+            "Connect to a server, return false if failed")
+        .def("close", &GeometryClient<T>::close)
+        .def_property_readonly("connected", &GeometryClient<T>::connected)
+        .def("iou", [](GeometryClient<T> &c, const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2) {
+                vector<T> ious(p1.size());
+                if (!c.iou(p1.data(), p2.data(), p1.size(), ious.data()))
+                    throw std::runtime_error("the request failed");
+                return ious;
+            }, "Get the iou of pairs of boxes from the server", py::call_guard<py::gil_scoped_release>())
+        .def("area", [](GeometryClient<T> &c, const vector<Quad2<T>> &p) {
+                vector<T> areas(p.size());
+                if (!c.area(p.data(), p.size(), areas.data()))
+                    throw std::runtime_error("the request failed");
+                return areas;
+            }, "Get the areas of boxes from the server", py::call_guard<py::gil_scoped_release>());
+
+    // fused kernels from expression.hpp
+
+    m.def("intersection_area", [](const Quad2<T>& b1, const Quad2<T>& b2) {
+            return lazy::area(lazy::intersect(b1, b2));
+        }, "Get the area of intersection of two boxes without constructing the intersection");
+    m.def("merged_dimension", [](const Quad2<T>& b1, const Quad2<T>& b2) {
+            return lazy::dimension(lazy::merge(b1, b2));
+        }, "Get the dimension of the merged hull of two boxes without constructing the hull");
+
+    // ... from sector.hpp
+
+    py::class_<Circle2<T>>(m, "Circle2")
+        .def(py::init<>())
+        .def(py::init([](const Point2<T> &center, const T radius) {
+            return Circle2<T>{.center = center, .radius = radius}; }))
+        .def_readwrite("center", &Circle2<T>::center)
+        .def_readwrite("radius", &Circle2<T>::radius);
+    py::class_<Sector2<T>>(m, "Sector2")
+        .def(py::init<>())
+        .def(py::init([](const Point2<T> &center, const T radius, const T heading, const T half_angle) {
+            return Sector2<T>{.center = center, .radius = radius, .heading = heading, .half_angle = half_angle}; }))
+        .def_readwrite("center", &Sector2<T>::center)
+        .def_readwrite("radius", &Sector2<T>::radius)
+        .def_readwrite("heading", &Sector2<T>::heading)
+        .def_readwrite("half_angle", &Sector2<T>::half_angle);
+    m.def("area", py::overload_cast<const Circle2<T>&>(&dgal::area<T>), "Get the area of circle");
+    m.def("area", py::overload_cast<const Sector2<T>&>(&dgal::area<T>), "Get the area of circular sector");
+    m.def("intersection_area", [](const Quad2<T>& b, const Circle2<T>& c) { return dgal::intersection_area(b, c); },
+        "Get the area of the part of a box inside a circle");
+    m.def("intersection_area", [](const Quad2<T>& b, const Sector2<T>& s) { return dgal::intersection_area(b, s); },
+        "Get the area of the part of a box inside a circular sector");
+    m.def("intersects", [](const Quad2<T>& b, const Circle2<T>& c) { return dgal::intersects(b, c); },
+        "Check whether a box overlaps a circle");
+    m.def("intersects", [](const Quad2<T>& b, const Sector2<T>& s) { return dgal::intersects(b, s); },
+        "Check whether a box overlaps a circular sector");
+    m.def("intersection_area_grad", [](const Quad2<T>& b, const Circle2<T>& c, const T grad) {
+            Quad2<T> grad_b; Circle2<T> grad_c;
+            grad_b.zero(); grad_c.zero();
+            dgal::intersection_area_grad(b, c, grad, grad_b, grad_c);
+            return make_tuple(grad_b, grad_c);
+        }, "Calculate gradient of intersection_area() with a circle");
+    m.def("intersection_area_grad", [](const Quad2<T>& b, const Sector2<T>& s, const T grad) {
+            Quad2<T> grad_b; Sector2<T> grad_s;
+            grad_b.zero(); grad_s.zero();
+            dgal::intersection_area_grad(b, s, grad, grad_b, grad_s);
+            return make_tuple(grad_b, grad_s);
+        }, "Calculate gradient of intersection_area() with a circular sector");
+    m.def("intersection_area_batch", [](const vector<Quad2<T>>& boxes, const Sector2<T>& s) {
+            vector<T> areas(boxes.size());
+            dgal::intersection_area_batch(boxes.data(), boxes.size(), s, areas.data());
+            return areas;
+        }, "Get the areas of the parts of boxes inside a circular sector", py::call_guard<py::gil_scoped_release>());
+    m.def("intersects_batch", [](const vector<Quad2<T>>& boxes, const Sector2<T>& s) {
+            std::unique_ptr<bool[]> results(new bool[boxes.size()]);
+            dgal::intersects_batch(boxes.data(), boxes.size(), s, results.get());
+            return vector<bool>(results.get(), results.get() + boxes.size());
+        }, "Check whether boxes overlap a circular sector", py::call_guard<py::gil_scoped_release>());
+    m.def("intersection_area_batch_grad", [](const vector<Quad2<T>>& boxes, const Sector2<T>& s, const vector<T>& grads) {
+            if (grads.size() != boxes.size())
+                throw std::invalid_argument("the numbers of boxes and gradients don't match");
+            vector<Quad2<T>> grad_boxes(boxes.size()); Sector2<T> grad_s;
+            dgal::intersection_area_batch_grad(boxes.data(), boxes.size(), s, grads.data(), grad_boxes.data(), grad_s);
+            return make_tuple(grad_boxes, grad_s);
+        }, "Calculate gradient of intersection_area_batch()", py::call_guard<py::gil_scoped_release>());
+
+    // ... from ellipse.hpp
+
+    py::class_<Ellipse2<T>>(m, "Ellipse2")
+        .def(py::init<>())
+        .def(py::init([](const Point2<T> &center, const T a, const T b, const T rotation) {
+            return Ellipse2<T>{.center = center, .a = a, .b = b, .rotation = rotation}; }))
+        .def_readwrite("center", &Ellipse2<T>::center)
+        .def_readwrite("a", &Ellipse2<T>::a)
+        .def_readwrite("b", &Ellipse2<T>::b)
+        .def_readwrite("rotation", &Ellipse2<T>::rotation)
+        .def("contains", &Ellipse2<T>::contains);
+    m.def("ellipse2_from_covariance", &dgal::ellipse2_from_covariance<T>,
+        "Create the ellipse of a 2D gaussian", py::arg("x"), py::arg("y"), py::arg("sxx"), py::arg("sxy"), py::arg("syy"),
+        py::arg("nsigma") = 1);
+    m.def("area", py::overload_cast<const Ellipse2<T>&>(&dgal::area<T>), "Get the area of ellipse");
+    m.def("intersection_area", [](const Quad2<T>& b, const Ellipse2<T>& e) { return dgal::intersection_area(b, e); },
+        "Get the area of the part of a box inside an ellipse");
+    m.def("intersects", [](const Quad2<T>& b, const Ellipse2<T>& e) { return dgal::intersects(b, e); },
+        "Check whether a box overlaps an ellipse");
+    m.def("intersection_area_grad", [](const Quad2<T>& b, const Ellipse2<T>& e, const T grad) {
+            Quad2<T> grad_b; Ellipse2<T> grad_e;
+            grad_b.zero(); grad_e.zero();
+            dgal::intersection_area_grad(b, e, grad, grad_b, grad_e);
+            return make_tuple(grad_b, grad_e);
+        }, "Calculate gradient of intersection_area() with an ellipse");
+    m.def("intersection_area", py::overload_cast<const Ellipse2<T>&, const Ellipse2<T>&>(&dgal::intersection_area<T>),
+        "Get the area of the intersection of two ellipses");
+    m.def("iou", py::overload_cast<const Ellipse2<T>&, const Ellipse2<T>&>(&dgal::iou<T>),
+        "Get the intersection over union of two ellipses");
+    m.def("iou_grad", [](const Ellipse2<T>& e1, const Ellipse2<T>& e2, const T grad) {
+            Ellipse2<T> grad_e1, grad_e2;
+            dgal::iou_grad(e1, e2, grad, grad_e1, grad_e2);
+            return make_tuple(grad_e1, grad_e2);
+        }, "Calculate gradient of iou() of two ellipses");
+    m.def("intersection_area_batch", [](const vector<Quad2<T>>& boxes, const Ellipse2<T>& e) {
+            vector<T> areas(boxes.size());
+            dgal::intersection_area_batch(boxes.data(), boxes.size(), e, areas.data());
+            return areas;
+        }, "Get the areas of the parts of boxes inside an ellipse", py::call_guard<py::gil_scoped_release>());
+    m.def("intersection_area_batch_grad", [](const vector<Quad2<T>>& boxes, const Ellipse2<T>& e, const vector<T>& grads) {
+            if (grads.size() != boxes.size())
+                throw std::invalid_argument("the numbers of boxes and gradients don't match");
+            vector<Quad2<T>> grad_boxes(boxes.size()); Ellipse2<T> grad_e;
+            dgal::intersection_area_batch_grad(boxes.data(), boxes.size(), e, grads.data(), grad_boxes.data(), grad_e);
+            return make_tuple(grad_boxes, grad_e);
+        }, "Calculate gradient of intersection_area_batch() with an ellipse", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_batch", [](const vector<Ellipse2<T>>& e1, const vector<Ellipse2<T>>& e2) {
+            if (e1.size() != e2.size())
+                throw std::invalid_argument("the numbers of ellipses don't match");
+            vector<T> ious(e1.size());
+            dgal::iou_batch(e1.data(), e2.data(), e1.size(), ious.data());
+            return ious;
+        }, "Get the IoUs of pairs of ellipses", py::call_guard<py::gil_scoped_release>());
+    m.def("iou_batch_grad", [](const vector<Ellipse2<T>>& e1, const vector<Ellipse2<T>>& e2, const vector<T>& grads) {
+            if (e1.size() != e2.size() || grads.size() != e1.size())
+                throw std::invalid_argument("the numbers of ellipses and gradients don't match");
+            vector<Ellipse2<T>> grad_e1(e1.size()), grad_e2(e1.size());
+            dgal::iou_batch_grad(e1.data(), e2.data(), e1.size(), grads.data(), grad_e1.data(), grad_e2.data());
+            return make_tuple(grad_e1, grad_e2);
+        }, "Calculate gradient of iou_batch() of ellipses", py::call_guard<py::gil_scoped_release>());
+
+    // ... from tiling.hpp
+
+    py::class_<TileGrid<T>>(m, "TileGrid")
+        .def(py::init<>())
+        .def(py::init([](const Point2<T> &origin, const T cell_width, const T cell_height) {
+            return TileGrid<T>{.origin = origin, .cell_width = cell_width, .cell_height = cell_height}; }))
+        .def_readwrite("origin", &TileGrid<T>::origin)
+        .def_readwrite("cell_width", &TileGrid<T>::cell_width)
+        .def_readwrite("cell_height", &TileGrid<T>::cell_height)
+        .def("cell", &TileGrid<T>::cell, "Get the bounding box of a tile");
+    py::class_<TilePiece<T, 4>>(m, "TilePiece")
+        .def_readonly("tile_x", &TilePiece<T, 4>::tile_x)
+        .def_readonly("tile_y", &TilePiece<T, 4>::tile_y)
+        .def_readonly("source", &TilePiece<T, 4>::source)
+        .def_readonly("polygon", &TilePiece<T, 4>::polygon)
+        .def_property_readonly("xflags", [](const TilePiece<T, 4> &p) {
+            return vector<uint8_t>(p.xflags, p.xflags + p.polygon.nvertices); });
+    m.def("partition", [](const Quad2<T>& b, const TileGrid<T>& grid) {
+            vector<TilePiece<T, 4>> pieces;
+            dgal::partition(b, grid, pieces);
+            return pieces;
+        }, "Partition a box across the tiles of a grid");
+    m.def("partition_batch", [](const vector<Quad2<T>>& boxes, const TileGrid<T>& grid) {
+            vector<TilePiece<T, 4>> pieces;
+            dgal::partition_batch(boxes.data(), boxes.size(), grid, pieces);
+            return pieces;
+        }, "Partition boxes across the tiles of a grid, the pieces are ordered by tile",
+        py::call_guard<py::gil_scoped_release>());
+
+    // ... from sharding.hpp
+
+    auto sparse_tuples = [](const vector<SparseEntry<T>> &entries) {
+        vector<tuple<uint32_t, uint32_t, T>> result;
+        for (const auto &e : entries)
+            result.emplace_back(e.i, e.j, e.value);
+        return result;
+    };
+    m.def("write_shards", [](const string &directory, const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2,
+            const TileGrid<T> &grid, const T min_iou) {
+            return dgal::write_shards(directory, p1.data(), p1.size(), p2.data(), p2.size(), grid, min_iou);
+        }, "directory"_a, "p1"_a, "p2"_a, "grid"_a, "min_iou"_a = 0,
+        "Split a sharded iou_sparse job of two sets of boxes into the directory, return false if failed",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("run_shard_worker", &dgal::run_shard_worker<T, 4, 4>, "directory"_a,
+        "Process the unclaimed shards of a job in the directory, return false if failed",
+        py::call_guard<py::gil_scoped_release>());
+    m.def("merge_shards", [sparse_tuples](const string &directory, bool finish_missing) {
+            vector<SparseEntry<T>> entries;
+            bool ok;
+            {
+                py::gil_scoped_release release;
+                ok = dgal::merge_shards<T, 4, 4>(directory, entries, finish_missing);
+            }
+            if (!ok)
+                throw std::runtime_error("failed to merge the shards");
+            return sparse_tuples(entries);
+        }, "directory"_a, "finish_missing"_a = true, "Get (i, j, iou) of a sharded job from the directory");
+    m.def("iou_sparse_sharded", [sparse_tuples](const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2,
+            const TileGrid<T> &grid, const string &directory, size_t nprocs, const T min_iou) {
+            vector<SparseEntry<T>> entries;
+            bool ok;
+            {
+                py::gil_scoped_release release;
+                ok = dgal::iou_sparse_sharded(p1.data(), p1.size(), p2.data(), p2.size(), grid, directory,
+                    nprocs, entries, min_iou);
+            }
+            if (!ok)
+                throw std::runtime_error("the sharded job failed");
+            return sparse_tuples(entries);
+        }, "p1"_a, "p2"_a, "grid"_a, "directory"_a, "nprocs"_a = 4, "min_iou"_a = 0,
+        "Get (i, j, iou) of the pairs with iou > min_iou from two sets of boxes using worker processes");
+
+    // ... from pair_cache.hpp
+
+    py::class_<PairKey>(m, "PairKey")
+        .def(py::init<>())
+        .def(py::init([](uint32_t id1, uint32_t version1, uint32_t id2, uint32_t version2) {
+            return PairKey{.id1 = id1, .version1 = version1, .id2 = id2, .version2 = version2}; }),
+            "id1"_a, "version1"_a, "id2"_a, "version2"_a)
+        .def_readwrite("id1", &PairKey::id1)
+        .def_readwrite("version1", &PairKey::version1)
+        .def_readwrite("id2", &PairKey::id2)
+        .def_readwrite("version2", &PairKey::version2);
+    py::class_<PairCache<T, 4, 4>>(m, "PairCache")
+        .def(py::init<size_t>(), "capacity"_a = 1 << 16)
+        .def_property_readonly("capacity", &PairCache<T, 4, 4>::capacity)
+        .def_property_readonly("frame", &PairCache<T, 4, 4>::frame)
+        .def("next_frame", &PairCache<T, 4, 4>::next_frame)
+        .def("clear", &PairCache<T, 4, 4>::clear);
+    m.def("iou_batch_cached", [](PairCache<T, 4, 4> &cache, const vector<PairKey> &keys,
+            const vector<Quad2<T>> &p1, const vector<Quad2<T>> &p2) {
+            size_t n = p1.size();
+            if (p2.size() != n || keys.size() != n)
+                throw std::invalid_argument("the numbers of keys and boxes don't match");
+            vector<T> ious(n);
+            vector<uint8_t> nx(n), xflags(n * 8);
+            size_t nhits = dgal::iou_batch_cached(cache, keys.data(), p1.data(), p2.data(), n, ious.data(),
+                (T*)nullptr, nx.data(), xflags.data());
+            vector<vector<uint8_t>> xflags_v;
+            for (size_t k = 0; k < n; k++)
+                xflags_v.emplace_back(xflags.begin() + k * 8, xflags.begin() + k * 8 + nx[k]);
+            return make_tuple(ious, xflags_v, nhits);
+        }, "Get the iou of pairs of boxes like iou_batch_(), reusing the results cached with the same keys. "
+        "The number of cache hits is returned as well", py::call_guard<py::gil_scoped_release>());
+}
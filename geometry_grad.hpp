@@ -161,11 +161,12 @@ void distance_grad(const Line2<scalar_t> &l, const Point2<scalar_t> &p, const sc
 {
     scalar_t hab = hypot(l.a, l.b);
     scalar_t hab3 = hab * hab * hab;
+    scalar_t num = l.a*p.x + l.b*p.y + l.c;
 
     grad_p.x += grad * l.a / hab;
     grad_p.y += grad * l.b / hab;
-    grad_l.a += grad * l.a * p.y * p.y / hab3;
-    grad_l.b += grad * l.b * p.x * p.x / hab3;
+    grad_l.a += grad * (p.x / hab - num * l.a / hab3);
+    grad_l.b += grad * (p.y / hab - num * l.b / hab3);
     grad_l.c += grad * 1 / hab;
 }
 
@@ -214,6 +215,165 @@ void distance_grad(const Poly2<scalar_t, MaxPoints> &poly, const Point2<scalar_t
     segment2_from_pp_grad(poly.vertices[idx], poly.vertices[nidx], grad_s, grad_poly.vertices[idx], grad_poly.vertices[nidx]);
 }
 
+// gradient of the cumulative length at vertex idx
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+void _lengths_grad(const Polyline2<scalar_t, MaxPoints> &l, const uint8_t &idx, const scalar_t &grad,
+    Polyline2<scalar_t, MaxPoints> &grad_l)
+{
+    for (uint8_t j = 0; j < idx; j++)
+        if (l.vertices[j].x != l.vertices[j+1].x || l.vertices[j].y != l.vertices[j+1].y)
+            distance_grad(l.vertices[j+1], l.vertices[j], grad, grad_l.vertices[j+1], grad_l.vertices[j]);
+}
+
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+void length_grad(const Polyline2<scalar_t, MaxPoints> &l, const scalar_t &grad, Polyline2<scalar_t, MaxPoints> &grad_l)
+{
+    grad_l.nvertices = l.nvertices;
+    if (l.nvertices > 0)
+        _lengths_grad(l, l.nvertices - 1, grad, grad_l);
+}
+
+// idx is the segment index reported by project()
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+void project_grad(const Polyline2<scalar_t, MaxPoints> &l, const Point2<scalar_t> &p,
+    const scalar_t &grad_s, const scalar_t &grad_offset, const uint8_t &idx,
+    Polyline2<scalar_t, MaxPoints> &grad_l, Point2<scalar_t> &grad_p)
+{
+    grad_l.nvertices = l.nvertices;
+    if (l.nvertices < 2) // see _project_degenerate
+    {
+        if (l.nvertices == 1 && (p.x != l.vertices[0].x || p.y != l.vertices[0].y))
+            distance_grad(p, l.vertices[0], grad_offset, grad_p, grad_l.vertices[0]);
+        return;
+    }
+    const Point2<scalar_t> &a = l.vertices[idx], &b = l.vertices[idx+1];
+    Point2<scalar_t> &grad_a = grad_l.vertices[idx], &grad_b = grad_l.vertices[idx+1];
+    scalar_t dx = b.x - a.x, dy = b.y - a.y, wx = p.x - a.x, wy = p.y - a.y;
+    scalar_t seglen = hypot(dx, dy);
+    if (!(seglen > 0))
+    {
+        _lengths_grad(l, idx, grad_s, grad_l);
+        distance_grad(p, a, grad_offset, grad_p, grad_a);
+        return;
+    }
+
+    scalar_t t = (dx * wx + dy * wy) / seglen;
+    scalar_t cross = dx * wy - dy * wx;
+    bool extend_head = idx == 0, extend_tail = idx + 2 == l.nvertices;
+    if ((t < 0 && !extend_head) || (t > seglen && !extend_tail))
+    {
+        _lengths_grad(l, t < 0 ? idx : uint8_t(idx + 1), grad_s, grad_l);
+        distance_grad(p, t < 0 ? a : b, cross > 0 ? -grad_offset : grad_offset, grad_p, t < 0 ? grad_a : grad_b);
+        return;
+    }
+
+    // s = lengths[idx] + t
+    _lengths_grad(l, idx, grad_s, grad_l);
+    scalar_t ux = dx / seglen, uy = dy / seglen;
+    scalar_t gtx = (wx - t * ux) / seglen, gty = (wy - t * uy) / seglen; // dt/d(b)
+    grad_p.x += grad_s * ux;
+    grad_p.y += grad_s * uy;
+    grad_b.x += grad_s * gtx;
+    grad_b.y += grad_s * gty;
+    grad_a.x -= grad_s * (ux + gtx);
+    grad_a.y -= grad_s * (uy + gty);
+
+    // offset = -cross / seglen
+    scalar_t offset = -cross / seglen;
+    scalar_t gwx = dy / seglen, gwy = -dx / seglen; // d(offset)/d(p - a)
+    scalar_t gdx = -wy / seglen - offset * dx / (seglen * seglen); // d(offset)/d(b - a)
+    scalar_t gdy =  wx / seglen - offset * dy / (seglen * seglen);
+    grad_p.x += grad_offset * gwx;
+    grad_p.y += grad_offset * gwy;
+    grad_b.x += grad_offset * gdx;
+    grad_b.y += grad_offset * gdy;
+    grad_a.x -= grad_offset * (gwx + gdx);
+    grad_a.y -= grad_offset * (gwy + gdy);
+}
+
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> CUDA_CALLABLE_MEMBER inline
+void distance_grad(const Polyline2<scalar_t, MaxPoints1> &l, const Poly2<scalar_t, MaxPoints2> &poly, const scalar_t &grad,
+    const uint8_t &flag1, const uint8_t &flag2, Polyline2<scalar_t, MaxPoints1> &grad_l, Poly2<scalar_t, MaxPoints2> &grad_poly)
+{
+    grad_l.nvertices = l.nvertices;
+    grad_poly.nvertices = poly.nvertices;
+    if (flag1 == 0xFF) return; // intersected
+
+    uint8_t j = flag2 >> 1;
+    Segment2<scalar_t> s, grad_s;
+    if (flag2 & 1) // polygon vertex to polyline segment
+    {
+        s = segment2_from_pp(l.vertices[flag1], l.vertices[flag1 + 1]);
+        scalar_t d = distance(s, poly.vertices[j]);
+        distance_grad(s, poly.vertices[j], d > 0 ? grad : -grad, grad_s, grad_poly.vertices[j]);
+        segment2_from_pp_grad(l.vertices[flag1], l.vertices[flag1 + 1], grad_s,
+            grad_l.vertices[flag1], grad_l.vertices[flag1 + 1]);
+    }
+    else // polyline vertex to polygon edge
+    {
+        uint8_t jnext = _mod_inc(j, poly.nvertices);
+        s = segment2_from_pp(poly.vertices[j], poly.vertices[jnext]);
+        scalar_t d = distance(s, l.vertices[flag1]);
+        distance_grad(s, l.vertices[flag1], d > 0 ? grad : -grad, grad_s, grad_l.vertices[flag1]);
+        segment2_from_pp_grad(poly.vertices[j], poly.vertices[jnext], grad_s,
+            grad_poly.vertices[j], grad_poly.vertices[jnext]);
+    }
+}
+
+// gradient of the unsigned distance from a point to the edge idx of the polygon
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+void _edge_distance_grad(const Poly2<scalar_t, MaxPoints> &poly, const Point2<scalar_t> &p, const scalar_t &grad,
+    const uint8_t &idx, Poly2<scalar_t, MaxPoints> &grad_poly, Point2<scalar_t> &grad_p)
+{
+    uint8_t nidx = _mod_inc(idx, poly.nvertices);
+    const Point2<scalar_t> &a = poly.vertices[idx], &b = poly.vertices[nidx];
+    scalar_t cross = _cross(a, b, p);
+    if (cross != 0)
+    {
+        distance_grad(poly, p, cross > 0 ? grad : -grad, grad_poly, grad_p, idx); // the signed distance is positive inside
+        return;
+    }
+
+    // on the line of the edge the sign is undefined, the distance is either to an end point or zero
+    scalar_t t = (b.x - a.x)*(p.x - a.x) + (b.y - a.y)*(p.y - a.y);
+    if (t < 0)
+        distance_grad(p, a, grad, grad_p, grad_poly.vertices[idx]);
+    else if (t > (b.x - a.x)*(b.x - a.x) + (b.y - a.y)*(b.y - a.y))
+        distance_grad(p, b, grad, grad_p, grad_poly.vertices[nidx]);
+}
+
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> CUDA_CALLABLE_MEMBER inline
+void hausdorff_distance_grad(const Poly2<scalar_t, MaxPoints1> &p1, const Poly2<scalar_t, MaxPoints2> &p2,
+    const scalar_t &grad, const uint8_t &flag1, const uint8_t &flag2,
+    Poly2<scalar_t, MaxPoints1> &grad_p1, Poly2<scalar_t, MaxPoints2> &grad_p2)
+{
+    grad_p1.nvertices = p1.nvertices;
+    grad_p2.nvertices = p2.nvertices;
+    if (p1.nvertices == 0 || p2.nvertices == 0) return;
+
+    uint8_t i = flag1 >> 1;
+    if (flag1 & 1)
+        _edge_distance_grad(p2, p1.vertices[i], grad, flag2, grad_p2, grad_p1.vertices[i]);
+    else
+        _edge_distance_grad(p1, p2.vertices[i], grad, flag2, grad_p1, grad_p2.vertices[i]);
+}
+
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> CUDA_CALLABLE_MEMBER inline
+void chamfer_distance_grad(const Poly2<scalar_t, MaxPoints1> &p1, const Poly2<scalar_t, MaxPoints2> &p2,
+    const scalar_t &grad, const CUDA_RESTRICT uint8_t flags[MaxPoints1 + MaxPoints2],
+    Poly2<scalar_t, MaxPoints1> &grad_p1, Poly2<scalar_t, MaxPoints2> &grad_p2)
+{
+    grad_p1.nvertices = p1.nvertices;
+    grad_p2.nvertices = p2.nvertices;
+    if (p1.nvertices == 0 || p2.nvertices == 0) return;
+
+    scalar_t g1 = grad / p1.nvertices, g2 = grad / p2.nvertices;
+    for (uint8_t i = 0; i < p1.nvertices; i++)
+        _edge_distance_grad(p2, p1.vertices[i], g1, flags[i], grad_p2, grad_p1.vertices[i]);
+    for (uint8_t j = 0; j < p2.nvertices; j++)
+        _edge_distance_grad(p1, p2.vertices[j], g2, flags[p1.nvertices + j], grad_p1, grad_p2.vertices[j]);
+}
+
 template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
 void area_grad(const AABox2<scalar_t> &a, const scalar_t &grad, AABox2<scalar_t> &grad_a)
 {
@@ -301,6 +461,63 @@ void centroid_grad(const Poly2<scalar_t, MaxPoints> &p, const Point2<scalar_t> &
     }
 }
 
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+void moments_grad(const Poly2<scalar_t, MaxPoints> &p, const Moments2<scalar_t> &grad, Poly2<scalar_t, MaxPoints> &grad_p)
+{
+    if (p.nvertices == 0) return;
+    grad_p.nvertices = p.nvertices;
+
+    // forward pass for the sums, see moments()
+    const Point2<scalar_t> &o = p.vertices[0];
+    scalar_t a2 = 0, mx = 0, my = 0, sxx = 0, sxy = 0, syy = 0;
+    for (uint8_t i = 1; i + 1 < p.nvertices; i++)
+    {
+        scalar_t ax = p.vertices[i].x - o.x, ay = p.vertices[i].y - o.y;
+        scalar_t bx = p.vertices[i+1].x - o.x, by = p.vertices[i+1].y - o.y;
+        scalar_t c = ax*by - bx*ay;
+        a2 += c;
+        mx += (ax + bx) * c;
+        my += (ay + by) * c;
+        sxx += (ax*ax + ax*bx + bx*bx) * c;
+        syy += (ay*ay + ay*by + by*by) * c;
+        sxy += (ax*by + 2*ax*ay + 2*bx*by + bx*ay) * c;
+    }
+    if (a2 == 0)
+    {
+        area_grad(p, grad.area, grad_p);
+        centroid_grad(p, grad.centroid, grad_p);
+        return;
+    }
+
+    // gradients of the sums
+    scalar_t cx = mx / (3*a2), cy = my / (3*a2);
+    scalar_t gcx = grad.centroid.x - 2*grad.cxx*cx - grad.cxy*cy;
+    scalar_t gcy = grad.centroid.y - 2*grad.cyy*cy - grad.cxy*cx;
+    scalar_t gsxx = grad.cxx / (6*a2), gsyy = grad.cyy / (6*a2), gsxy = grad.cxy / (12*a2);
+    scalar_t gmx = gcx / (3*a2), gmy = gcy / (3*a2);
+    scalar_t ga2 = grad.area / 2 - (gsxx*sxx + gsyy*syy + gsxy*sxy + gmx*mx + gmy*my) / a2;
+
+    // the first vertex receives the centroid gradient and the opposite of the gradients of relative coordinates
+    Point2<scalar_t> &grad_o = grad_p.vertices[0];
+    grad_o += grad.centroid;
+    for (uint8_t i = 1; i + 1 < p.nvertices; i++)
+    {
+        scalar_t ax = p.vertices[i].x - o.x, ay = p.vertices[i].y - o.y;
+        scalar_t bx = p.vertices[i+1].x - o.x, by = p.vertices[i+1].y - o.y;
+        scalar_t c = ax*by - bx*ay;
+        scalar_t gc = ga2 + gmx*(ax + bx) + gmy*(ay + by) + gsxx*(ax*ax + ax*bx + bx*bx)
+                    + gsyy*(ay*ay + ay*by + by*by) + gsxy*(ax*by + 2*ax*ay + 2*bx*by + bx*ay);
+
+        scalar_t gax = (gmx + gsxx*(2*ax + bx) + gsxy*(by + 2*ay)) * c + gc*by;
+        scalar_t gay = (gmy + gsyy*(2*ay + by) + gsxy*(2*ax + bx)) * c - gc*bx;
+        scalar_t gbx = (gmx + gsxx*(ax + 2*bx) + gsxy*(2*by + ay)) * c - gc*ay;
+        scalar_t gby = (gmy + gsyy*(ay + 2*by) + gsxy*(ax + 2*bx)) * c + gc*ax;
+        grad_p.vertices[i].x += gax; grad_p.vertices[i].y += gay;
+        grad_p.vertices[i+1].x += gbx; grad_p.vertices[i+1].y += gby;
+        grad_o.x -= gax + gbx; grad_o.y -= gay + gby;
+    }
+}
+
 ///////////// gradient implementation of operators //////////////
 
 template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
@@ -0,0 +1,134 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+// This file is compiled once for each instruction set with DGAL_KERNEL_ISA set to the name of the instruction
+// set and dgal defined as dgal_<name>, so that each build has its own copy of the header-only library.
+// Code outside of the dgal namespace (most importantly the std templates) is shared between the builds, so
+// the kernels shouldn't instantiate std containers, and DGAL_EXTERNAL_PARALLEL_FOR is defined so that the
+// loops don't instantiate the thread pool. Check with nm that the weak symbols of the objects are all in dgal_<name>.
+
+#include <math.h>
+#include <cassert>
+#include "dgal/geometry.hpp"
+#include "dgal/geometry_batch.hpp"
+#include "dgal/box_coder.hpp"
+#include "dgal/geometry_kernels.hpp"
+
+#ifndef DGAL_KERNEL_ISA
+#define DGAL_KERNEL_ISA baseline
+#endif
+
+#define _DGAL_CONCAT(a, b) a##b
+#define _DGAL_KERNEL_TABLE(isa) _DGAL_CONCAT(kernels_, isa)
+
+namespace dgal_kernels {
+
+namespace {
+
+typedef double T;
+using Box = dgal::Quad2<T>;
+
+void iou_batch(const void *p1, const void *p2, size_t n, T *ious, uint8_t *nx, uint8_t *xflags, uint8_t *status)
+{
+    dgal::iou_batch(static_cast<const Box*>(p1), static_cast<const Box*>(p2), n, ious, nx, xflags, status);
+}
+
+void iou_batch_grad(const void *p1, const void *p2, size_t n, const T *grads,
+    const uint8_t *nx, const uint8_t *xflags, void *grad_p1, void *grad_p2, uint8_t *status)
+{
+    dgal::iou_batch_grad(static_cast<const Box*>(p1), static_cast<const Box*>(p2), n, grads, nx, xflags,
+        static_cast<Box*>(grad_p1), static_cast<Box*>(grad_p2), status);
+}
+
+void iou_batch_packed(const void *p1, const void *p2, size_t n, T *ious, uint32_t *state, uint8_t *status)
+{
+    dgal::iou_batch_packed(static_cast<const Box*>(p1), static_cast<const Box*>(p2), n, ious, state, status);
+}
+
+void iou_batch_grad_packed(const void *p1, const void *p2, size_t n, const T *grads,
+    const uint32_t *state, void *grad_p1, void *grad_p2, uint8_t *status)
+{
+    dgal::iou_batch_grad_packed(static_cast<const Box*>(p1), static_cast<const Box*>(p2), n, grads, state,
+        static_cast<Box*>(grad_p1), static_cast<Box*>(grad_p2), status);
+}
+
+void iou_pairs(const void *p1, const void *p2, const std::pair<uint32_t, uint32_t> *pairs, size_t n, T *ious)
+{
+    const Box *b1 = static_cast<const Box*>(p1), *b2 = static_cast<const Box*>(p2);
+    dgal::parallel_for(0, n, [&](size_t k) {
+        uint8_t nx; dgal::PairStatus status;
+        ious[k] = dgal::_iou_checked(b1[pairs[k].first], b2[pairs[k].second], nx, nullptr, status);
+    }, 256);
+}
+
+void decode_poly2_batch(const T *deltas, const T *anchors, size_t n, void *polys, int encoding)
+{
+    dgal::decode_poly2_batch(deltas, anchors, n, static_cast<Box*>(polys), dgal::BoxEncoding(encoding));
+}
+
+void decode_poly2_batch_grad(const T *deltas, const T *anchors, const void *grads, size_t n,
+    T *grad_deltas, int encoding)
+{
+    dgal::decode_poly2_batch_grad(deltas, anchors, static_cast<const Box*>(grads), n, grad_deltas,
+        dgal::BoxEncoding(encoding));
+}
+
+void decode_iou_batch(const T *deltas, const T *anchors, const void *targets, size_t n, T *ious, uint32_t *state,
+    int encoding, uint8_t *status)
+{
+    dgal::decode_iou_batch(deltas, anchors, static_cast<const Box*>(targets), n, ious, state,
+        dgal::BoxEncoding(encoding), status);
+}
+
+void decode_iou_batch_grad(const T *deltas, const T *anchors, const void *targets, size_t n, const T *grads,
+    const uint32_t *state, T *grad_deltas, int encoding, uint8_t *status)
+{
+    dgal::decode_iou_batch_grad(deltas, anchors, static_cast<const Box*>(targets), n, grads, state, grad_deltas,
+        dgal::BoxEncoding(encoding), status);
+}
+
+void canonicalize_batch(void *polys, size_t n, uint8_t *status, T tolerance)
+{
+    dgal::canonicalize_batch(static_cast<dgal::Poly2<T, 8>*>(polys), n, status, tolerance);
+}
+
+void set_parallel_for(ParallelFor fn)
+{
+    dgal::set_parallel_for(fn);
+}
+
+} // namespace
+
+extern const KernelTable _DGAL_KERNEL_TABLE(DGAL_KERNEL_ISA) = {
+    &iou_batch,
+    &iou_batch_grad,
+    &iou_batch_packed,
+    &iou_batch_grad_packed,
+    &iou_pairs,
+    &decode_poly2_batch,
+    &decode_poly2_batch_grad,
+    &decode_iou_batch,
+    &decode_iou_batch_grad,
+    &canonicalize_batch,
+    &set_parallel_for
+};
+
+} // namespace dgal_kernels
@@ -0,0 +1,77 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+// Hot kernels of the python binding, which are compiled once for each instruction set (see geometry_kernels.cpp
+// and CMakeLists.txt) and selected at runtime. Each build renames the dgal namespace to avoid mixing the inline
+// functions compiled with different flags, so the polygons are passed as pointers to Quad2<double> arrays.
+// The renaming doesn't cover the std templates, whose instantiations are merged by the linker across the builds,
+// so the kernels only take preallocated buffers and their loops run on the pool of the binding (set_parallel_for).
+
+#ifndef DGAL_GEOMETRY_KERNELS_HPP
+#define DGAL_GEOMETRY_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace dgal_kernels {
+
+// same as dgal::ParallelForFn
+typedef void (*ParallelFor)(size_t begin, size_t end, size_t grain,
+    void (*body)(void *ctx, size_t lo, size_t hi), void *ctx);
+
+struct KernelTable
+{
+    void (*iou_batch)(const void *p1, const void *p2, size_t n, double *ious, uint8_t *nx, uint8_t *xflags,
+        uint8_t *status);
+    void (*iou_batch_grad)(const void *p1, const void *p2, size_t n, const double *grads,
+        const uint8_t *nx, const uint8_t *xflags, void *grad_p1, void *grad_p2, uint8_t *status);
+    void (*iou_batch_packed)(const void *p1, const void *p2, size_t n, double *ious, uint32_t *state,
+        uint8_t *status);
+    void (*iou_batch_grad_packed)(const void *p1, const void *p2, size_t n, const double *grads,
+        const uint32_t *state, void *grad_p1, void *grad_p2, uint8_t *status);
+    void (*iou_pairs)(const void *p1, const void *p2, const std::pair<uint32_t, uint32_t> *pairs, size_t n,
+        double *ious); // iou of p1[pairs[k].first] and p2[pairs[k].second]
+    void (*decode_poly2_batch)(const double *deltas, const double *anchors, size_t n, void *polys, int encoding);
+    void (*decode_poly2_batch_grad)(const double *deltas, const double *anchors, const void *grads, size_t n,
+        double *grad_deltas, int encoding);
+    void (*decode_iou_batch)(const double *deltas, const double *anchors, const void *targets, size_t n,
+        double *ious, uint32_t *state, int encoding, uint8_t *status);
+    void (*decode_iou_batch_grad)(const double *deltas, const double *anchors, const void *targets, size_t n,
+        const double *grads, const uint32_t *state, double *grad_deltas, int encoding, uint8_t *status);
+    void (*canonicalize_batch)(void *polys, size_t n, uint8_t *status, double tolerance); // Poly2<double, 8> array
+    void (*set_parallel_for)(ParallelFor fn); // should be called before the other kernels
+};
+
+extern const KernelTable kernels_baseline;
+#ifdef DGAL_HAS_KERNELS_SSE42
+extern const KernelTable kernels_sse42;
+#endif
+#ifdef DGAL_HAS_KERNELS_AVX2
+extern const KernelTable kernels_avx2;
+#endif
+#ifdef DGAL_HAS_KERNELS_AVX512
+extern const KernelTable kernels_avx512;
+#endif
+
+} // namespace dgal_kernels
+
+#endif // DGAL_GEOMETRY_KERNELS_HPP
@@ -0,0 +1,273 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a cache of pairwise results (IoU, intersection area and xflags) that persists across frames,
+ * so that the pairs whose polygons don't change are not evaluated again.
+ *
+ * The entries are keyed by the ids and versions of both polygons. The caller bumps the version of a polygon when it
+ * changes, so the stale entries never match again, and they are replaced by the next insertion of the same id pair.
+ * The cache is set-associative with a fixed capacity. Within a set, the least recently used entry (at the
+ * granularity of frames, see next_frame()) is evicted. Each slot is guarded by a sequence lock, so lookups never
+ * block and never write the entry, and insertions from multiple threads only skip when racing on the same slot.
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_PAIR_CACHE_HPP
+#define DGAL_PAIR_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include "dgal/geometry.hpp"
+#include "dgal/geometry_batch.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+struct PairKey
+{
+    uint32_t id1 = 0, version1 = 0; // id and version of the first polygon
+    uint32_t id2 = 0, version2 = 0; // id and version of the second polygon
+};
+
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> struct PairResult
+{
+    scalar_t iou = 0, area = 0; // area is the area of the intersection
+    uint8_t nx = 0; // number of vertices of the intersection
+    PairStatus status = PairStatus::Ok;
+    uint8_t xflags[MaxPoints1 + MaxPoints2];
+};
+
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> class PairCache
+{
+public:
+    using Result = PairResult<scalar_t, MaxPoints1, MaxPoints2>;
+    static constexpr size_t ways = 8; // number of slots in a set
+
+    // the capacity is rounded up to a multiple of the number of ways
+    explicit PairCache(size_t capacity = 1 << 16)
+        : _nsets(std::max<size_t>((capacity + ways - 1) / ways, 1)), _sets(new _Set[_nsets]) {}
+
+    PairCache(const PairCache&) = delete;
+    PairCache& operator=(const PairCache&) = delete;
+
+    size_t capacity() const { return _nsets * ways; }
+    uint32_t frame() const { return _frame.load(std::memory_order_relaxed); }
+
+    // Advance the clock used for eviction, entries not used in the recent frames are evicted first
+    void next_frame() { _frame.fetch_add(1, std::memory_order_relaxed); }
+
+    // Find the result of the key, return false if it's not cached. Lookups are lock-free
+    bool lookup(const PairKey &key, Result &result) const
+    {
+        uint32_t tag;
+        _Set &set = _find_set(key, tag);
+        for (size_t w = 0; w < ways; w++)
+        {
+            if (set.tags[w].load(std::memory_order_relaxed) != tag)
+                continue;
+
+            const _Slot &slot = set.slots[w];
+            uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq & 1)
+                continue; // being written
+
+            uint64_t words[_nwords];
+            for (size_t k = 0; k < _nwords; k++)
+                words[k] = slot.data[k].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != seq)
+                continue; // overwritten while reading
+
+            _Entry entry;
+            std::memcpy(&entry, words, sizeof(_Entry));
+            if (!_same(entry.key, key))
+                continue; // another version, or a collision of the tags
+            result = entry.result;
+            set.last_used[w].store(frame(), std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    // Store the result of the key. It replaces the entry of the same id pair if there is one (e.g. of an older
+    // version), otherwise an empty slot or the least recently used one in the set
+    void insert(const PairKey &key, const Result &result)
+    {
+        uint32_t tag;
+        _Set &set = _find_set(key, tag);
+        const uint32_t now = frame();
+        size_t victim = ways, empty = ways, oldest = ways;
+        uint32_t oldest_age = 0;
+        for (size_t w = 0; w < ways && victim == ways; w++)
+        {
+            uint32_t t = set.tags[w].load(std::memory_order_relaxed);
+            uint32_t age = now - set.last_used[w].load(std::memory_order_relaxed);
+            if (t == 0)
+            {
+                if (empty == ways) empty = w;
+            }
+            else if (t == tag && _same_ids(set.slots[w], key))
+                victim = w;
+            else if (oldest == ways || age > oldest_age)
+            {
+                oldest = w;
+                oldest_age = age;
+            }
+        }
+        if (victim == ways)
+            victim = empty != ways ? empty : oldest;
+
+        // lock the slot by making the sequence odd, give up if another thread is writing it
+        _Slot &slot = set.slots[victim];
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+        if ((seq & 1) || !slot.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+            return;
+        std::atomic_thread_fence(std::memory_order_release);
+
+        _Entry entry;
+        entry.key = key;
+        entry.result = result;
+        uint64_t words[_nwords];
+        std::memset(words, 0, sizeof(words));
+        std::memcpy(words, &entry, sizeof(_Entry));
+        for (size_t k = 0; k < _nwords; k++)
+            slot.data[k].store(words[k], std::memory_order_relaxed);
+        set.tags[victim].store(tag, std::memory_order_relaxed);
+        set.last_used[victim].store(now, std::memory_order_relaxed);
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Remove all the entries, it must not run concurrently with other operations
+    void clear()
+    {
+        for (size_t s = 0; s < _nsets; s++)
+            for (size_t w = 0; w < ways; w++)
+                _sets[s].tags[w].store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct _Entry
+    {
+        PairKey key;
+        Result result;
+    };
+    static_assert(std::is_trivially_copyable<Result>::value, "cached results must be trivially copyable");
+    static constexpr size_t _nwords = (sizeof(_Entry) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    // the entry is stored as atomic words so that concurrent reads and writes are well defined
+    struct _Slot
+    {
+        std::atomic<uint32_t> seq {0}; // odd while being written
+        std::atomic<uint64_t> data[_nwords];
+    };
+
+    // the tags (hashes of the id pairs, 0 if empty) and the access times are packed together,
+    // so that a lookup only touches the slot that is likely to match
+    struct _Set
+    {
+        std::atomic<uint32_t> tags[ways];
+        mutable std::atomic<uint32_t> last_used[ways]; // frame of the last access
+        _Slot slots[ways];
+
+        _Set()
+        {
+            for (size_t w = 0; w < ways; w++)
+            {
+                tags[w].store(0, std::memory_order_relaxed);
+                last_used[w].store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    static bool _same(const PairKey &a, const PairKey &b)
+    {
+        return a.id1 == b.id1 && a.id2 == b.id2 && a.version1 == b.version1 && a.version2 == b.version2;
+    }
+
+    static bool _same_ids(const _Slot &slot, const PairKey &key)
+    {
+        uint64_t words[2] = {slot.data[0].load(std::memory_order_relaxed), slot.data[1].load(std::memory_order_relaxed)};
+        PairKey stored;
+        std::memcpy(&stored, words, sizeof(PairKey));
+        return stored.id1 == key.id1 && stored.id2 == key.id2;
+    }
+
+    // sets and tags only depend on the ids, so the entries of all versions of a pair land in the same set
+    _Set& _find_set(const PairKey &key, uint32_t &tag) const
+    {
+        uint64_t h = (uint64_t(key.id1) << 32) | key.id2;
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        tag = uint32_t(h >> 32) | 1;
+        return _sets[h % _nsets];
+    }
+
+    size_t _nsets;
+    std::unique_ptr<_Set[]> _sets;
+    std::atomic<uint32_t> _frame {0};
+};
+
+// Calculate IoU between p1[k] and p2[k] like iou_batch from geometry_batch.hpp, reusing the cached results of the
+// keys and caching the new ones. The intersection areas are stored if areas is not null, and nx / xflags / status
+// are in the same layout as iou_batch for iou_batch_grad. Return the number of pairs found in the cache
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+size_t iou_batch_cached(PairCache<scalar_t, MaxPoints1, MaxPoints2> &cache, const PairKey *keys,
+    const Poly2<scalar_t, MaxPoints1> *p1, const Poly2<scalar_t, MaxPoints2> *p2, size_t n,
+    scalar_t *ious, scalar_t *areas = nullptr, uint8_t *nx = nullptr, uint8_t *xflags = nullptr,
+    uint8_t *status = nullptr)
+{
+    constexpr size_t stride = MaxPoints1 + MaxPoints2;
+    std::atomic<size_t> nhits {0};
+    constexpr size_t grain = 256;
+    parallel_for(0, (n + grain - 1) / grain, [&](size_t c) {
+        // count the hits per chunk to avoid contention on the counter
+        size_t hits = 0;
+        for (size_t k = c * grain; k < std::min(n, c * grain + grain); k++)
+        {
+            PairResult<scalar_t, MaxPoints1, MaxPoints2> r;
+            if (cache.lookup(keys[k], r))
+                hits++;
+            else
+            {
+                r.iou = _iou_checked(p1[k], p2[k], r.nx, r.xflags, r.status, &r.area);
+                cache.insert(keys[k], r);
+            }
+
+            ious[k] = r.iou;
+            if (areas != nullptr) areas[k] = r.area;
+            if (nx != nullptr) nx[k] = r.nx;
+            if (status != nullptr) status[k] = uint8_t(r.status);
+            if (xflags != nullptr) std::copy(r.xflags, r.xflags + r.nx, xflags + k * stride);
+        }
+        nhits.fetch_add(hits, std::memory_order_relaxed);
+    }, 1);
+    return nhits.load();
+}
+
+} // namespace dgal
+
+#endif // DGAL_PAIR_CACHE_HPP
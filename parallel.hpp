@@ -0,0 +1,552 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a minimal thread pool used by the CPU batch kernels of the library.
+ * The number of workers defaults to the hardware concurrency and can be overridden
+ * by the environment variable DGAL_NUM_THREADS.
+ *
+ * AsyncExecutor submits jobs to the pool and returns Future handles, so that callers can overlap
+ * geometry jobs with other work. The number of unfinished jobs is bounded, and pending jobs can be
+ * cancelled (running jobs can check the CancelToken passed to them and stop early).
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_PARALLEL_HPP
+#define DGAL_PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dgal {
+
+class ThreadPool
+{
+public:
+    // nthreads includes the calling thread, which also does work in parallel_for
+    explicit ThreadPool(size_t nthreads = 0)
+    {
+        if (nthreads == 0)
+            nthreads = default_concurrency();
+        for (size_t i = 1; i < nthreads; i++)
+            _workers.emplace_back([this]{ _worker_loop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopped = true;
+        }
+        _cv.notify_all();
+        for (auto &w : _workers)
+            w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return _workers.size() + 1; }
+
+    void enqueue(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.push_back(std::move(task));
+        }
+        _cv.notify_one();
+    }
+
+    // Call f(i) for i in [begin, end), work is distributed in chunks of grain size.
+    // The calling thread participates, so it's safe to call this from inside a task.
+    template <typename Func>
+    void parallel_for(size_t begin, size_t end, const Func &f, size_t grain = 1)
+    {
+        if (end <= begin) return;
+        grain = std::max<size_t>(grain, 1);
+        size_t nchunks = (end - begin + grain - 1) / grain;
+        if (nchunks == 1 || _workers.empty())
+        {
+            for (size_t i = begin; i < end; i++)
+                f(i);
+            return;
+        }
+
+        struct State
+        {
+            std::atomic<size_t> next{0}, done{0};
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+
+        // tasks started after all chunks are claimed return without touching f,
+        // so capturing f by reference is safe once all chunks are done
+        auto run = [state, &f, begin, end, grain, nchunks]
+        {
+            size_t c;
+            while ((c = state->next.fetch_add(1)) < nchunks)
+            {
+                size_t lo = begin + c * grain, hi = std::min(lo + grain, end);
+                try
+                {
+                    for (size_t i = lo; i < hi; i++)
+                        f(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->error) state->error = std::current_exception();
+                }
+                if (state->done.fetch_add(1) + 1 == nchunks)
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->cv.notify_all();
+                }
+            }
+        };
+
+        size_t ntasks = std::min(nchunks, size()) - 1;
+        for (size_t i = 0; i < ntasks; i++)
+            enqueue(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cv.wait(lock, [&]{ return state->done.load() == nchunks; });
+        if (state->error)
+            std::rethrow_exception(state->error);
+    }
+
+    // the pool shared by the library
+    static ThreadPool& global()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    static size_t default_concurrency()
+    {
+        const char* env = std::getenv("DGAL_NUM_THREADS");
+        if (env != nullptr && std::atoi(env) > 0)
+            return std::atoi(env);
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+private:
+    void _worker_loop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]{ return _stopped || !_tasks.empty(); });
+                if (_stopped && _tasks.empty()) return;
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stopped = false;
+};
+
+// Parallel loop calling body(ctx, lo, hi) on the chunks [lo, hi) of [begin, end), as a plain function pointer.
+// Code compiled separately with different flags (e.g. the ISA kernels of the python binding) is built with
+// DGAL_EXTERNAL_PARALLEL_FOR, so that its loops run on the pool of the host through such a pointer instead
+// of starting another pool and instantiating the std templates of the pool once more
+typedef void (*ParallelForFn)(size_t begin, size_t end, size_t grain,
+    void (*body)(void *ctx, size_t lo, size_t hi), void *ctx);
+
+// ParallelForFn running on the global pool
+inline void pool_parallel_for(size_t begin, size_t end, size_t grain,
+    void (*body)(void *ctx, size_t lo, size_t hi), void *ctx)
+{
+    if (end <= begin) return;
+    grain = std::max<size_t>(grain, 1);
+    ThreadPool::global().parallel_for(0, (end - begin + grain - 1) / grain, [=](size_t c) {
+        size_t lo = begin + c * grain;
+        body(ctx, lo, std::min(lo + grain, end));
+    });
+}
+
+#ifdef DGAL_EXTERNAL_PARALLEL_FOR
+// the loop of the host, set_parallel_for() should be called before any loop runs
+inline ParallelForFn& _external_parallel_for()
+{
+    static ParallelForFn fn = nullptr;
+    return fn;
+}
+
+inline void set_parallel_for(ParallelForFn fn) { _external_parallel_for() = fn; }
+
+template <typename Func> inline
+void parallel_for(size_t begin, size_t end, const Func &f, size_t grain = 1)
+{
+    auto body = [](void *ctx, size_t lo, size_t hi) {
+        const Func &f = *static_cast<const Func*>(ctx);
+        for (size_t i = lo; i < hi; i++)
+            f(i);
+    };
+    _external_parallel_for()(begin, end, grain, body, const_cast<Func*>(&f));
+}
+#else
+template <typename Func> inline
+void parallel_for(size_t begin, size_t end, const Func &f, size_t grain = 1)
+{
+    ThreadPool::global().parallel_for(begin, end, f, grain);
+}
+#endif
+
+class TaskCancelled : public std::runtime_error
+{
+public:
+    TaskCancelled() : std::runtime_error("the task is cancelled") {}
+};
+
+// Shared flag for requesting a job to stop
+class CancelToken
+{
+public:
+    CancelToken() : _flag(std::make_shared<std::atomic<bool>>(false)) {}
+    bool cancelled() const { return _flag->load(); }
+    void cancel() const { _flag->store(true); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> _flag;
+};
+
+enum class TaskStatus : int
+{
+    Pending = 0,
+    Running = 1,
+    Done = 2, // finished with a value or an exception
+    Cancelled = 3
+};
+
+class _TaskStateBase
+{
+public:
+    bool try_start()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (status != TaskStatus::Pending) return false;
+        status = TaskStatus::Running;
+        return true;
+    }
+
+    void finish(std::exception_ptr e = nullptr)
+    {
+        std::vector<std::function<void()>> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            status = TaskStatus::Done;
+            error = e;
+            pending.swap(callbacks);
+        }
+        _complete(pending);
+    }
+
+    bool cancel()
+    {
+        token.cancel();
+        std::vector<std::function<void()>> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (status != TaskStatus::Pending) return false;
+            status = TaskStatus::Cancelled;
+            pending.swap(callbacks);
+        }
+        _complete(pending);
+        return true;
+    }
+
+    bool ready()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return completed;
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]{ return completed; });
+    }
+
+    template <typename Duration>
+    bool wait_for(const Duration &timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, timeout, [this]{ return completed; });
+    }
+
+    // the callback is called immediately if the task is already finished
+    void add_callback(std::function<void()> cb)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (status < TaskStatus::Done)
+            {
+                callbacks.push_back(std::move(cb));
+                return;
+            }
+        }
+        cb();
+    }
+
+    void check()
+    {
+        wait();
+        if (status == TaskStatus::Cancelled) throw TaskCancelled();
+        if (error) std::rethrow_exception(error);
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    TaskStatus status = TaskStatus::Pending;
+    bool completed = false; // set before the callbacks are called, so that they can call get() on the task
+    std::exception_ptr error;
+    std::vector<std::function<void()>> callbacks;
+    CancelToken token;
+
+private:
+    void _complete(std::vector<std::function<void()>> &pending)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completed = true;
+        }
+        cv.notify_all();
+        for (auto &cb : pending) cb();
+    }
+};
+
+template <typename R> struct _TaskState : _TaskStateBase
+{
+    std::unique_ptr<R> value;
+
+    template <typename Func> void run(Func &f)
+    {
+        try { value.reset(new R(f())); }
+        catch (...) { finish(std::current_exception()); return; }
+        finish();
+    }
+};
+
+template <> struct _TaskState<void> : _TaskStateBase
+{
+    template <typename Func> void run(Func &f)
+    {
+        try { f(); }
+        catch (...) { finish(std::current_exception()); return; }
+        finish();
+    }
+};
+
+template <typename R> class _FutureBase
+{
+public:
+    bool valid() const { return _state != nullptr; }
+    TaskStatus status() const
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        return _state->status;
+    }
+    bool ready() const { return _state->ready(); }
+    bool cancelled() const { return status() == TaskStatus::Cancelled; }
+
+    void wait() const { _state->wait(); }
+    template <typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> &timeout) const { return _state->wait_for(timeout); }
+
+    // Cancel the task if it hasn't started and return true. Otherwise the token is
+    // set so that a running task can stop early, and false is returned.
+    bool cancel() const { return _state->cancel(); }
+    const CancelToken& token() const { return _state->token; }
+
+    // call cb on the thread finishing (or cancelling) the task
+    void on_complete(std::function<void()> cb) const { _state->add_callback(std::move(cb)); }
+
+protected:
+    std::shared_ptr<_TaskState<R>> _state;
+};
+
+// Handle of an asynchronous task, copies share the same task
+template <typename R> class Future : public _FutureBase<R>
+{
+public:
+    Future() = default;
+    explicit Future(std::shared_ptr<_TaskState<R>> state) { this->_state = std::move(state); }
+
+    // wait for the result, throw TaskCancelled if the task is cancelled or rethrow its exception
+    const R& get() const
+    {
+        this->_state->check();
+        return *this->_state->value;
+    }
+};
+
+template <> class Future<void> : public _FutureBase<void>
+{
+public:
+    Future() = default;
+    explicit Future(std::shared_ptr<_TaskState<void>> state) { this->_state = std::move(state); }
+
+    void get() const { this->_state->check(); }
+};
+
+// Call f with the cancel token if it accepts one
+template <typename Func> inline
+auto _call_with_token(Func &f, const CancelToken &token, int) -> decltype(f(token)) { return f(token); }
+template <typename Func> inline
+auto _call_with_token(Func &f, const CancelToken &, long) -> decltype(f()) { return f(); }
+
+template <typename Func>
+using _async_result_t = typename std::decay<decltype(
+    _call_with_token(std::declval<Func&>(), std::declval<const CancelToken&>(), 0))>::type;
+
+// Submit jobs to a thread pool with bounded number of unfinished jobs.
+// Note that blocking submit() should not be called from inside a job, use try_submit() instead.
+class AsyncExecutor
+{
+public:
+    // max_pending = 0 means twice the size of the pool
+    explicit AsyncExecutor(ThreadPool &pool = ThreadPool::global(), size_t max_pending = 0)
+        : _pool(pool), _max_pending(max_pending == 0 ? 2 * pool.size() : max_pending) {}
+
+    ~AsyncExecutor() { wait_all(); }
+
+    AsyncExecutor(const AsyncExecutor&) = delete;
+    AsyncExecutor& operator=(const AsyncExecutor&) = delete;
+
+    size_t max_pending() const { return _max_pending; }
+    void set_max_pending(size_t n)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _max_pending = std::max<size_t>(n, 1);
+        }
+        _cv.notify_all();
+    }
+
+    // number of unfinished jobs
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _pending;
+    }
+
+    // Submit f() or f(const CancelToken&), block while the queue is full
+    template <typename Func>
+    Future<_async_result_t<Func>> submit(Func f)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]{ return _pending < _max_pending; });
+            _pending++;
+        }
+        return _launch(std::move(f));
+    }
+
+    // Submit the job only if the queue is not full, return an invalid future otherwise
+    template <typename Func>
+    Future<_async_result_t<Func>> try_submit(Func f)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_pending >= _max_pending) return Future<_async_result_t<Func>>();
+            _pending++;
+        }
+        return _launch(std::move(f));
+    }
+
+    void wait_all()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this]{ return _pending == 0; });
+    }
+
+    // the executor on the global pool
+    static AsyncExecutor& global()
+    {
+        static AsyncExecutor executor;
+        return executor;
+    }
+
+private:
+    template <typename Func>
+    Future<_async_result_t<Func>> _launch(Func f)
+    {
+        using R = _async_result_t<Func>;
+        auto state = std::make_shared<_TaskState<R>>();
+        state->add_callback([this]{
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _pending--;
+            }
+            _cv.notify_all();
+        });
+
+        auto fp = std::make_shared<Func>(std::move(f));
+        auto job = [state, fp]{
+            if (!state->try_start()) return; // cancelled
+            const CancelToken &token = state->token;
+            auto call = [&]() -> R { return _call_with_token(*fp, token, 0); };
+            state->run(call);
+        };
+
+        // a pool without workers can't run jobs in background
+        if (_pool.size() == 1)
+            job();
+        else
+            _pool.enqueue(job);
+        return Future<R>(state);
+    }
+
+    ThreadPool &_pool;
+    size_t _max_pending;
+    size_t _pending = 0;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+};
+
+} // namespace dgal
+
+#endif // DGAL_PARALLEL_HPP
@@ -0,0 +1,178 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a sampler for placing objects into a scene without collision, which is used by
+ * copy-paste (ground truth sampling) augmentation.
+ *
+ * Each object comes with a sequence of candidate poses: the first one is the original pose and the others
+ * are random shifts and rotations of it. The candidates are tested against the scene in parallel with a
+ * SpatialHash broad-phase and the SAT predicate `intersects`, then objects are committed in input order so
+ * that they don't collide with each other. The random numbers are derived from (seed, round, object, trial)
+ * by hashing, so the result doesn't depend on the number of threads.
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_PLACEMENT_HPP
+#define DGAL_PLACEMENT_HPP
+
+#include <vector>
+#include "dgal/geometry.hpp"
+#include "dgal/broadphase.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+// SplitMix64 hash (ref "Fast splittable pseudorandom number generators")
+inline uint64_t _splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// Convert a random integer to a uniform number in [-1, 1)
+template <typename scalar_t> inline scalar_t _uniform_signed(uint64_t bits)
+{
+    return scalar_t((bits >> 11) * (1.0 / 9007199254740992.0)) * 2 - 1;
+}
+
+template <typename scalar_t> class PlacementSampler
+{
+public:
+    // cell_size is used for the broad-phase grid and should be around the typical object size
+    explicit PlacementSampler(scalar_t cell_size = 4, uint64_t seed = 0)
+        : _grid(cell_size), _seed(seed) {}
+
+    void clear()
+    {
+        _grid.clear();
+        _boxes.clear();
+    }
+
+    // add existing objects of the scene, they are only used as obstacles
+    void add(const Quad2<scalar_t> &box)
+    {
+        _grid.insert(aabox2_from_poly2(box));
+        _boxes.push_back(box);
+    }
+    void add(const Quad2<scalar_t> *boxes, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+            add(boxes[i]);
+    }
+
+    size_t size() const { return _boxes.size(); }
+    const std::vector<Quad2<scalar_t>>& boxes() const { return _boxes; }
+
+    // check whether the box collides with any object in the scene
+    bool collides(const Quad2<scalar_t> &box) const
+    {
+        return _collides(_grid, _boxes, box);
+    }
+
+    // Generate the trial-th candidate pose of an object. Trial 0 is the original pose, the others are shifted
+    // uniformly within [-max_shift, max_shift] in x and y and rotated within [-max_rotation, max_rotation]
+    Quad2<scalar_t> candidate(const Quad2<scalar_t> &box, size_t object, uint32_t trial,
+        scalar_t max_shift, scalar_t max_rotation) const
+    {
+        if (trial == 0)
+            return box;
+
+        uint64_t state = _splitmix64(_splitmix64(_splitmix64(_splitmix64(_seed) ^ _round) ^ object) ^ trial);
+        uint64_t r1 = _splitmix64(state), r2 = _splitmix64(r1), r3 = _splitmix64(r2);
+        scalar_t dx = max_shift * _uniform_signed<scalar_t>(r1);
+        scalar_t dy = max_shift * _uniform_signed<scalar_t>(r2);
+        scalar_t dr = max_rotation * _uniform_signed<scalar_t>(r3);
+
+        Point2<scalar_t> c = centroid(box);
+        scalar_t cr = cos(dr), sr = sin(dr);
+        Quad2<scalar_t> result;
+        result.nvertices = box.nvertices;
+        for (uint8_t i = 0; i < box.nvertices; i++)
+        {
+            scalar_t px = box.vertices[i].x - c.x, py = box.vertices[i].y - c.y;
+            result.vertices[i].x = c.x + dx + px * cr - py * sr;
+            result.vertices[i].y = c.y + dy + px * sr + py * cr;
+        }
+        return result;
+    }
+
+    // Place n objects into the scene, trying at most ntrials candidates for each of them. The accepted
+    // pose is stored in placed[i] and success[i] is set to 1 if a collision-free pose is found. Placed
+    // objects are added to the scene. Return the number of objects placed.
+    size_t place(const Quad2<scalar_t> *objects, size_t n, uint32_t ntrials,
+        scalar_t max_shift, scalar_t max_rotation, Quad2<scalar_t> *placed, uint8_t *success)
+    {
+        // test all candidates against the existing scene in parallel
+        std::vector<uint8_t> valid(n * ntrials);
+        parallel_for(0, n, [&](size_t i) {
+            for (uint32_t k = 0; k < ntrials; k++)
+                valid[i * ntrials + k] = !collides(candidate(objects[i], i, k, max_shift, max_rotation));
+        }, 16);
+
+        // commit in order, so that the result is deterministic
+        SpatialHash<scalar_t> pasted_grid(_grid.cell_size());
+        std::vector<Quad2<scalar_t>> pasted;
+        size_t count = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            success[i] = 0;
+            for (uint32_t k = 0; k < ntrials; k++)
+            {
+                if (!valid[i * ntrials + k]) continue;
+                Quad2<scalar_t> box = candidate(objects[i], i, k, max_shift, max_rotation);
+                if (_collides(pasted_grid, pasted, box)) continue;
+
+                pasted_grid.insert(aabox2_from_poly2(box));
+                pasted.push_back(box);
+                placed[i] = box;
+                success[i] = 1;
+                count++;
+                break;
+            }
+        }
+
+        add(pasted.data(), pasted.size());
+        _round++;
+        return count;
+    }
+
+private:
+    static bool _collides(const SpatialHash<scalar_t> &grid, const std::vector<Quad2<scalar_t>> &boxes,
+        const Quad2<scalar_t> &box)
+    {
+        return grid.visit(aabox2_from_poly2(box), [&](uint32_t id) {
+            return intersects(boxes[id], box);
+        });
+    }
+
+    SpatialHash<scalar_t> _grid;
+    std::vector<Quad2<scalar_t>> _boxes;
+    uint64_t _seed;
+    uint64_t _round = 0;
+};
+
+} // namespace dgal
+
+#endif // DGAL_PLACEMENT_HPP
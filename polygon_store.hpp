@@ -0,0 +1,378 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a read-only polygon store that is built once and memory mapped by many processes, so that
+ * workers on the same host share one copy of a static map (e.g. HD-map lanes and areas) through the page cache
+ * instead of each loading and preparing it in private memory. Put the file under /dev/shm to keep it in RAM.
+ *
+ * The polygons are stored in SoA layout (CSR offsets, x and y arrays) along with their bounding boxes and the
+ * lines of their edges, which are prepared when writing so that point queries only cost a dot product per edge.
+ * The batch functions of ragged.hpp (area_batch, iou_pairs, iou_sparse) accept the store directly.
+ *
+ * File layout (all sections are 64-byte aligned):
+ *      PolygonStoreHeader | offsets | xs | ys | boxes | lines | ids
+ *
+ * Note that the functions in this file are only available in CPU and on POSIX systems. The files are not
+ * portable between machines with different endianness.
+ */
+
+#ifndef DGAL_POLYGON_STORE_HPP
+#define DGAL_POLYGON_STORE_HPP
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "dgal/geometry.hpp"
+#include "dgal/broadphase.hpp"
+#include "dgal/parallel.hpp"
+#include "dgal/ragged.hpp"
+#include "dgal/rtree.hpp"
+
+namespace dgal {
+
+struct PolygonStoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t scalar_size; // used for validating the scalar type
+    uint64_t npolys, nvertices;
+    uint64_t offsets_offset, xs_offset, ys_offset, boxes_offset, lines_offset, ids_offset, file_size;
+};
+
+constexpr char _polygon_store_magic[8] = {'D', 'G', 'A', 'L', 'P', 'S', 'T', 'O'};
+constexpr uint32_t _polygon_store_version = 1;
+
+// Write the polygons into a store file. ids are stored along with the polygons (the input index is used if ids
+// is null). The file is written under a temporary name and renamed, so processes never map a partial store.
+// Return false if writing failed
+template <typename scalar_t> inline
+bool write_polygon_store(const std::string &path, const RaggedPoly2<scalar_t> &polys, const uint64_t *ids = nullptr)
+{
+    size_t n = polys.size(), nv = polys.vertices.size();
+    if (nv > std::numeric_limits<uint32_t>::max()) return false;
+
+    PolygonStoreHeader header;
+    std::memcpy(header.magic, _polygon_store_magic, sizeof(header.magic));
+    header.version = _polygon_store_version;
+    header.scalar_size = sizeof(scalar_t);
+    header.npolys = n;
+    header.nvertices = nv;
+    header.offsets_offset = _align64(sizeof(PolygonStoreHeader));
+    header.xs_offset = _align64(header.offsets_offset + (n + 1) * sizeof(uint32_t));
+    header.ys_offset = _align64(header.xs_offset + nv * sizeof(scalar_t));
+    header.boxes_offset = _align64(header.ys_offset + nv * sizeof(scalar_t));
+    header.lines_offset = _align64(header.boxes_offset + n * sizeof(AABox2<scalar_t>));
+    header.ids_offset = _align64(header.lines_offset + nv * sizeof(Line2<scalar_t>));
+    header.file_size = header.ids_offset + n * sizeof(uint64_t);
+
+    std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+    std::ofstream fout(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!fout) return false;
+    const auto pad_to = [&](uint64_t offset) {
+        static const char zeros[64] = {0};
+        fout.write(zeros, offset - (uint64_t)fout.tellp());
+    };
+    const auto write = [&](const auto &value) {
+        fout.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    write(header);
+    pad_to(header.offsets_offset);
+    fout.write(reinterpret_cast<const char*>(polys.offsets.data()), (n + 1) * sizeof(uint32_t));
+    pad_to(header.xs_offset);
+    for (const Point2<scalar_t> &p : polys.vertices)
+        write(p.x);
+    pad_to(header.ys_offset);
+    for (const Point2<scalar_t> &p : polys.vertices)
+        write(p.y);
+    pad_to(header.boxes_offset);
+    for (const AABox2<scalar_t> &b : _ragged_aabox2(polys))
+        write(b);
+    pad_to(header.lines_offset);
+    for (size_t i = 0; i < n; i++)
+    {
+        const Point2<scalar_t> *v = polys.data(i);
+        uint32_t nvertices = polys.nvertices(i);
+        for (uint32_t k = 0; k < nvertices; k++)
+            write(line2_from_pp(v[k], v[k + 1 == nvertices ? 0 : k + 1]));
+    }
+    pad_to(header.ids_offset);
+    for (size_t i = 0; i < n; i++)
+        write(ids == nullptr ? (uint64_t)i : ids[i]);
+
+    fout.close();
+    if (!fout.good() || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+template <typename scalar_t, uint8_t MaxPoints> inline
+bool write_polygon_store(const std::string &path, const Poly2<scalar_t, MaxPoints> *polys, size_t n,
+    const uint64_t *ids = nullptr)
+{
+    RaggedPoly2<scalar_t> ragged;
+    ragged.reserve(n, n * MaxPoints);
+    for (size_t i = 0; i < n; i++)
+        ragged.push_back(polys[i]);
+    return write_polygon_store(path, ragged, ids);
+}
+
+// Read-only view of a store file written by write_polygon_store. The view provides the same nvertices(i) and
+// get<N>(i) accessors as RaggedPoly2
+template <typename scalar_t> class MappedPolygonStore
+{
+public:
+    MappedPolygonStore() = default;
+    explicit MappedPolygonStore(const std::string &path) { open(path); }
+    ~MappedPolygonStore() { close(); }
+
+    MappedPolygonStore(const MappedPolygonStore&) = delete;
+    MappedPolygonStore& operator=(const MappedPolygonStore&) = delete;
+
+    // map the file, return false if the file can't be opened, doesn't match the scalar type or is malformed
+    bool open(const std::string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PolygonStoreHeader))
+        {
+            ::close(fd);
+            return false;
+        }
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+
+        _data = static_cast<const char*>(data);
+        _size = st.st_size;
+        const PolygonStoreHeader *h = header();
+        if (std::memcmp(h->magic, _polygon_store_magic, sizeof(h->magic)) != 0
+            || h->version != _polygon_store_version || h->scalar_size != sizeof(scalar_t)
+            || h->file_size > _size || !_check_sections(*h))
+        {
+            close();
+            return false;
+        }
+        _offsets = reinterpret_cast<const uint32_t*>(_data + h->offsets_offset);
+        _xs = reinterpret_cast<const scalar_t*>(_data + h->xs_offset);
+        _ys = reinterpret_cast<const scalar_t*>(_data + h->ys_offset);
+        _boxes = reinterpret_cast<const AABox2<scalar_t>*>(_data + h->boxes_offset);
+        _lines = reinterpret_cast<const Line2<scalar_t>*>(_data + h->lines_offset);
+        _ids = reinterpret_cast<const uint64_t*>(_data + h->ids_offset);
+        if (!_check_offsets(*h))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (_data != nullptr)
+            munmap(const_cast<char*>(_data), _size);
+        _data = nullptr;
+        _size = 0;
+    }
+
+    bool is_open() const { return _data != nullptr; }
+    const PolygonStoreHeader* header() const { return reinterpret_cast<const PolygonStoreHeader*>(_data); }
+    size_t size() const { return _data == nullptr ? 0 : header()->npolys; }
+
+    // the vertices of polygon i are [offsets()[i], offsets()[i+1]) in xs() and ys(),
+    // and lines()[k] is the edge from vertex k to the next vertex of the same polygon
+    const uint32_t* offsets() const { return _offsets; }
+    const scalar_t* xs() const { return _xs; }
+    const scalar_t* ys() const { return _ys; }
+    const AABox2<scalar_t>* boxes() const { return _boxes; }
+    const Line2<scalar_t>* lines() const { return _lines; }
+
+    uint32_t nvertices(size_t i) const { return _offsets[i+1] - _offsets[i]; }
+    const AABox2<scalar_t>& box(size_t i) const { return _boxes[i]; }
+    uint64_t id(size_t i) const { return _ids[i]; }
+
+    // copy polygon i into a fixed-size polygon
+    template <uint8_t MaxPoints>
+    Poly2<scalar_t, MaxPoints> get(size_t i) const
+    {
+        assert(nvertices(i) <= MaxPoints);
+        Poly2<scalar_t, MaxPoints> p;
+        p.nvertices = nvertices(i);
+        for (uint8_t k = 0; k < p.nvertices; k++)
+            p.vertices[k] = {.x = _xs[_offsets[i] + k], .y = _ys[_offsets[i] + k]};
+        return p;
+    }
+
+    // same as Poly2::contains, using the prepared edge lines
+    bool contains(size_t i, const Point2<scalar_t> &p) const
+    {
+        const AABox2<scalar_t> &b = _boxes[i];
+        if (p.x < b.min_x || p.x > b.max_x || p.y < b.min_y || p.y > b.max_y)
+            return false;
+        for (uint32_t k = _offsets[i]; k < _offsets[i+1]; k++)
+            if (_lines[k].a*p.x + _lines[k].b*p.y + _lines[k].c > 0)
+                return false;
+        return true;
+    }
+
+private:
+    // whether count elements of type T starting at offset are aligned and within the file
+    template <typename T>
+    static bool _section_fits(uint64_t offset, uint64_t count, uint64_t file_size)
+    {
+        return offset % alignof(T) == 0 && offset <= file_size && count <= (file_size - offset) / sizeof(T);
+    }
+
+    static bool _check_sections(const PolygonStoreHeader &h)
+    {
+        if (h.npolys >= h.file_size || h.nvertices > std::numeric_limits<uint32_t>::max())
+            return false;
+        return _section_fits<uint32_t>(h.offsets_offset, h.npolys + 1, h.file_size)
+            && _section_fits<scalar_t>(h.xs_offset, h.nvertices, h.file_size)
+            && _section_fits<scalar_t>(h.ys_offset, h.nvertices, h.file_size)
+            && _section_fits<AABox2<scalar_t>>(h.boxes_offset, h.npolys, h.file_size)
+            && _section_fits<Line2<scalar_t>>(h.lines_offset, h.nvertices, h.file_size)
+            && _section_fits<uint64_t>(h.ids_offset, h.npolys, h.file_size);
+    }
+
+    // the CSR offsets should start from zero, increase by at most RaggedMaxPoints and end at nvertices
+    bool _check_offsets(const PolygonStoreHeader &h) const
+    {
+        if (_offsets[0] != 0 || _offsets[h.npolys] != h.nvertices)
+            return false;
+        for (size_t i = 0; i < h.npolys; i++)
+            if (_offsets[i+1] < _offsets[i] || _offsets[i+1] - _offsets[i] > RaggedMaxPoints)
+                return false;
+        return true;
+    }
+
+    const char *_data = nullptr;
+    size_t _size = 0;
+    const uint32_t *_offsets = nullptr;
+    const scalar_t *_xs = nullptr, *_ys = nullptr;
+    const AABox2<scalar_t> *_boxes = nullptr;
+    const Line2<scalar_t> *_lines = nullptr;
+    const uint64_t *_ids = nullptr;
+};
+
+template <typename scalar_t> inline
+void area_batch(const MappedPolygonStore<scalar_t> &polys, scalar_t *areas)
+{
+    const uint32_t *offsets = polys.offsets();
+    const scalar_t *xs = polys.xs(), *ys = polys.ys();
+    parallel_for(0, polys.size(), [&](size_t i) {
+        if (offsets[i+1] - offsets[i] < 3)
+        {
+            areas[i] = 0;
+            return;
+        }
+        uint32_t first = offsets[i], last = offsets[i+1] - 1;
+        scalar_t sum = xs[last]*ys[first] - ys[last]*xs[first];
+        for (uint32_t k = first + 1; k <= last; k++)
+            sum += xs[k-1]*ys[k] - xs[k]*ys[k-1];
+        areas[i] = sum / 2;
+    }, 1024);
+}
+
+template <typename scalar_t> inline
+void iou_pairs(const MappedPolygonStore<scalar_t> &p1, const MappedPolygonStore<scalar_t> &p2,
+    const IndexPair *pairs, size_t n, scalar_t *ious, uint8_t *status = nullptr)
+{
+    _ragged_iou_pairs(p1, p2, pairs, n, ious, status);
+}
+
+// Query polygons from a ragged batch against a store, pairs[k].first indexes into p1
+template <typename scalar_t> inline
+void iou_pairs(const RaggedPoly2<scalar_t> &p1, const MappedPolygonStore<scalar_t> &p2,
+    const IndexPair *pairs, size_t n, scalar_t *ious, uint8_t *status = nullptr)
+{
+    _ragged_iou_pairs(p1, p2, pairs, n, ious, status);
+}
+
+template <typename scalar_t> inline
+void iou_sparse(const MappedPolygonStore<scalar_t> &p1, const MappedPolygonStore<scalar_t> &p2,
+    std::vector<SparseEntry<scalar_t>> &result, const scalar_t &min_iou = 0)
+{
+    std::vector<IndexPair> candidates;
+    find_overlaps(p1.boxes(), p1.size(), p2.boxes(), p2.size(), candidates);
+    _ragged_iou_candidates(p1, p2, candidates, result, min_iou);
+}
+
+template <typename scalar_t> inline
+void iou_sparse(const MappedPolygonStore<scalar_t> &p, std::vector<SparseEntry<scalar_t>> &result,
+    const scalar_t &min_iou = 0)
+{
+    std::vector<IndexPair> candidates;
+    find_overlaps(p.boxes(), p.size(), candidates);
+    _ragged_iou_candidates(p, p, candidates, result, min_iou);
+}
+
+template <typename scalar_t> inline
+void iou_sparse(const RaggedPoly2<scalar_t> &p1, const MappedPolygonStore<scalar_t> &p2,
+    std::vector<SparseEntry<scalar_t>> &result, const scalar_t &min_iou = 0)
+{
+    std::vector<AABox2<scalar_t>> boxes1 = _ragged_aabox2(p1);
+    std::vector<IndexPair> candidates;
+    find_overlaps(boxes1.data(), boxes1.size(), p2.boxes(), p2.size(), candidates);
+    _ragged_iou_candidates(p1, p2, candidates, result, min_iou);
+}
+
+// Find the polygons containing each point, result contains sorted (point index, polygon index) pairs.
+// Points on the boundaries of the bounding boxes are not reported
+template <typename scalar_t> inline
+void find_containing(const MappedPolygonStore<scalar_t> &polys, const Point2<scalar_t> *points, size_t n,
+    std::vector<IndexPair> &result)
+{
+    std::vector<AABox2<scalar_t>> boxes(n);
+    for (size_t k = 0; k < n; k++)
+        boxes[k] = {.min_x = points[k].x, .max_x = points[k].x, .min_y = points[k].y, .max_y = points[k].y};
+
+    std::vector<IndexPair> candidates;
+    find_overlaps(boxes.data(), n, polys.boxes(), polys.size(), candidates);
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<uint8_t> inside(candidates.size());
+    parallel_for(0, candidates.size(), [&](size_t k) {
+        inside[k] = polys.contains(candidates[k].second, points[candidates[k].first]);
+    }, 1024);
+    for (size_t k = 0; k < candidates.size(); k++)
+        if (inside[k])
+            result.push_back(candidates[k]);
+}
+
+} // namespace dgal
+
+#endif // DGAL_POLYGON_STORE_HPP
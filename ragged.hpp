@@ -0,0 +1,252 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a ragged container of polygons with different number of vertices, stored in CSR format
+ * (an offsets array and packed vertices), and batch kernels on it.
+ *
+ * Since the geometry functions work on fixed-size Poly2 objects, the kernels group the polygons (or pairs) by
+ * their vertex-count class (<=4, <=8, <=16, <=32) and process each group with the matching Poly2
+ * instantiation. This avoids padding all the polygons to the largest size.
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_RAGGED_HPP
+#define DGAL_RAGGED_HPP
+
+#include <array>
+#include <cassert>
+#include <type_traits>
+#include <vector>
+#include "dgal/geometry.hpp"
+#include "dgal/geometry_batch.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+constexpr uint8_t _ragged_nclasses = 4;
+constexpr uint8_t RaggedMaxPoints = 32;
+
+// Get the vertex-count class of a polygon, class c stores at most 4 << c vertices
+CUDA_CALLABLE_MEMBER inline uint8_t _ragged_class(uint32_t nvertices)
+{
+    return nvertices <= 4 ? 0 : nvertices <= 8 ? 1 : nvertices <= 16 ? 2 : 3;
+}
+
+template <typename scalar_t> struct RaggedPoly2
+{
+    std::vector<uint32_t> offsets {0}; // vertices of polygon i are [offsets[i], offsets[i+1])
+    std::vector<Point2<scalar_t>> vertices;
+
+    size_t size() const { return offsets.size() - 1; }
+    uint32_t nvertices(size_t i) const { return offsets[i+1] - offsets[i]; }
+    const Point2<scalar_t>* data(size_t i) const { return vertices.data() + offsets[i]; }
+
+    void clear()
+    {
+        offsets.assign(1, 0);
+        vertices.clear();
+    }
+
+    void reserve(size_t npolys, size_t nvertices)
+    {
+        offsets.reserve(npolys + 1);
+        vertices.reserve(nvertices);
+    }
+
+    // the points should be in counter-clockwise order and the count should be <= RaggedMaxPoints
+    void push_back(const Point2<scalar_t> *points, uint32_t n)
+    {
+        assert(n <= RaggedMaxPoints);
+        vertices.insert(vertices.end(), points, points + n);
+        offsets.push_back(vertices.size());
+    }
+
+    template <uint8_t MaxPoints>
+    void push_back(const Poly2<scalar_t, MaxPoints> &p)
+    {
+        push_back(p.vertices, p.nvertices);
+    }
+
+    // copy polygon i into a fixed-size polygon
+    template <uint8_t MaxPoints>
+    Poly2<scalar_t, MaxPoints> get(size_t i) const
+    {
+        assert(nvertices(i) <= MaxPoints);
+        Poly2<scalar_t, MaxPoints> p;
+        p.nvertices = nvertices(i);
+        const Point2<scalar_t> *src = data(i);
+        for (uint8_t k = 0; k < p.nvertices; k++)
+            p.vertices[k] = src[k];
+        return p;
+    }
+};
+
+// Call f with std::integral_constant<uint8_t, N> where N is the vertex capacity of the class
+template <typename Func> inline
+void _with_ragged_class(uint8_t c, const Func &f)
+{
+    switch (c)
+    {
+        case 0: f(std::integral_constant<uint8_t, 4>()); break;
+        case 1: f(std::integral_constant<uint8_t, 8>()); break;
+        case 2: f(std::integral_constant<uint8_t, 16>()); break;
+        default: f(std::integral_constant<uint8_t, 32>()); break;
+    }
+}
+
+// Sort item indices by class with counting sort, return the start of each class in order
+template <typename ClassFunc> inline
+std::vector<uint32_t> _bucket_by_class(size_t n, size_t nclasses, const ClassFunc &class_of,
+    std::vector<uint32_t> &order)
+{
+    std::vector<uint32_t> starts(nclasses + 1, 0);
+    std::vector<uint8_t> classes(n);
+    for (size_t k = 0; k < n; k++)
+    {
+        classes[k] = class_of(k);
+        starts[classes[k] + 1]++;
+    }
+    for (size_t c = 0; c < nclasses; c++)
+        starts[c + 1] += starts[c];
+
+    order.resize(n);
+    std::vector<uint32_t> cursor(starts.begin(), starts.end() - 1);
+    for (size_t k = 0; k < n; k++)
+        order[cursor[classes[k]]++] = k;
+    return starts;
+}
+
+template <typename scalar_t> inline
+void area_batch(const RaggedPoly2<scalar_t> &polys, scalar_t *areas)
+{
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> starts = _bucket_by_class(polys.size(), _ragged_nclasses,
+        [&](size_t i) { return _ragged_class(polys.nvertices(i)); }, order);
+
+    for (uint8_t c = 0; c < _ragged_nclasses; c++)
+        _with_ragged_class(c, [&](auto n) {
+            constexpr uint8_t N = decltype(n)::value;
+            parallel_for(starts[c], starts[c + 1], [&](size_t k) {
+                areas[order[k]] = area(polys.template get<N>(order[k]));
+            }, 1024);
+        });
+}
+
+// Implementation of iou_pairs, shared with the other ragged containers that provide nvertices(i) and get<N>(i)
+template <typename Polys1, typename Polys2, typename scalar_t> inline
+void _ragged_iou_pairs(const Polys1 &p1, const Polys2 &p2, const IndexPair *pairs, size_t n, scalar_t *ious,
+    uint8_t *status = nullptr)
+{
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> starts = _bucket_by_class(n, _ragged_nclasses * _ragged_nclasses, [&](size_t k) {
+        return _ragged_class(p1.nvertices(pairs[k].first)) * _ragged_nclasses
+             + _ragged_class(p2.nvertices(pairs[k].second));
+    }, order);
+
+    for (uint8_t c1 = 0; c1 < _ragged_nclasses; c1++)
+        for (uint8_t c2 = 0; c2 < _ragged_nclasses; c2++)
+        {
+            uint8_t c = c1 * _ragged_nclasses + c2;
+            if (starts[c] == starts[c + 1]) continue;
+            _with_ragged_class(c1, [&](auto n1) {
+                _with_ragged_class(c2, [&](auto n2) {
+                    constexpr uint8_t N1 = decltype(n1)::value, N2 = decltype(n2)::value;
+                    parallel_for(starts[c], starts[c + 1], [&](size_t k) {
+                        const IndexPair &pair = pairs[order[k]];
+                        uint8_t nx; PairStatus sk;
+                        ious[order[k]] = _iou_checked(p1.template get<N1>(pair.first),
+                            p2.template get<N2>(pair.second), nx, nullptr, sk);
+                        if (status != nullptr) status[order[k]] = uint8_t(sk);
+                    }, 256);
+                });
+            });
+        }
+}
+
+// Calculate IoU of the given pairs, where pairs[k].first indexes into p1 and pairs[k].second into p2.
+// Invalid pairs get zero IoU as in iou_batch, the PairStatus of pair k is stored in status[k] if it's not null
+template <typename scalar_t> inline
+void iou_pairs(const RaggedPoly2<scalar_t> &p1, const RaggedPoly2<scalar_t> &p2,
+    const IndexPair *pairs, size_t n, scalar_t *ious, uint8_t *status = nullptr)
+{
+    _ragged_iou_pairs(p1, p2, pairs, n, ious, status);
+}
+
+// Bounding boxes of the polygons. Empty polygons get an inverted box (min = +inf, max = -inf),
+// which never intersects any box and sorts last in the sweep of find_overlaps
+template <typename scalar_t> inline
+std::vector<AABox2<scalar_t>> _ragged_aabox2(const RaggedPoly2<scalar_t> &polys)
+{
+    const scalar_t inf = std::numeric_limits<scalar_t>::infinity();
+    std::vector<AABox2<scalar_t>> boxes(polys.size());
+    parallel_for(0, polys.size(), [&](size_t i) {
+        const Point2<scalar_t> *v = polys.data(i);
+        AABox2<scalar_t> &b = boxes[i];
+        b.min_x = b.min_y = inf;
+        b.max_x = b.max_y = -inf;
+        for (uint32_t k = 0; k < polys.nvertices(i); k++)
+        {
+            b.min_x = _min(b.min_x, v[k].x); b.max_x = _max(b.max_x, v[k].x);
+            b.min_y = _min(b.min_y, v[k].y); b.max_y = _max(b.max_y, v[k].y);
+        }
+    }, 1024);
+    return boxes;
+}
+
+template <typename Polys1, typename Polys2, typename scalar_t> inline
+void _ragged_iou_candidates(const Polys1 &p1, const Polys2 &p2,
+    std::vector<IndexPair> &candidates, std::vector<SparseEntry<scalar_t>> &result, const scalar_t &min_iou)
+{
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<scalar_t> values(candidates.size());
+    _ragged_iou_pairs(p1, p2, candidates.data(), candidates.size(), values.data());
+
+    for (size_t k = 0; k < candidates.size(); k++)
+        if (values[k] > min_iou)
+            result.push_back({.i = candidates[k].first, .j = candidates[k].second, .value = values[k]});
+}
+
+// Ragged version of iou_sparse from geometry_batch.hpp
+template <typename scalar_t> inline
+void iou_sparse(const RaggedPoly2<scalar_t> &p1, const RaggedPoly2<scalar_t> &p2,
+    std::vector<SparseEntry<scalar_t>> &result, const scalar_t &min_iou = 0)
+{
+    std::vector<AABox2<scalar_t>> boxes1 = _ragged_aabox2(p1), boxes2 = _ragged_aabox2(p2);
+    std::vector<IndexPair> candidates;
+    find_overlaps(boxes1.data(), boxes1.size(), boxes2.data(), boxes2.size(), candidates);
+    _ragged_iou_candidates(p1, p2, candidates, result, min_iou);
+}
+
+template <typename scalar_t> inline
+void iou_sparse(const RaggedPoly2<scalar_t> &p, std::vector<SparseEntry<scalar_t>> &result,
+    const scalar_t &min_iou = 0)
+{
+    std::vector<AABox2<scalar_t>> boxes = _ragged_aabox2(p);
+    std::vector<IndexPair> candidates;
+    find_overlaps(boxes.data(), boxes.size(), candidates);
+    _ragged_iou_candidates(p, p, candidates, result, min_iou);
+}
+
+} // namespace dgal
+
+#endif // DGAL_RAGGED_HPP
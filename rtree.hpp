@@ -0,0 +1,350 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a packed (static) R-tree over polygons that can be saved to a file and memory mapped.
+ * The tree is bulk loaded with Sort-Tile-Recursive (ref "STR: A Simple and Efficient Algorithm for R-Tree Packing"),
+ * and the polygons are stored in the file in the order of leaves, so that query results point directly
+ * into the mapped memory and can be passed to the geometry functions without copying. Mapping is read-only
+ * and shared, so processes opening the same file share the page cache.
+ *
+ * File layout (all sections are 64-byte aligned):
+ *      RTreeHeader | nodes (root first, leaves last) | polygons | ids
+ *
+ * Note that the functions in this file are only available in CPU and on POSIX systems. The files are not
+ * portable between machines with different endianness.
+ */
+
+#ifndef DGAL_RTREE_HPP
+#define DGAL_RTREE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "dgal/geometry.hpp"
+
+namespace dgal {
+
+struct RTreeHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size, poly_size; // used for validating the scalar type and capacity
+    uint32_t node_capacity;
+    uint64_t npolys, nnodes, leaf_begin; // nodes with index >= leaf_begin are leaves
+    uint64_t nodes_offset, polys_offset, ids_offset, file_size;
+};
+
+// For inner nodes, children are nodes [first, first+count), for leaves they are polygons
+template <typename scalar_t> struct RTreeNode
+{
+    AABox2<scalar_t> box;
+    uint32_t first = 0, count = 0;
+};
+
+constexpr char _rtree_magic[8] = {'D', 'G', 'A', 'L', 'R', 'T', 'R', 'E'};
+constexpr uint32_t _rtree_version = 1;
+
+inline uint64_t _align64(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+// Sort items into tiles with Sort-Tile-Recursive, return the permutation of the items
+template <typename scalar_t> inline
+std::vector<uint32_t> _str_order(const std::vector<AABox2<scalar_t>> &boxes, size_t capacity)
+{
+    size_t n = boxes.size();
+    std::vector<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return boxes[a].min_x + boxes[a].max_x < boxes[b].min_x + boxes[b].max_x;
+    });
+
+    size_t ngroups = (n + capacity - 1) / capacity;
+    size_t nslices = (size_t)ceil(sqrt((double)ngroups));
+    size_t slice_size = nslices * capacity;
+    for (size_t start = 0; start < n; start += slice_size)
+        std::sort(order.begin() + start, order.begin() + std::min(start + slice_size, n), [&](uint32_t a, uint32_t b) {
+            return boxes[a].min_y + boxes[a].max_y < boxes[b].min_y + boxes[b].max_y;
+        });
+    return order;
+}
+
+// Build a packed R-tree over polygons and write it to a file. ids are stored along with
+// the polygons (the input index is used if ids is null). Return false if writing failed
+template <typename scalar_t, uint8_t MaxPoints> inline
+bool write_rtree(const std::string &path, const Poly2<scalar_t, MaxPoints> *polys, size_t n,
+    const uint64_t *ids = nullptr, uint32_t node_capacity = 16)
+{
+    using Node = RTreeNode<scalar_t>;
+
+    // build the leaves
+    std::vector<AABox2<scalar_t>> boxes(n);
+    for (size_t i = 0; i < n; i++)
+        boxes[i] = aabox2_from_poly2(polys[i]);
+    std::vector<uint32_t> poly_order = _str_order(boxes, node_capacity);
+
+    std::vector<std::vector<Node>> levels(1);
+    for (size_t start = 0; start < n; start += node_capacity)
+    {
+        Node node;
+        node.first = start;
+        node.count = std::min<size_t>(node_capacity, n - start);
+        node.box = boxes[poly_order[start]];
+        for (size_t k = start + 1; k < start + node.count; k++)
+            node.box = merge(node.box, boxes[poly_order[k]]);
+        levels[0].push_back(node);
+    }
+
+    // build upper levels until there is only the root
+    while (levels.back().size() > 1)
+    {
+        std::vector<Node> &children = levels.back();
+        std::vector<AABox2<scalar_t>> child_boxes(children.size());
+        for (size_t i = 0; i < children.size(); i++)
+            child_boxes[i] = children[i].box;
+        std::vector<uint32_t> order = _str_order(child_boxes, node_capacity);
+
+        std::vector<Node> sorted(children.size()), parents;
+        for (size_t i = 0; i < children.size(); i++)
+            sorted[i] = children[order[i]];
+        children.swap(sorted);
+
+        for (size_t start = 0; start < children.size(); start += node_capacity)
+        {
+            Node node;
+            node.first = start;
+            node.count = std::min<size_t>(node_capacity, children.size() - start);
+            node.box = children[start].box;
+            for (size_t k = start + 1; k < start + node.count; k++)
+                node.box = merge(node.box, children[k].box);
+            parents.push_back(node);
+        }
+        levels.push_back(std::move(parents));
+    }
+
+    // flatten the levels from root to leaves
+    std::vector<Node> nodes;
+    for (size_t l = levels.size(); l-- > 0;)
+    {
+        size_t child_base = nodes.size() + levels[l].size();
+        for (Node node : levels[l])
+        {
+            if (l > 0) node.first += child_base;
+            nodes.push_back(node);
+        }
+    }
+
+    RTreeHeader header;
+    std::memcpy(header.magic, _rtree_magic, sizeof(header.magic));
+    header.version = _rtree_version;
+    header.node_size = sizeof(Node);
+    header.poly_size = sizeof(Poly2<scalar_t, MaxPoints>);
+    header.node_capacity = node_capacity;
+    header.npolys = n;
+    header.nnodes = nodes.size();
+    header.leaf_begin = nodes.size() - levels[0].size();
+    header.nodes_offset = _align64(sizeof(RTreeHeader));
+    header.polys_offset = _align64(header.nodes_offset + nodes.size() * sizeof(Node));
+    header.ids_offset = _align64(header.polys_offset + n * sizeof(Poly2<scalar_t, MaxPoints>));
+    header.file_size = header.ids_offset + n * sizeof(uint64_t);
+
+    std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+    if (!fout) return false;
+    const auto pad_to = [&](uint64_t offset) {
+        static const char zeros[64] = {0};
+        fout.write(zeros, offset - (uint64_t)fout.tellp());
+    };
+
+    fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    pad_to(header.nodes_offset);
+    fout.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(Node));
+    pad_to(header.polys_offset);
+    for (size_t i = 0; i < n; i++)
+        fout.write(reinterpret_cast<const char*>(&polys[poly_order[i]]), sizeof(Poly2<scalar_t, MaxPoints>));
+    pad_to(header.ids_offset);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t id = ids == nullptr ? poly_order[i] : ids[poly_order[i]];
+        fout.write(reinterpret_cast<const char*>(&id), sizeof(id));
+    }
+    return fout.good();
+}
+
+// Read-only view of an R-tree file written by write_rtree
+template <typename scalar_t, uint8_t MaxPoints> class MappedRTree
+{
+public:
+    using PolyT = Poly2<scalar_t, MaxPoints>;
+
+    MappedRTree() = default;
+    explicit MappedRTree(const std::string &path) { open(path); }
+    ~MappedRTree() { close(); }
+
+    MappedRTree(const MappedRTree&) = delete;
+    MappedRTree& operator=(const MappedRTree&) = delete;
+
+    // Map the file, return false if the file can't be opened or doesn't match the types. Throw std::runtime_error
+    // if the sections or the nodes are corrupted
+    bool open(const std::string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RTreeHeader))
+        {
+            ::close(fd);
+            return false;
+        }
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+
+        _data = static_cast<const char*>(data);
+        _size = st.st_size;
+        const RTreeHeader *h = header();
+        if (std::memcmp(h->magic, _rtree_magic, sizeof(h->magic)) != 0 || h->version != _rtree_version
+            || h->node_size != sizeof(RTreeNode<scalar_t>) || h->poly_size != sizeof(PolyT)
+            || h->file_size > _size)
+        {
+            close();
+            return false;
+        }
+        if (!_check_sections(*h) || !_check_nodes(*h))
+        {
+            close();
+            throw std::runtime_error("the R-tree file is corrupted: " + path);
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (_data != nullptr)
+            munmap(const_cast<char*>(_data), _size);
+        _data = nullptr;
+        _size = 0;
+    }
+
+    bool is_open() const { return _data != nullptr; }
+    const RTreeHeader* header() const { return reinterpret_cast<const RTreeHeader*>(_data); }
+    size_t size() const { return _data == nullptr ? 0 : header()->npolys; }
+
+    // polygons are stored in the order of leaves, use id() to get the original id
+    const PolyT* polygons() const { return reinterpret_cast<const PolyT*>(_data + header()->polys_offset); }
+    const PolyT& polygon(size_t i) const { return polygons()[i]; }
+    uint64_t id(size_t i) const { return reinterpret_cast<const uint64_t*>(_data + header()->ids_offset)[i]; }
+
+    // call visitor(i) for every polygon i whose bounding box overlaps the query box
+    template <typename Visitor>
+    void visit(const AABox2<scalar_t> &query, const Visitor &visitor) const
+    {
+        if (size() == 0) return;
+        const RTreeNode<scalar_t> *nodes = reinterpret_cast<const RTreeNode<scalar_t>*>(_data + header()->nodes_offset);
+        uint64_t leaf_begin = header()->leaf_begin;
+
+        std::vector<uint32_t> stack {0};
+        while (!stack.empty())
+        {
+            const RTreeNode<scalar_t> &node = nodes[stack.back()];
+            bool leaf = stack.back() >= leaf_begin;
+            stack.pop_back();
+            if (!_overlaps(node.box, query)) continue;
+
+            for (uint32_t k = node.first; k < node.first + node.count; k++)
+            {
+                if (!leaf)
+                    stack.push_back(k);
+                else if (_overlaps(aabox2_from_poly2(polygons()[k]), query))
+                    visitor(k);
+            }
+        }
+    }
+
+    void query(const AABox2<scalar_t> &box, std::vector<uint32_t> &result) const
+    {
+        visit(box, [&](uint32_t i) { result.push_back(i); });
+    }
+
+    // find the polygons containing the point
+    void query(const Point2<scalar_t> &p, std::vector<uint32_t> &result) const
+    {
+        AABox2<scalar_t> box {.min_x = p.x, .max_x = p.x, .min_y = p.y, .max_y = p.y};
+        visit(box, [&](uint32_t i) {
+            if (polygons()[i].contains(p)) result.push_back(i);
+        });
+    }
+
+private:
+    // whether count elements of type T starting at offset are aligned and within the file
+    template <typename T>
+    static bool _section_fits(uint64_t offset, uint64_t count, uint64_t file_size)
+    {
+        return offset % alignof(T) == 0 && offset <= file_size && count <= (file_size - offset) / sizeof(T);
+    }
+
+    static bool _check_sections(const RTreeHeader &h)
+    {
+        if (h.npolys >= h.file_size || h.nnodes >= h.file_size || h.npolys > std::numeric_limits<uint32_t>::max()
+            || h.nnodes > std::numeric_limits<uint32_t>::max() || (h.npolys > 0 && h.leaf_begin >= h.nnodes))
+            return false;
+        return _section_fits<RTreeNode<scalar_t>>(h.nodes_offset, h.nnodes, h.file_size)
+            && _section_fits<PolyT>(h.polys_offset, h.npolys, h.file_size)
+            && _section_fits<uint64_t>(h.ids_offset, h.npolys, h.file_size);
+    }
+
+    // the children of an inner node should be nodes after it (so that the traversal terminates),
+    // and the polygons of a leaf should be in range
+    bool _check_nodes(const RTreeHeader &h) const
+    {
+        const RTreeNode<scalar_t> *nodes = reinterpret_cast<const RTreeNode<scalar_t>*>(_data + h.nodes_offset);
+        for (uint64_t i = 0; i < h.nnodes; i++)
+        {
+            uint64_t end = (uint64_t)nodes[i].first + nodes[i].count;
+            if (i < h.leaf_begin ? nodes[i].first <= i || end > h.nnodes : end > h.npolys)
+                return false;
+        }
+        return true;
+    }
+
+    // closed overlap test, so that degenerated query boxes (points) work
+    static bool _overlaps(const AABox2<scalar_t> &a, const AABox2<scalar_t> &b)
+    {
+        return a.max_x >= b.min_x && a.min_x <= b.max_x && a.max_y >= b.min_y && a.min_y <= b.max_y;
+    }
+
+    const char *_data = nullptr;
+    size_t _size = 0;
+};
+
+} // namespace dgal
+
+#endif // DGAL_RTREE_HPP
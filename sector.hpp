@@ -0,0 +1,472 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains the exact overlap between convex polygons and circular regions (disks and circular
+ * sectors), which are used for sensor field-of-view checks. A sector is the part of a disk within the angular
+ * window [heading - half_angle, heading + half_angle], a half angle of at least pi makes it a full disk.
+ *
+ * The overlap area is decomposed into signed triangles (center, a, b) over the polygon edges. Each edge is split
+ * at its crossings with the circle and the boundary rays of the sector, then every piece inside the angular window
+ * contributes either the triangle area (inside the circle) or the circular sector area (outside the circle).
+ * The gradients are chained through the crossing points, so they are exact as long as no crossing degenerates.
+ *
+ * The functions on single shapes are available in GPU, while the batch functions are only available in CPU.
+ */
+
+#ifndef DGAL_SECTOR_HPP
+#define DGAL_SECTOR_HPP
+
+#include <vector>
+#include "dgal/geometry.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+template <typename scalar_t> struct Circle2 // Disk in 2D surface
+{
+    Point2<scalar_t> center;
+    scalar_t radius = 0;
+
+    // this operator is intended for gradient accumulation
+    CUDA_CALLABLE_MEMBER Circle2<scalar_t>& operator+= (const Circle2<scalar_t>& rhs)
+    {
+        center += rhs.center; radius += rhs.radius;
+        return *this;
+    }
+
+    // initialize the values to zeros
+    CUDA_CALLABLE_MEMBER inline void zero()
+    {
+        center.x = center.y = radius = 0;
+    }
+};
+
+template <typename scalar_t> struct Sector2 // Circular sector, e.g. field of view of a sensor
+{
+    // contract: radius >= 0, half_angle >= 0
+    Point2<scalar_t> center;
+    scalar_t radius = 0, heading = 0, half_angle = 0;
+
+    // this operator is intended for gradient accumulation
+    CUDA_CALLABLE_MEMBER Sector2<scalar_t>& operator+= (const Sector2<scalar_t>& rhs)
+    {
+        center += rhs.center; radius += rhs.radius;
+        heading += rhs.heading; half_angle += rhs.half_angle;
+        return *this;
+    }
+
+    CUDA_CALLABLE_MEMBER inline void zero()
+    {
+        center.x = center.y = radius = heading = half_angle = 0;
+    }
+};
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t area(const Circle2<scalar_t> &c)
+{
+    return _pi * c.radius * c.radius;
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t area(const Sector2<scalar_t> &s)
+{
+    return _min(s.half_angle, scalar_t(_pi)) * s.radius * s.radius;
+}
+
+// Internal description of a circular region, with points relative to its center
+template <typename scalar_t> struct _CircularRegion
+{
+    scalar_t radius;
+    bool full; // no angular window
+    Point2<scalar_t> ray1, ray2; // unit directions at heading - half_angle and heading + half_angle
+    Point2<scalar_t> axis; scalar_t cos_half; // heading direction and cosine of half angle
+};
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+_CircularRegion<scalar_t> _region_from(const Circle2<scalar_t> &c)
+{
+    _CircularRegion<scalar_t> r;
+    r.radius = c.radius;
+    r.full = true;
+    return r;
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+_CircularRegion<scalar_t> _region_from(const Sector2<scalar_t> &s)
+{
+    _CircularRegion<scalar_t> r;
+    r.radius = s.radius;
+    r.full = s.half_angle >= _pi;
+    r.ray1 = {.x = cos(s.heading - s.half_angle), .y = sin(s.heading - s.half_angle)};
+    r.ray2 = {.x = cos(s.heading + s.half_angle), .y = sin(s.heading + s.half_angle)};
+    r.axis = {.x = cos(s.heading), .y = sin(s.heading)};
+    r.cos_half = cos(s.half_angle);
+    return r;
+}
+
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+bool _in_window(const _CircularRegion<scalar_t> &r, const scalar_t &x, const scalar_t &y)
+{
+    return r.full || x * r.axis.x + y * r.axis.y >= hypot(x, y) * r.cos_half;
+}
+
+// Gradient of the region parameters, the angles are the ones of ray1 and ray2
+template <typename scalar_t> struct _CircularRegionGrad
+{
+    scalar_t radius = 0, angle1 = 0, angle2 = 0;
+};
+
+// Area of the triangle (center, a, b) inside the region, signed by the orientation of the triangle.
+// a and b are relative to the center. If grad_a is not null, the gradient (scaled by grad) is accumulated.
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t _edge_overlap_area(const _CircularRegion<scalar_t> &r, const Point2<scalar_t> &a, const Point2<scalar_t> &b,
+    const scalar_t &grad = 0, Point2<scalar_t> *grad_a = nullptr, Point2<scalar_t> *grad_b = nullptr,
+    _CircularRegionGrad<scalar_t> *grad_r = nullptr)
+{
+    enum { EndA, EndB, Circle, Ray1, Ray2 };
+    scalar_t dx = b.x - a.x, dy = b.y - a.y;
+    scalar_t ss[6]; uint8_t types[6], n = 0;
+    ss[n] = 0; types[n++] = EndA;
+
+    // crossings with the circle
+    scalar_t qa = dx*dx + dy*dy, qb = a.x*dx + a.y*dy, qc = a.x*a.x + a.y*a.y - r.radius*r.radius;
+    scalar_t disc = qb*qb - qa*qc;
+    if (qa > 0 && disc > 0)
+    {
+        scalar_t sq = sqrt(disc);
+        scalar_t s1 = (-qb - sq) / qa, s2 = (-qb + sq) / qa;
+        if (s1 > 0 && s1 < 1) { ss[n] = s1; types[n++] = Circle; }
+        if (s2 > 0 && s2 < 1) { ss[n] = s2; types[n++] = Circle; }
+    }
+
+    // crossings with the boundary rays
+    if (!r.full)
+    {
+        const Point2<scalar_t> *rays[2] = {&r.ray1, &r.ray2};
+        for (uint8_t k = 0; k < 2; k++)
+        {
+            const Point2<scalar_t> &u = *rays[k];
+            scalar_t den = u.x*dy - u.y*dx;
+            if (den == 0) continue;
+            scalar_t s = -(u.x*a.y - u.y*a.x) / den;
+            if (s > 0 && s < 1 && u.x*(a.x + s*dx) + u.y*(a.y + s*dy) > 0)
+            {
+                ss[n] = s;
+                types[n++] = k == 0 ? Ray1 : Ray2;
+            }
+        }
+    }
+    ss[n] = 1; types[n++] = EndB;
+
+    // sort the crossings along the edge (insertion sort on at most 4 values)
+    for (uint8_t i = 2; i < n - 1; i++)
+        for (uint8_t j = i; j > 1 && ss[j] < ss[j-1]; j--)
+        {
+            scalar_t ts = ss[j]; ss[j] = ss[j-1]; ss[j-1] = ts;
+            uint8_t tt = types[j]; types[j] = types[j-1]; types[j-1] = tt;
+        }
+
+    scalar_t result = 0;
+    for (uint8_t i = 0; i + 1 < n; i++)
+    {
+        if (ss[i+1] <= ss[i]) continue;
+        scalar_t sm = (ss[i] + ss[i+1]) / 2, mx = a.x + sm*dx, my = a.y + sm*dy;
+        if (!_in_window(r, mx, my)) continue;
+
+        Point2<scalar_t> q0 {.x = a.x + ss[i]*dx, .y = a.y + ss[i]*dy};
+        Point2<scalar_t> q1 {.x = a.x + ss[i+1]*dx, .y = a.y + ss[i+1]*dy};
+        Point2<scalar_t> g0, g1; // gradient w.r.t. q0 and q1
+        if (mx*mx + my*my <= r.radius*r.radius) // triangle
+        {
+            result += (q0.x*q1.y - q0.y*q1.x) / 2;
+            g0 = {.x = q1.y / 2, .y = -q1.x / 2};
+            g1 = {.x = -q0.y / 2, .y = q0.x / 2};
+        }
+        else // circular sector
+        {
+            scalar_t r2 = r.radius * r.radius;
+            scalar_t theta = atan2(q0.x*q1.y - q0.y*q1.x, q0.x*q1.x + q0.y*q1.y);
+            result += r2 * theta / 2;
+            scalar_t n0 = q0.x*q0.x + q0.y*q0.y, n1 = q1.x*q1.x + q1.y*q1.y;
+            g0 = {.x = r2 * q0.y / (2*n0), .y = -r2 * q0.x / (2*n0)};
+            g1 = {.x = -r2 * q1.y / (2*n1), .y = r2 * q1.x / (2*n1)};
+            if (grad_r != nullptr)
+                grad_r->radius += grad * r.radius * theta;
+        }
+        if (grad_a == nullptr) continue;
+
+        // chain the gradient through the end points of the piece
+        for (uint8_t e = 0; e < 2; e++)
+        {
+            const Point2<scalar_t> &q = e ? q1 : q0;
+            const scalar_t s = e ? ss[i+1] : ss[i];
+            const uint8_t type = e ? types[i+1] : types[i];
+            scalar_t gx = (e ? g1.x : g0.x) * grad, gy = (e ? g1.y : g0.y) * grad;
+
+            switch (type)
+            {
+                case EndA: grad_a->x += gx; grad_a->y += gy; break;
+                case EndB: grad_b->x += gx; grad_b->y += gy; break;
+                case Circle:
+                {
+                    // q = a + s*d with |q| = radius
+                    scalar_t k = (gx*dx + gy*dy) / (q.x*dx + q.y*dy);
+                    scalar_t px = gx - k*q.x, py = gy - k*q.y;
+                    grad_a->x += (1-s) * px; grad_a->y += (1-s) * py;
+                    grad_b->x += s * px; grad_b->y += s * py;
+                    if (grad_r != nullptr) grad_r->radius += k * r.radius;
+                    break;
+                }
+                default:
+                {
+                    // q = a + s*d with cross(u, q) = 0
+                    const Point2<scalar_t> &u = type == Ray1 ? r.ray1 : r.ray2;
+                    scalar_t k = (gx*dx + gy*dy) / (u.x*dy - u.y*dx);
+                    scalar_t px = gx + k*u.y, py = gy - k*u.x;
+                    grad_a->x += (1-s) * px; grad_a->y += (1-s) * py;
+                    grad_b->x += s * px; grad_b->y += s * py;
+                    if (grad_r != nullptr)
+                        (type == Ray1 ? grad_r->angle1 : grad_r->angle2) += k * (u.x*q.x + u.y*q.y);
+                    break;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+template <typename scalar_t, uint8_t MaxPoints, typename RegionT> CUDA_CALLABLE_MEMBER inline
+scalar_t _overlap_area(const Poly2<scalar_t, MaxPoints> &p, const RegionT &shape)
+{
+    _CircularRegion<scalar_t> r = _region_from(shape);
+    if (r.radius <= 0)
+        return 0;
+
+    // quick rejection by the bounding box of the circle
+    bool outside[4] = {true, true, true, true};
+    for (uint8_t i = 0; i < p.nvertices; i++)
+    {
+        outside[0] = outside[0] && p.vertices[i].x <= shape.center.x - r.radius;
+        outside[1] = outside[1] && p.vertices[i].x >= shape.center.x + r.radius;
+        outside[2] = outside[2] && p.vertices[i].y <= shape.center.y - r.radius;
+        outside[3] = outside[3] && p.vertices[i].y >= shape.center.y + r.radius;
+    }
+    if (outside[0] || outside[1] || outside[2] || outside[3])
+        return 0;
+
+    scalar_t result = 0;
+    for (uint8_t i = 0; i < p.nvertices; i++)
+    {
+        const Point2<scalar_t> &va = p.vertices[i], &vb = p.vertices[_mod_inc(i, p.nvertices)];
+        Point2<scalar_t> a {.x = va.x - shape.center.x, .y = va.y - shape.center.y};
+        Point2<scalar_t> b {.x = vb.x - shape.center.x, .y = vb.y - shape.center.y};
+        result += _edge_overlap_area(r, a, b);
+    }
+    return _max(result, scalar_t(0)); // the pieces of disjoint shapes cancel up to rounding
+}
+
+// Calculate the area of the part of polygon p inside the circle c
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+scalar_t intersection_area(const Poly2<scalar_t, MaxPoints> &p, const Circle2<scalar_t> &c)
+{
+    return _overlap_area(p, c);
+}
+
+// Calculate the area of the part of polygon p inside the sector s
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+scalar_t intersection_area(const Poly2<scalar_t, MaxPoints> &p, const Sector2<scalar_t> &s)
+{
+    if (s.half_angle <= 0)
+        return 0;
+    return _overlap_area(p, s);
+}
+
+// Check whether polygon p overlaps the disk at center with the radius. The edges are tested directly since the sign
+// of distance(Poly2, Point2) is not reliable when the nearest feature is a vertex
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+bool _overlaps_disk(const Poly2<scalar_t, MaxPoints> &p, const Point2<scalar_t> &center, const scalar_t &radius)
+{
+    if (p.contains(center))
+        return true;
+    scalar_t r2 = radius * radius;
+    for (uint8_t i = 0; i < p.nvertices; i++)
+    {
+        const Point2<scalar_t> &va = p.vertices[i], &vb = p.vertices[_mod_inc(i, p.nvertices)];
+        scalar_t dx = vb.x - va.x, dy = vb.y - va.y, wx = center.x - va.x, wy = center.y - va.y;
+        scalar_t l2 = dx*dx + dy*dy;
+        scalar_t t = l2 > 0 ? _min<scalar_t>(_max<scalar_t>((wx*dx + wy*dy) / l2, 0), 1) : 0;
+        scalar_t ex = wx - t*dx, ey = wy - t*dy;
+        if (ex*ex + ey*ey < r2)
+            return true;
+    }
+    return false;
+}
+
+// Check whether polygon p and circle c overlap
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+bool intersects(const Poly2<scalar_t, MaxPoints> &p, const Circle2<scalar_t> &c)
+{
+    return c.radius > 0 && _overlaps_disk(p, c.center, c.radius);
+}
+
+// Check whether polygon p and sector s overlap. If the boundaries don't cross, then either the polygon contains the
+// apex of the sector or the sector contains the vertices of the polygon.
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+bool intersects(const Poly2<scalar_t, MaxPoints> &p, const Sector2<scalar_t> &s)
+{
+    if (s.radius <= 0 || s.half_angle <= 0)
+        return false;
+    if (s.half_angle >= _pi)
+        return _overlaps_disk(p, s.center, s.radius);
+    if (p.contains(s.center))
+        return true;
+
+    _CircularRegion<scalar_t> r = _region_from(s);
+    scalar_t r2 = s.radius * s.radius;
+    for (uint8_t i = 0; i < p.nvertices; i++)
+    {
+        const Point2<scalar_t> &va = p.vertices[i], &vb = p.vertices[_mod_inc(i, p.nvertices)];
+        scalar_t ax = va.x - s.center.x, ay = va.y - s.center.y;
+        scalar_t dx = vb.x - va.x, dy = vb.y - va.y;
+
+        // vertex inside the sector
+        if (ax*ax + ay*ay < r2 && _in_window(r, ax, ay))
+            return true;
+
+        // edge crossing the boundary rays
+        const Point2<scalar_t> *rays[2] = {&r.ray1, &r.ray2};
+        for (uint8_t k = 0; k < 2; k++)
+        {
+            const Point2<scalar_t> &u = *rays[k];
+            scalar_t den = u.x*dy - u.y*dx;
+            if (den == 0) continue;
+            scalar_t t = -(u.x*ay - u.y*ax) / den; // position on the edge
+            scalar_t l = u.x*(ax + t*dx) + u.y*(ay + t*dy); // position on the ray
+            if (t >= 0 && t <= 1 && l > 0 && l < s.radius)
+                return true;
+        }
+
+        // edge crossing the arc
+        scalar_t qa = dx*dx + dy*dy, qb = ax*dx + ay*dy, qc = ax*ax + ay*ay - r2;
+        scalar_t disc = qb*qb - qa*qc;
+        if (qa > 0 && disc > 0)
+        {
+            scalar_t sq = sqrt(disc);
+            scalar_t t1 = (-qb - sq) / qa, t2 = (-qb + sq) / qa;
+            if (t1 >= 0 && t1 <= 1 && _in_window(r, ax + t1*dx, ay + t1*dy))
+                return true;
+            if (t2 >= 0 && t2 <= 1 && _in_window(r, ax + t2*dx, ay + t2*dy))
+                return true;
+        }
+    }
+    return false;
+}
+
+template <typename scalar_t, uint8_t MaxPoints, typename RegionT> CUDA_CALLABLE_MEMBER inline
+void _overlap_area_grad(const Poly2<scalar_t, MaxPoints> &p, const RegionT &shape, const scalar_t &grad,
+    Poly2<scalar_t, MaxPoints> &grad_p, Point2<scalar_t> &grad_center, _CircularRegionGrad<scalar_t> &grad_r)
+{
+    grad_p.nvertices = p.nvertices;
+    _CircularRegion<scalar_t> r = _region_from(shape);
+    if (r.radius <= 0)
+        return;
+
+    for (uint8_t i = 0; i < p.nvertices; i++)
+    {
+        uint8_t inext = _mod_inc(i, p.nvertices);
+        const Point2<scalar_t> &va = p.vertices[i], &vb = p.vertices[inext];
+        Point2<scalar_t> a {.x = va.x - shape.center.x, .y = va.y - shape.center.y};
+        Point2<scalar_t> b {.x = vb.x - shape.center.x, .y = vb.y - shape.center.y};
+        Point2<scalar_t> ga, gb;
+        _edge_overlap_area(r, a, b, grad, &ga, &gb, &grad_r);
+        grad_p.vertices[i] += ga;
+        grad_p.vertices[inext] += gb;
+        grad_center.x -= ga.x + gb.x;
+        grad_center.y -= ga.y + gb.y;
+    }
+}
+
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+void intersection_area_grad(const Poly2<scalar_t, MaxPoints> &p, const Circle2<scalar_t> &c, const scalar_t &grad,
+    Poly2<scalar_t, MaxPoints> &grad_p, Circle2<scalar_t> &grad_c)
+{
+    _CircularRegionGrad<scalar_t> grad_r;
+    _overlap_area_grad(p, c, grad, grad_p, grad_c.center, grad_r);
+    grad_c.radius += grad_r.radius;
+}
+
+template <typename scalar_t, uint8_t MaxPoints> CUDA_CALLABLE_MEMBER inline
+void intersection_area_grad(const Poly2<scalar_t, MaxPoints> &p, const Sector2<scalar_t> &s, const scalar_t &grad,
+    Poly2<scalar_t, MaxPoints> &grad_p, Sector2<scalar_t> &grad_s)
+{
+    grad_p.nvertices = p.nvertices;
+    if (s.half_angle <= 0)
+        return;
+
+    _CircularRegionGrad<scalar_t> grad_r;
+    _overlap_area_grad(p, s, grad, grad_p, grad_s.center, grad_r);
+    grad_s.radius += grad_r.radius;
+    grad_s.heading += grad_r.angle1 + grad_r.angle2;
+    grad_s.half_angle += grad_r.angle2 - grad_r.angle1;
+}
+
+// Calculate the overlap areas of n polygons with a single circle or sector, in parallel
+template <typename scalar_t, uint8_t MaxPoints, typename RegionT> inline
+void intersection_area_batch(const Poly2<scalar_t, MaxPoints> *polys, size_t n, const RegionT &shape,
+    scalar_t *areas)
+{
+    parallel_for(0, n, [&](size_t i) {
+        areas[i] = intersection_area(polys[i], shape);
+    }, 64);
+}
+
+// Check the overlap of n polygons with a single circle or sector, in parallel
+template <typename scalar_t, uint8_t MaxPoints, typename RegionT> inline
+void intersects_batch(const Poly2<scalar_t, MaxPoints> *polys, size_t n, const RegionT &shape,
+    bool *results)
+{
+    parallel_for(0, n, [&](size_t i) {
+        results[i] = intersects(polys[i], shape);
+    }, 64);
+}
+
+// Calculate the gradients of intersection_area_batch. The polygon gradients are overwritten,
+// and the gradient of the shape is reduced over all polygons and overwritten as well
+template <typename scalar_t, uint8_t MaxPoints, typename RegionT> inline
+void intersection_area_batch_grad(const Poly2<scalar_t, MaxPoints> *polys, size_t n, const RegionT &shape,
+    const scalar_t *grads, Poly2<scalar_t, MaxPoints> *grad_polys, RegionT &grad_shape)
+{
+    std::vector<RegionT> grad_shapes(n);
+    parallel_for(0, n, [&](size_t i) {
+        grad_polys[i].zero();
+        grad_shapes[i].zero();
+        intersection_area_grad(polys[i], shape, grads[i], grad_polys[i], grad_shapes[i]);
+    }, 64);
+
+    grad_shape.zero();
+    for (size_t i = 0; i < n; i++)
+        grad_shape += grad_shapes[i];
+}
+
+} // namespace dgal
+
+#endif // DGAL_SECTOR_HPP
@@ -0,0 +1,656 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a local server that batches geometry requests from multiple processes on the same host.
+ *
+ * Each client creates a shared memory buffer and passes its file descriptor to the server through a Unix socket
+ * when connecting. On Linux the buffer is a memfd sealed against shrinking, and the server rejects buffers
+ * without the seal, so a client can't truncate the buffer under the server and crash it with SIGBUS. A request only
+ * contains the operation and the offsets of the inputs and output in the buffer, so the server reads the inputs and
+ * writes the results in place without copying. Requests from all the clients are coalesced into one parallel kernel
+ * invocation when the number of pending items reaches max_batch or the oldest pending request has waited for max_delay.
+ *
+ * The client sockets are non-blocking on the server side, partial requests and replies are buffered per client so
+ * that a slow or stalled client can't block the others. A client that doesn't read its replies is disconnected.
+ *
+ * Note that the functions in this file are only available in CPU and on POSIX systems.
+ */
+
+#ifndef DGAL_SERVER_HPP
+#define DGAL_SERVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "dgal/geometry.hpp"
+#include "dgal/parallel.hpp"
+
+// whether the shared buffers are memfds sealed against shrinking
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING) && defined(F_SEAL_SHRINK)
+#define DGAL_SERVER_SEALED_BUFFER
+#endif
+
+namespace dgal {
+
+enum class ServerOp : uint32_t
+{
+    IoU = 0, // output[i] = iou(input1[i], input2[i]), inputs are Quad2 arrays
+    Area = 1 // output[i] = area(input1[i]), input1 is a Quad2 array
+};
+
+enum class ServerStatus : uint32_t
+{
+    Ok = 0,
+    InvalidRequest = 1
+};
+
+constexpr uint32_t _server_magic = 0x4447414c; // "DGAL"
+
+struct _ServerHello
+{
+    uint32_t magic;
+    uint32_t scalar_size;
+    uint64_t buffer_size;
+};
+
+struct _ServerRequest
+{
+    uint32_t op;
+    uint32_t n;
+    uint64_t input1, input2, output; // offsets in the shared buffer
+};
+
+struct _ServerReply
+{
+    uint32_t status;
+    uint32_t n;
+};
+
+inline bool _write_all(int fd, const void *data, size_t size)
+{
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    const char *p = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        ssize_t k = send(fd, p, size, flags);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k; size -= k;
+    }
+    return true;
+}
+
+inline bool _read_all(int fd, void *data, size_t size)
+{
+    char *p = static_cast<char*>(data);
+    while (size > 0)
+    {
+        ssize_t k = read(fd, p, size);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k; size -= k;
+    }
+    return true;
+}
+
+// send a message along with a file descriptor
+inline bool _send_with_fd(int sock, const void *data, size_t size, int fd)
+{
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(sock, &msg, 0) == (ssize_t)size;
+}
+
+inline bool _recv_with_fd(int sock, void *data, size_t size, int &fd)
+{
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, 0) != (ssize_t)size) return false;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) return false;
+    std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return true;
+}
+
+inline bool _unix_address(const std::string &path, struct sockaddr_un &addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    std::strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+template <typename scalar_t> class GeometryServer
+{
+public:
+    explicit GeometryServer(const std::string &path, size_t max_batch = 1 << 16,
+        std::chrono::microseconds max_delay = std::chrono::microseconds(1000))
+        : _path(path), _max_batch(max_batch), _max_delay(max_delay) {}
+
+    ~GeometryServer()
+    {
+        for (auto &c : _clients)
+            _close_client(c);
+        if (_listen_fd >= 0)
+        {
+            ::close(_listen_fd);
+            unlink(_path.c_str());
+        }
+        if (_wake[0] >= 0) { ::close(_wake[0]); ::close(_wake[1]); }
+    }
+
+    GeometryServer(const GeometryServer&) = delete;
+    GeometryServer& operator=(const GeometryServer&) = delete;
+
+    // create the socket, an existing socket file at the path is replaced. Return false if failed
+    bool listen()
+    {
+        struct sockaddr_un addr;
+        if (!_unix_address(_path, addr)) return false;
+        if (pipe(_wake) != 0) return false;
+        fcntl(_wake[0], F_SETFL, O_NONBLOCK);
+
+        _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_listen_fd < 0) return false;
+        unlink(_path.c_str());
+        if (bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(_listen_fd, 64) != 0)
+        {
+            ::close(_listen_fd);
+            _listen_fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // serve the clients until stop() is called
+    void run()
+    {
+        while (!_stopped.load())
+        {
+            std::vector<struct pollfd> fds;
+            fds.push_back({_listen_fd, POLLIN, 0});
+            fds.push_back({_wake[0], POLLIN, 0});
+            for (auto &c : _clients)
+                fds.push_back({c.fd, short(c.outbox.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+
+            int timeout = -1;
+            if (_npending > 0)
+            {
+                auto wait = _oldest + _max_delay - Clock::now();
+                timeout = std::max<long>(0, (std::chrono::duration_cast<std::chrono::microseconds>(wait).count() + 999) / 1000);
+            }
+            if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+                break;
+
+            if (fds[1].revents & POLLIN)
+            {
+                char buf[64];
+                while (read(_wake[0], buf, sizeof(buf)) > 0);
+            }
+            if (fds[0].revents & POLLIN)
+                _accept();
+
+            // the clients accepted in this round are not in fds
+            for (size_t k = 2; k < fds.size(); k++)
+            {
+                _Client &c = _clients[k - 2];
+                if (fds[k].revents & POLLOUT)
+                    _send(c);
+                if (c.fd >= 0 && (fds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+                {
+                    if (c.buffer == nullptr)
+                        _handshake(c);
+                    else
+                        _receive(c);
+                }
+            }
+            _clients.erase(std::remove_if(_clients.begin(), _clients.end(),
+                [](const _Client &c) { return c.fd < 0; }), _clients.end());
+
+            if (_npending > 0 && (_npending >= _max_batch || Clock::now() >= _oldest + _max_delay))
+                _flush();
+        }
+    }
+
+    // can be called from any thread
+    void stop()
+    {
+        _stopped.store(true);
+        if (_wake[1] >= 0)
+        {
+            char c = 0;
+            ssize_t _ = write(_wake[1], &c, 1); (void)_;
+        }
+    }
+
+    size_t nclients() const { return _clients.size(); } // including the ones in handshake
+    size_t nbatches() const { return _nbatches.load(); } // number of kernel invocations
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct _Client
+    {
+        int fd = -1;
+        char *buffer = nullptr; // null until the handshake is finished
+        size_t size = 0;
+        bool pending = false;
+        _ServerRequest request;
+        size_t nread = 0; // number of bytes of the request received so far
+        std::vector<char> outbox; // replies not sent yet
+    };
+
+    // maximum size of the unsent replies of a client before it's disconnected
+    static constexpr size_t _max_outbox = 64 * sizeof(_ServerReply);
+
+    // The hello is received when the socket becomes readable, so that a client connecting without sending it
+    // can't block the server. The socket stays non-blocking after the handshake
+    void _accept()
+    {
+        int fd = accept(_listen_fd, nullptr, nullptr);
+        if (fd < 0) return;
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+        {
+            ::close(fd);
+            return;
+        }
+
+        _Client c;
+        c.fd = fd;
+        _clients.push_back(c);
+    }
+
+    // whether the buffer can be mapped with the given size and can't be shrunk by the client later
+    static bool _check_buffer(int shm_fd, uint64_t size)
+    {
+        struct stat st;
+        if (size == 0 || fstat(shm_fd, &st) != 0 || (uint64_t)st.st_size < size)
+            return false;
+#ifdef DGAL_SERVER_SEALED_BUFFER
+        int seals = fcntl(shm_fd, F_GET_SEALS);
+        if (seals < 0 || !(seals & F_SEAL_SHRINK))
+            return false;
+#endif
+        return true;
+    }
+
+    void _handshake(_Client &c)
+    {
+        _ServerHello hello;
+        int shm_fd = -1;
+        if (!_recv_with_fd(c.fd, &hello, sizeof(hello), shm_fd) || hello.magic != _server_magic
+            || hello.scalar_size != sizeof(scalar_t) || !_check_buffer(shm_fd, hello.buffer_size))
+        {
+            if (shm_fd >= 0) ::close(shm_fd);
+            _close_client(c);
+            return;
+        }
+
+        void *buffer = mmap(nullptr, hello.buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        ::close(shm_fd);
+        if (buffer == MAP_FAILED)
+        {
+            _close_client(c);
+            return;
+        }
+        c.buffer = static_cast<char*>(buffer);
+        c.size = hello.buffer_size;
+    }
+
+    void _close_client(_Client &c)
+    {
+        if (c.pending)
+            _npending -= c.request.n;
+        if (c.buffer != nullptr)
+            munmap(c.buffer, c.size);
+        if (c.fd >= 0)
+            ::close(c.fd);
+        c.fd = -1;
+        c.buffer = nullptr;
+        c.pending = false;
+        c.outbox.clear();
+    }
+
+    bool _check_range(const _Client &c, uint64_t offset, size_t item_size, uint32_t n) const
+    {
+        return offset % alignof(scalar_t) == 0 && offset <= c.size && n * item_size <= c.size - offset;
+    }
+
+    bool _validate(const _Client &c, const _ServerRequest &r) const
+    {
+        const size_t box_size = sizeof(Quad2<scalar_t>);
+        switch (ServerOp(r.op))
+        {
+            case ServerOp::IoU:
+                return _check_range(c, r.input1, box_size, r.n) && _check_range(c, r.input2, box_size, r.n)
+                    && _check_range(c, r.output, sizeof(scalar_t), r.n);
+            case ServerOp::Area:
+                return _check_range(c, r.input1, box_size, r.n) && _check_range(c, r.output, sizeof(scalar_t), r.n);
+            default:
+                return false;
+        }
+    }
+
+    // send as much of the unsent replies as the socket accepts
+    void _send(_Client &c)
+    {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        size_t sent = 0;
+        while (sent < c.outbox.size())
+        {
+            ssize_t k = send(c.fd, c.outbox.data() + sent, c.outbox.size() - sent, flags);
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (k <= 0)
+            {
+                _close_client(c);
+                return;
+            }
+            sent += k;
+        }
+        c.outbox.erase(c.outbox.begin(), c.outbox.begin() + sent);
+    }
+
+    void _reply(_Client &c, ServerStatus status, uint32_t n)
+    {
+        _ServerReply reply {uint32_t(status), n};
+        const char *p = reinterpret_cast<const char*>(&reply);
+        c.outbox.insert(c.outbox.end(), p, p + sizeof(reply));
+        _send(c);
+        if (c.outbox.size() > _max_outbox)
+            _close_client(c); // the client stopped reading the replies
+    }
+
+    void _receive(_Client &c)
+    {
+        if (c.pending)
+        {
+            // the client disconnected (or sent a request before the last one is finished)
+            _close_client(c);
+            return;
+        }
+
+        char *p = reinterpret_cast<char*>(&c.request);
+        ssize_t k = read(c.fd, p + c.nread, sizeof(_ServerRequest) - c.nread);
+        if (k < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (k <= 0)
+        {
+            _close_client(c);
+            return;
+        }
+        c.nread += k;
+        if (c.nread < sizeof(_ServerRequest))
+            return; // wait for the rest of the request
+        c.nread = 0;
+
+        if (!_validate(c, c.request))
+        {
+            _reply(c, ServerStatus::InvalidRequest, 0);
+            return;
+        }
+
+        if (_npending == 0)
+            _oldest = Clock::now();
+        c.pending = true;
+        _npending += c.request.n;
+    }
+
+    void _flush()
+    {
+        std::vector<_Client*> batch;
+        std::vector<size_t> starts {0};
+        for (auto &c : _clients)
+            if (c.pending)
+            {
+                batch.push_back(&c);
+                starts.push_back(starts.back() + c.request.n);
+            }
+
+        parallel_for(0, starts.back(), [&](size_t k) {
+            size_t b = std::upper_bound(starts.begin(), starts.end(), k) - starts.begin() - 1;
+            const _Client &c = *batch[b];
+            size_t i = k - starts[b];
+
+            const Quad2<scalar_t> *input1 = reinterpret_cast<const Quad2<scalar_t>*>(c.buffer + c.request.input1);
+            const Quad2<scalar_t> *input2 = reinterpret_cast<const Quad2<scalar_t>*>(c.buffer + c.request.input2);
+            scalar_t *output = reinterpret_cast<scalar_t*>(c.buffer + c.request.output);
+            switch (ServerOp(c.request.op))
+            {
+                case ServerOp::IoU: output[i] = iou(input1[i], input2[i]); break;
+                case ServerOp::Area: output[i] = area(input1[i]); break;
+            }
+        }, 256);
+        _nbatches++;
+
+        for (_Client *c : batch)
+        {
+            c->pending = false;
+            _reply(*c, ServerStatus::Ok, c->request.n);
+        }
+        _npending = 0;
+        _clients.erase(std::remove_if(_clients.begin(), _clients.end(),
+            [](const _Client &c) { return c.fd < 0; }), _clients.end());
+    }
+
+    std::string _path;
+    size_t _max_batch;
+    std::chrono::microseconds _max_delay;
+
+    int _listen_fd = -1;
+    int _wake[2] = {-1, -1};
+    std::atomic<bool> _stopped {false};
+    std::atomic<size_t> _nbatches {0};
+    std::vector<_Client> _clients;
+    size_t _npending = 0;
+    Clock::time_point _oldest;
+};
+
+// Client of GeometryServer, a client should be used by one thread at a time
+template <typename scalar_t> class GeometryClient
+{
+public:
+    GeometryClient() = default;
+    ~GeometryClient() { close(); }
+
+    GeometryClient(const GeometryClient&) = delete;
+    GeometryClient& operator=(const GeometryClient&) = delete;
+
+    // connect to the server and share a buffer of the given size with it. Return false if failed
+    bool connect(const std::string &path, size_t buffer_size = 1 << 24)
+    {
+        close();
+        struct sockaddr_un addr;
+        if (!_unix_address(path, addr)) return false;
+
+        int shm_fd = _create_buffer(buffer_size);
+        if (shm_fd < 0) return false;
+
+        void *buffer = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        if (buffer == MAP_FAILED)
+        {
+            ::close(shm_fd);
+            return false;
+        }
+        _buffer = static_cast<char*>(buffer);
+        _size = buffer_size;
+
+        _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        _ServerHello hello {_server_magic, sizeof(scalar_t), buffer_size};
+        bool ok = _fd >= 0 && ::connect(_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+            && _send_with_fd(_fd, &hello, sizeof(hello), shm_fd);
+        ::close(shm_fd);
+        if (!ok) close();
+        return ok;
+    }
+
+    void close()
+    {
+        if (_fd >= 0) ::close(_fd);
+        if (_buffer != nullptr) munmap(_buffer, _size);
+        _fd = -1;
+        _buffer = nullptr;
+        _size = _used = 0;
+    }
+
+    bool connected() const { return _fd >= 0; }
+    char* buffer() const { return _buffer; }
+    size_t buffer_size() const { return _size; }
+
+    // Reserve n objects in the shared buffer, return null if it's full. The space is valid until reset()
+    template <typename T> T* allocate(size_t n)
+    {
+        size_t offset = (_used + alignof(T) - 1) / alignof(T) * alignof(T);
+        if (offset + n * sizeof(T) > _size) return nullptr;
+        _used = offset + n * sizeof(T);
+        return reinterpret_cast<T*>(_buffer + offset);
+    }
+    void reset() { _used = 0; }
+
+    // Run the operation on arrays in the shared buffer and wait for the results. Return false if failed
+    bool submit(ServerOp op, const void *input1, const void *input2, void *output, uint32_t n)
+    {
+        if (_fd < 0) return false;
+        _ServerRequest request {uint32_t(op), n, _offset(input1), _offset(input2), _offset(output)};
+        _ServerReply reply;
+        return _write_all(_fd, &request, sizeof(request)) && _read_all(_fd, &reply, sizeof(reply))
+            && reply.status == uint32_t(ServerStatus::Ok);
+    }
+
+    // Convenience functions copying the inputs and outputs through the shared buffer
+    bool iou(const Quad2<scalar_t> *p1, const Quad2<scalar_t> *p2, size_t n, scalar_t *ious)
+    {
+        reset();
+        Quad2<scalar_t> *in1 = allocate<Quad2<scalar_t>>(n), *in2 = allocate<Quad2<scalar_t>>(n);
+        scalar_t *out = allocate<scalar_t>(n);
+        if (out == nullptr) return false;
+        std::copy(p1, p1 + n, in1);
+        std::copy(p2, p2 + n, in2);
+        if (!submit(ServerOp::IoU, in1, in2, out, n)) return false;
+        std::copy(out, out + n, ious);
+        return true;
+    }
+
+    bool area(const Quad2<scalar_t> *p, size_t n, scalar_t *areas)
+    {
+        reset();
+        Quad2<scalar_t> *in = allocate<Quad2<scalar_t>>(n);
+        scalar_t *out = allocate<scalar_t>(n);
+        if (out == nullptr) return false;
+        std::copy(p, p + n, in);
+        if (!submit(ServerOp::Area, in, nullptr, out, n)) return false;
+        std::copy(out, out + n, areas);
+        return true;
+    }
+
+private:
+    // Create the file backing the shared buffer. It's a memfd sealed against shrinking where supported,
+    // otherwise an unlinked file, preferably in memory
+    static int _create_buffer(size_t size)
+    {
+#ifdef DGAL_SERVER_SEALED_BUFFER
+        int fd = memfd_create("dgal", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) return -1;
+        if (ftruncate(fd, size) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+#else
+        const char *dir = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+        std::string name = std::string(dir) + "/dgal-XXXXXX";
+        std::vector<char> templ(name.begin(), name.end());
+        templ.push_back('\0');
+        int fd = mkstemp(templ.data());
+        if (fd < 0) return -1;
+        unlink(templ.data());
+        if (ftruncate(fd, size) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+#endif
+    }
+
+    uint64_t _offset(const void *p) const
+    {
+        return p == nullptr ? 0 : static_cast<const char*>(p) - _buffer;
+    }
+
+    int _fd = -1;
+    char *_buffer = nullptr;
+    size_t _size = 0, _used = 0;
+};
+
+} // namespace dgal
+
+#endif // DGAL_SERVER_HPP
@@ -0,0 +1,347 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains a driver that splits very large pairwise jobs into spatial shards processed by separate
+ * worker processes, so that the job is not bounded by the memory of a single process.
+ *
+ * The shards are the cells of a TileGrid. Each polygon is replicated to every shard that its bounding box
+ * overlaps, and a candidate pair is only evaluated by the shard containing the lower-left corner of the
+ * intersection of their bounding boxes, so every pair is reported exactly once. The job is coordinated only
+ * through files in a directory: write_shards() stores one input file per shard and a manifest, each worker
+ * claims shards by creating lock files exclusively and publishes its results by renaming, and merge_shards()
+ * collects the results. Workers can run on several hosts as long as the directory is on a shared filesystem.
+ *
+ * Note that the functions in this file are only available in CPU and on POSIX systems.
+ */
+
+#ifndef DGAL_SHARDING_HPP
+#define DGAL_SHARDING_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "dgal/geometry.hpp"
+#include "dgal/broadphase.hpp"
+#include "dgal/geometry_batch.hpp"
+#include "dgal/tiling.hpp"
+
+namespace dgal {
+
+constexpr uint32_t _shard_magic = 0x44475348; // "DGSH"
+
+template <typename scalar_t> struct _ShardManifest
+{
+    uint32_t magic, scalar_size, max_points1, max_points2;
+    uint64_t nshards;
+    TileGrid<scalar_t> grid;
+    scalar_t min_iou;
+};
+
+struct _ShardHeader
+{
+    uint32_t magic;
+    int32_t tile_x, tile_y;
+    uint32_t n1, n2;
+};
+
+struct _ShardResultHeader
+{
+    uint32_t magic;
+    uint64_t count;
+};
+
+inline std::string _shard_path(const std::string &directory, size_t k, const char *suffix)
+{
+    char name[48];
+    std::snprintf(name, sizeof(name), "/shard-%06zu.%s", k, suffix);
+    return directory + name;
+}
+
+inline bool _file_exists(const std::string &path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+// Write the chunks to a temporary file and rename it to the path, so that readers never see a partial file
+inline bool _publish_file(const std::string &path, const std::vector<std::pair<const void*, size_t>> &chunks)
+{
+    std::string temp = path + ".tmp" + std::to_string(getpid());
+    std::FILE *f = std::fopen(temp.c_str(), "wb");
+    if (f == nullptr) return false;
+    bool ok = true;
+    for (const auto &c : chunks)
+        ok = ok && (c.second == 0 || std::fwrite(c.first, 1, c.second, f) == c.second);
+    ok = (std::fclose(f) == 0) && ok;
+    ok = ok && std::rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) unlink(temp.c_str());
+    return ok;
+}
+
+inline bool _read_file(const std::string &path, std::vector<char> &data)
+{
+    std::FILE *f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) return false;
+    data.clear();
+    char buf[1 << 16];
+    size_t k;
+    while ((k = std::fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + k);
+    bool ok = !std::ferror(f);
+    std::fclose(f);
+    return ok;
+}
+
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+bool _read_manifest(const std::string &directory, _ShardManifest<scalar_t> &manifest)
+{
+    std::vector<char> data;
+    if (!_read_file(directory + "/manifest", data) || data.size() != sizeof(manifest))
+        return false;
+    std::copy(data.begin(), data.end(), reinterpret_cast<char*>(&manifest));
+    return manifest.magic == _shard_magic && manifest.scalar_size == sizeof(scalar_t)
+        && manifest.max_points1 == MaxPoints1 && manifest.max_points2 == MaxPoints2;
+}
+
+// Split two sets of polygons into shards in the directory (created if missing), for iou_sparse between the sets.
+// Results of a previous job in the same directory are discarded. Return false if failed
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+bool write_shards(const std::string &directory, const Poly2<scalar_t, MaxPoints1> *p1, size_t n1,
+    const Poly2<scalar_t, MaxPoints2> *p2, size_t n2, const TileGrid<scalar_t> &grid, const scalar_t &min_iou = 0)
+{
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+        return false;
+    std::string manifest_path = directory + "/manifest";
+    unlink(manifest_path.c_str());
+
+    // replicate the polygons to all the tiles their bounding boxes overlap
+    using Members = std::pair<std::vector<uint32_t>, std::vector<uint32_t>>;
+    std::map<std::pair<int32_t, int32_t>, Members> tiles;
+    auto assign = [&](const AABox2<scalar_t> &box, uint32_t idx, bool first) {
+        for (int32_t i = grid.column(box.min_x); i <= grid.column(box.max_x); i++)
+            for (int32_t j = grid.row(box.min_y); j <= grid.row(box.max_y); j++)
+            {
+                Members &m = tiles[std::make_pair(i, j)];
+                (first ? m.first : m.second).push_back(idx);
+            }
+    };
+    for (size_t i = 0; i < n1; i++)
+        if (p1[i].nvertices > 0) assign(aabox2_from_poly2(p1[i]), i, true);
+    for (size_t j = 0; j < n2; j++)
+        if (p2[j].nvertices > 0) assign(aabox2_from_poly2(p2[j]), j, false);
+
+    // only the tiles with polygons from both sets produce pairs
+    size_t nshards = 0;
+    std::vector<Poly2<scalar_t, MaxPoints1>> polys1;
+    std::vector<Poly2<scalar_t, MaxPoints2>> polys2;
+    for (const auto &t : tiles)
+    {
+        const Members &m = t.second;
+        if (m.first.empty() || m.second.empty())
+            continue;
+
+        polys1.resize(m.first.size());
+        polys2.resize(m.second.size());
+        for (size_t a = 0; a < m.first.size(); a++) polys1[a] = p1[m.first[a]];
+        for (size_t b = 0; b < m.second.size(); b++) polys2[b] = p2[m.second[b]];
+
+        _ShardHeader header {_shard_magic, t.first.first, t.first.second,
+            uint32_t(m.first.size()), uint32_t(m.second.size())};
+        unlink(_shard_path(directory, nshards, "lock").c_str());
+        unlink(_shard_path(directory, nshards, "out").c_str());
+        if (!_publish_file(_shard_path(directory, nshards, "in"), {
+                {&header, sizeof(header)},
+                {m.first.data(), m.first.size() * sizeof(uint32_t)},
+                {m.second.data(), m.second.size() * sizeof(uint32_t)},
+                {polys1.data(), polys1.size() * sizeof(polys1[0])},
+                {polys2.data(), polys2.size() * sizeof(polys2[0])}}))
+            return false;
+        nshards++;
+    }
+
+    // the manifest is written last, so workers never start on an incomplete job
+    _ShardManifest<scalar_t> manifest {_shard_magic, sizeof(scalar_t), MaxPoints1, MaxPoints2,
+        nshards, grid, min_iou};
+    return _publish_file(manifest_path, {{&manifest, sizeof(manifest)}});
+}
+
+// Evaluate the pairs owned by a shard and write them to its output file
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+bool _process_shard(const std::string &directory, size_t k, const _ShardManifest<scalar_t> &manifest)
+{
+    std::vector<char> data;
+    if (!_read_file(_shard_path(directory, k, "in"), data) || data.size() < sizeof(_ShardHeader))
+        return false;
+    _ShardHeader header;
+    std::copy(data.data(), data.data() + sizeof(header), reinterpret_cast<char*>(&header));
+    const size_t n1 = header.n1, n2 = header.n2;
+    const size_t ids_size = (n1 + n2) * sizeof(uint32_t);
+    const size_t polys_size = n1 * sizeof(Poly2<scalar_t, MaxPoints1>) + n2 * sizeof(Poly2<scalar_t, MaxPoints2>);
+    if (header.magic != _shard_magic || data.size() != sizeof(header) + ids_size + polys_size)
+        return false;
+
+    // copy out of the byte buffer to get proper alignment
+    std::vector<uint32_t> ids(n1 + n2);
+    std::vector<Poly2<scalar_t, MaxPoints1>> polys1(n1);
+    std::vector<Poly2<scalar_t, MaxPoints2>> polys2(n2);
+    const char *p = data.data() + sizeof(header);
+    std::copy(p, p + ids_size, reinterpret_cast<char*>(ids.data()));
+    p += ids_size;
+    std::copy(p, p + n1 * sizeof(polys1[0]), reinterpret_cast<char*>(polys1.data()));
+    p += n1 * sizeof(polys1[0]);
+    std::copy(p, p + n2 * sizeof(polys2[0]), reinterpret_cast<char*>(polys2.data()));
+    data = std::vector<char>();
+
+    std::vector<AABox2<scalar_t>> boxes1(n1), boxes2(n2);
+    for (size_t a = 0; a < n1; a++) boxes1[a] = aabox2_from_poly2(polys1[a]);
+    for (size_t b = 0; b < n2; b++) boxes2[b] = aabox2_from_poly2(polys2[b]);
+    std::vector<IndexPair> candidates;
+    find_overlaps(boxes1.data(), n1, boxes2.data(), n2, candidates);
+
+    // the processes already run in parallel, so the pairs are evaluated serially
+    const TileGrid<scalar_t> &grid = manifest.grid;
+    std::vector<SparseEntry<scalar_t>> result;
+    for (const IndexPair &c : candidates)
+    {
+        const AABox2<scalar_t> &b1 = boxes1[c.first], &b2 = boxes2[c.second];
+        if (grid.column(_max(b1.min_x, b2.min_x)) != header.tile_x || grid.row(_max(b1.min_y, b2.min_y)) != header.tile_y)
+            continue;
+        scalar_t value = iou(polys1[c.first], polys2[c.second]);
+        if (value > manifest.min_iou)
+            result.push_back({.i = ids[c.first], .j = ids[n1 + c.second], .value = value});
+    }
+
+    _ShardResultHeader result_header {_shard_magic, result.size()};
+    return _publish_file(_shard_path(directory, k, "out"), {
+        {&result_header, sizeof(result_header)},
+        {result.data(), result.size() * sizeof(SparseEntry<scalar_t>)}});
+}
+
+// Process the shards in the directory that are not claimed by other workers yet. It can be run by any
+// number of processes (on any host sharing the directory) at the same time. Return false if failed
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+bool run_shard_worker(const std::string &directory)
+{
+    _ShardManifest<scalar_t> manifest;
+    if (!_read_manifest<scalar_t, MaxPoints1, MaxPoints2>(directory, manifest))
+        return false;
+
+    bool ok = true;
+    for (size_t k = 0; k < manifest.nshards; k++)
+    {
+        int fd = open(_shard_path(directory, k, "lock").c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd < 0)
+        {
+            if (errno != EEXIST) ok = false;
+            continue;
+        }
+        close(fd);
+        ok = _process_shard<scalar_t, MaxPoints1, MaxPoints2>(directory, k, manifest) && ok;
+    }
+    return ok;
+}
+
+// Collect the results of all the shards, in the order of (i, j). Shards without results (e.g. their
+// workers crashed) are processed in this process if finish_missing is true, otherwise return false
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+bool merge_shards(const std::string &directory, std::vector<SparseEntry<scalar_t>> &result,
+    bool finish_missing = true)
+{
+    _ShardManifest<scalar_t> manifest;
+    if (!_read_manifest<scalar_t, MaxPoints1, MaxPoints2>(directory, manifest))
+        return false;
+
+    result.clear();
+    std::vector<char> data;
+    for (size_t k = 0; k < manifest.nshards; k++)
+    {
+        std::string path = _shard_path(directory, k, "out");
+        if (!_file_exists(path) && !(finish_missing
+            && _process_shard<scalar_t, MaxPoints1, MaxPoints2>(directory, k, manifest)))
+            return false;
+
+        _ShardResultHeader header;
+        if (!_read_file(path, data) || data.size() < sizeof(header))
+            return false;
+        std::copy(data.data(), data.data() + sizeof(header), reinterpret_cast<char*>(&header));
+        if (header.magic != _shard_magic || data.size() != sizeof(header) + header.count * sizeof(SparseEntry<scalar_t>))
+            return false;
+
+        size_t offset = result.size();
+        result.resize(offset + header.count);
+        const char *p = data.data() + sizeof(header);
+        std::copy(p, p + header.count * sizeof(SparseEntry<scalar_t>), reinterpret_cast<char*>(result.data() + offset));
+    }
+
+    // each pair is owned by a single shard, duplicates can only come from mixing results of different jobs
+    auto less = [](const SparseEntry<scalar_t> &l, const SparseEntry<scalar_t> &r) {
+        return l.i < r.i || (l.i == r.i && l.j < r.j); };
+    auto same = [](const SparseEntry<scalar_t> &l, const SparseEntry<scalar_t> &r) {
+        return l.i == r.i && l.j == r.j; };
+    std::sort(result.begin(), result.end(), less);
+    result.erase(std::unique(result.begin(), result.end(), same), result.end());
+    return true;
+}
+
+// Same as iou_sparse from geometry_batch.hpp, but the job is split into shards in the directory and
+// processed by nprocs forked worker processes. Return false if failed
+template <typename scalar_t, uint8_t MaxPoints1, uint8_t MaxPoints2> inline
+bool iou_sparse_sharded(const Poly2<scalar_t, MaxPoints1> *p1, size_t n1,
+    const Poly2<scalar_t, MaxPoints2> *p2, size_t n2, const TileGrid<scalar_t> &grid,
+    const std::string &directory, size_t nprocs, std::vector<SparseEntry<scalar_t>> &result,
+    const scalar_t &min_iou = 0)
+{
+    if (!write_shards(directory, p1, n1, p2, n2, grid, min_iou))
+        return false;
+
+    std::vector<pid_t> workers;
+    for (size_t k = 0; k < nprocs; k++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // the child only has the calling thread, so it must not touch the global thread pool, and it
+            // leaves with _exit() to skip the destructors and exit handlers inherited from the parent
+            bool ok = run_shard_worker<scalar_t, MaxPoints1, MaxPoints2>(directory);
+            _exit(ok ? 0 : 1);
+        }
+        if (pid > 0)
+            workers.push_back(pid);
+    }
+    for (pid_t pid : workers)
+        while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR);
+
+    // shards left by failed workers (or all of them if no worker started) are finished here
+    return merge_shards<scalar_t, MaxPoints1, MaxPoints2>(directory, result, true);
+}
+
+} // namespace dgal
+
+#endif // DGAL_SHARDING_HPP
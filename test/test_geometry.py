@@ -1,4 +1,5 @@
 import numpy as np
+import pytest
 import shapely.ops as so
 import shapely.geometry as sg
 import torch
@@ -77,6 +78,664 @@ def test_merge():
     assert bi.min_x == 1 and bi.min_y == 1
     assert bi.max_x == 4 and bi.max_y == 4
 
+def test_polyline():
+    points = [Point2(0, 0), Point2(2, 0), Point2(3, 1), Point2(3, 3)]
+    l = Polyline2(points)
+    shapely_l = sg.LineString([(p.x, p.y) for p in points])
+    assert np.isclose(length(l), shapely_l.length)
+
+    p = point_from_s(l, 2 + np.sqrt(2) / 2)
+    assert np.isclose(p.x, 2.5) and np.isclose(p.y, 0.5)
+
+    for x, y in np.random.rand(20, 2) * 4:
+        s, offset, idx = project(l, Point2(x, y))
+        if 0 < s < length(l):
+            assert np.isclose(s, shapely_l.project(sg.Point(x, y)))
+            assert np.isclose(abs(offset), shapely_l.distance(sg.Point(x, y)))
+        assert np.isclose(project(l, Point2(x, y), idx)[0], s)
+
+    box = poly2_from_xywhr(6, 2, 2, 2, 0)
+    assert np.isclose(distance(l, box), 2)
+    assert distance(l, poly2_from_xywhr(3, 2, 1, 1, 0.3)) == 0
+
+    # gradients by finite difference, the perturbations keep the projected segment and the distance flags
+    h = 1e-6
+    def shifted(points, k, c):
+        points = [Point2(p.x, p.y) for p in points]
+        setattr(points[k], c, getattr(points[k], c) + h)
+        return points
+
+    # distance_grad of a line whose coefficients are not normalized (regression)
+    line, point = Line2(1.5, -0.7, 0.3), Point2(0.8, -1.2)
+    grad_line, grad_point = Line2(), Point2()
+    distance_grad(line, point, 1., grad_line, grad_point)
+    d = distance(line, point)
+    assert np.isclose((distance(Line2(1.5 + h, -0.7, 0.3), point) - d) / h, grad_line.a, atol=1e-5)
+    assert np.isclose((distance(Line2(1.5, -0.7 + h, 0.3), point) - d) / h, grad_line.b, atol=1e-5)
+    assert np.isclose((distance(Line2(1.5, -0.7, 0.3 + h), point) - d) / h, grad_line.c, atol=1e-5)
+    assert np.isclose((distance(line, Point2(0.8 + h, -1.2)) - d) / h, grad_point.x, atol=1e-5)
+    assert np.isclose((distance(line, Point2(0.8, -1.2 + h)) - d) / h, grad_point.y, atol=1e-5)
+
+    for x, y in [(1, -0.5), (2.8, 0.4), (1.5, 2), (4, 2.5)]:
+        q = Point2(x, y)
+        s, offset, idx = project(l, q)
+        for grad_s, grad_offset in [(1, 0), (0, 1)]:
+            grad_l, grad_q = project_grad(l, q, grad_s, grad_offset, idx)
+            value = lambda r: r[0] * grad_s + r[1] * grad_offset
+            for k in range(len(points)):
+                for c in "xy":
+                    fd = (value(project(Polyline2(shifted(points, k, c)), q)) - value((s, offset))) / h
+                    assert np.isclose(fd, getattr(grad_l.vertices[k], c), atol=1e-4)
+            assert np.isclose((value(project(l, Point2(x + h, y))) - value((s, offset))) / h, grad_q.x, atol=1e-4)
+            assert np.isclose((value(project(l, Point2(x, y + h))) - value((s, offset))) / h, grad_q.y, atol=1e-4)
+
+    for box in [poly2_from_xywhr(6, 2, 2, 2, 0.3), poly2_from_xywhr(1, -2, 1.5, 1, 0.8)]:
+        d, flag1, flag2 = distance_(l, box)
+        grad_l, grad_box = distance_grad(l, box, 1., flag1, flag2)
+        for k in range(len(points)):
+            for c in "xy":
+                fd = (distance(Polyline2(shifted(points, k, c)), box) - d) / h
+                assert np.isclose(fd, getattr(grad_l.vertices[k], c), atol=1e-4)
+        for k in range(4):
+            for c in "xy":
+                fd = (distance(l, Quad2(shifted(box.vertices, k, c))) - d) / h
+                assert np.isclose(fd, getattr(grad_box.vertices[k], c), atol=1e-4)
+
+def test_ap_evaluator():
+    evaluator = APEvaluator(2, [0.5, 0.7], 2)
+    frames = []
+    for f in range(20):
+        gts = [EvalAnnotation(poly2_from_xywhr(5*k, f, 2, 1, 0.1*k), 0, k % 2, k % 2) for k in range(6)]
+        dets = [EvalDetection(poly2_from_xywhr(5*k + 0.1, f, 2, 1, 0.1*k), 0.9, 0, k % 2) for k in range(6)]
+        dets.append(EvalDetection(poly2_from_xywhr(-10, -10, 1, 1, 0), 0.2, 0, 0)) # false positive
+        frames.append((dets, gts))
+    evaluator.add_frames(frames)
+
+    metrics = evaluator.evaluate(0, 0, 0)
+    assert metrics.ngt == 60 and metrics.ntp == 60 and metrics.nfp == 20
+    assert np.isclose(metrics.ap, 1) and np.isclose(metrics.aos, 1)
+
+    # difficulty 1 objects of class 1 are ignored at level 0
+    assert evaluator.evaluate(1, 0, 0).ngt == 0
+    assert evaluator.evaluate(1, 1, 0).ngt == 60
+
+    for label, difficulty, threshold_index in [(2, 0, 0), (-1, 0, 0), (0, 2, 0), (0, 0, 2)]:
+        with pytest.raises(IndexError):
+            evaluator.evaluate(label, difficulty, threshold_index)
+
+def test_box_fusion():
+    boxes = [poly2_from_xywhr(0, 0, 4, 2, 0.1), poly2_from_xywhr(0.2, 0, 4, 2, 0.1),
+             poly2_from_xywhr(10, 10, 2, 2, 0), poly2_from_xywhr(0.4, 0, 4, 2, 0.1)]
+    assert cluster_iou(boxes, 0.5) == [0, 0, 1, 0]
+
+    fusion = BoxFusion([1, 1], 0.5)
+    fusion.add(0, [FusionBox(0, 0, 4, 2, 0.1, 0.9), FusionBox(10, 10, 2, 2, 0, 0.8)])
+    fusion.add(1, [FusionBox(0.2, 0, 4, 2, 0.1 + np.pi, 0.9)])
+    fused = fusion.fuse()
+    assert len(fused) == 2
+    assert np.isclose(fused[0].x, 0.1) and np.isclose(fused[0].score, 0.9)
+    assert np.isclose(fused[1].score, 0.4)
+
+    with pytest.raises(IndexError):
+        fusion.add(2, [FusionBox(0, 0, 4, 2, 0.1, 0.9)])
+    for weights in [[0, 0], [1, -1]]:
+        with pytest.raises(ValueError):
+            BoxFusion(weights)
+
+    # the detections of a model with zero weight don't form clusters with zero weight sum
+    fusion = BoxFusion([1, 0], 0.5)
+    fusion.add(0, [FusionBox(0, 0, 4, 2, 0.1, 0.9)])
+    fusion.add(1, [FusionBox(0.2, 0, 4, 2, 0.1, 0.9), FusionBox(10, 10, 2, 2, 0, 0.8)])
+    fused = fusion.fuse()
+    assert len(fused) == 1 and np.isclose(fused[0].x, 0) and np.isclose(fused[0].score, 0.9)
+
+def test_visibility():
+    boxes = [poly2_from_aabox2(AABox2(2, 3, -0.5, 0.5)), poly2_from_aabox2(AABox2(5, 6, -2, 2)),
+             poly2_from_aabox2(AABox2(-6, -5, -1, 1))]
+    fractions, polygon = visibility(boxes, Point2(0, 0), 20)
+    assert np.allclose(fractions, [1, 1 - np.arctan(0.25) / np.arctan(0.4), 1])
+    assert len(polygon) > 0
+
+    batch = visibility_batch([boxes, boxes[:1]], [Point2(0, 0), Point2(0, 0)])
+    assert np.allclose(batch[0], fractions) and np.allclose(batch[1], [1])
+
+    # the range only clips the polygon, boxes beyond it still get their fractions
+    clipped, polygon = visibility(boxes, Point2(0, 0), 4)
+    assert np.allclose(clipped, fractions)
+    assert all(np.hypot(p.x, p.y) <= 4 + 1e-9 for p in polygon)
+
+    # overlapping boxes, compared with casting rays
+    for _ in range(3):
+        boxes = [poly2_from_xywhr(*(np.random.rand(2) * 6 - 3), *(np.random.rand(2) * 3 + 0.5), np.random.rand() * 6)
+                 for _ in range(8)]
+        viewpoint = Point2(8, 1)
+        fractions, _ = visibility(boxes, viewpoint, 100)
+        hits, nearest = np.zeros(len(boxes)), np.zeros(len(boxes))
+        for angle in np.linspace(-np.pi, np.pi, 2000, endpoint=False):
+            ray = sg.LineString([(viewpoint.x, viewpoint.y),
+                                 (viewpoint.x + 100 * np.cos(angle), viewpoint.y + 100 * np.sin(angle))])
+            dists = [ray.intersection(sg.Polygon([(v.x, v.y) for v in b.vertices])) for b in boxes]
+            dists = [np.inf if d.is_empty else d.distance(sg.Point(viewpoint.x, viewpoint.y)) for d in dists]
+            hits += np.isfinite(dists)
+            if np.isfinite(min(dists)):
+                nearest[np.argmin(dists)] += 1
+        expected = np.divide(nearest, hits, out=np.ones(len(boxes)), where=hits > 0)
+        assert np.allclose(fractions, expected, atol=0.05)
+
+def test_rtree(tmp_path):
+    rng = np.random.default_rng(0)
+    polys = [Poly28([Point2(x, y), Point2(x + 1, y), Point2(x + 1, y + 1), Point2(x, y + 1)])
+             for x, y in rng.uniform(0, 100, (500, 2))]
+    path = str(tmp_path / "polys.rtree")
+    assert write_rtree(path, polys, list(range(1000, 1500)))
+
+    tree = MappedRTree(path)
+    assert tree.is_open and len(tree) == 500
+    query = AABox2(20, 40, 30, 60)
+    found = sorted(tree.id(i) for i in tree.query(query))
+    expected = [1000 + i for i, p in enumerate(polys) if
+                p.vertices[2].x >= 20 and p.vertices[0].x <= 40 and p.vertices[2].y >= 30 and p.vertices[0].y <= 60]
+    assert found == expected
+
+    point = polys[7].vertices[0]
+    hits = tree.query(Point2(point.x + 0.5, point.y + 0.5))
+    assert 1007 in [tree.id(i) for i in hits]
+    assert np.isclose(area(tree.polygon(hits[0])), 1)
+    tree.close()
+
+    with open(path, "rb") as f:
+        data = f.read()
+    corruptions = [(24, np.uint64(1 << 40)), # npolys in the header
+                   (48, np.uint64(100)), # misaligned nodes_offset
+                   (160, np.uint32(0))] # the root as its own child
+    for offset, value in corruptions:
+        with open(path, "wb") as f:
+            f.write(data[:offset] + value.tobytes() + data[offset + value.nbytes:])
+        with pytest.raises(RuntimeError):
+            MappedRTree(path)
+
+def test_placement():
+    scene = [poly2_from_xywhr(0, 0, 4, 2, 0), poly2_from_xywhr(10, 0, 4, 2, 0.5)]
+    assert intersects(scene[0], poly2_from_xywhr(1, 1, 4, 2, 0.3))
+    assert not intersects(scene[0], poly2_from_xywhr(5, 0, 4, 2, 0))
+
+    objects = [poly2_from_xywhr(0.5, 0, 4, 2, 0), poly2_from_xywhr(20, 0, 4, 2, 0), poly2_from_xywhr(20.5, 0, 4, 2, 0)]
+    sampler = PlacementSampler(4, seed=1)
+    sampler.add(scene)
+    placed, success = sampler.place(objects, ntrials=1)
+    assert success == [False, True, False] and len(sampler) == 3
+
+    sampler = PlacementSampler(4, seed=1)
+    sampler.add(scene)
+    placed, success = sampler.place(objects, ntrials=50, max_shift=5, max_rotation=0.5)
+    assert all(success) and len(sampler) == 5
+    boxes = sampler.boxes
+    for i in range(len(boxes)):
+        for j in range(i + 1, len(boxes)):
+            assert iou(boxes[i], boxes[j]) < 1e-6
+
+def test_box_coder():
+    anchors = [[0, 0, 4, 2, 0], [5, 5, 2, 2, 1]]
+    boxes = [[0.5, -0.2, 4.4, 1.8, 0.1], [5.1, 4.8, 2.2, 2.1, 1.2]]
+    for encoding in [BoxEncoding.Standard, BoxEncoding.SinCos]:
+        deltas = encode_boxes(boxes, anchors, encoding)
+        assert np.allclose(decode_boxes(deltas, anchors, encoding), boxes)
+
+        targets = [poly2_from_xywhr(0.6, -0.1, 4, 2, 0.2), poly2_from_xywhr(5, 5, 2, 2, 1)]
+        polys = decode_poly2(deltas, anchors, encoding)
+        ious, xflags = iou_batch_(polys, targets)
+        assert np.allclose(ious, [iou(p, t) for p, t in zip(polys, targets)])
+
+        grad_polys, _ = iou_batch_grad(polys, targets, [1, 1], xflags)
+        grad_deltas = decode_poly2_grad(deltas, anchors, grad_polys, encoding)
+        eps = 1e-6
+        for k in range(len(deltas[0])):
+            shifted = [list(d) for d in deltas]
+            shifted[0][k] += eps
+            shifted_iou = iou(decode_poly2(shifted, anchors, encoding)[0], targets[0])
+            assert np.isclose((shifted_iou - ious[0]) / eps, grad_deltas[0][k], atol=1e-4)
+
+        # the fused kernel doesn't store the decoded polygons
+        fused_ious, state = decode_iou(deltas, anchors, targets, encoding)
+        assert np.allclose(fused_ious, ious)
+        assert np.allclose(decode_iou_grad(deltas, anchors, targets, [1, 1], state, encoding), grad_deltas)
+
+def test_ragged():
+    def ngon(x, y, r, k):
+        return [Point2(x + r * np.cos(a), y + r * np.sin(a)) for a in np.linspace(0, 2 * np.pi, k, endpoint=False)]
+    polys = [ngon(0, 0, 1, 4), ngon(1, 0, 1, 7), ngon(0.5, 0.5, 2, 20), ngon(10, 10, 1, 5)]
+    ragged = RaggedPoly2(polys)
+    assert len(ragged) == 4 and ragged.offsets == [0, 4, 11, 31, 36]
+
+    areas = area_batch(ragged)
+    expected = [sg.Polygon([(p.x, p.y) for p in poly]).area for poly in polys]
+    assert np.allclose(areas, expected)
+
+    ious = iou_pairs(ragged, ragged, [(0, 1), (1, 2), (0, 3)])
+    shapes = [sg.Polygon([(p.x, p.y) for p in poly]) for poly in polys]
+    for (i, j), value in zip([(0, 1), (1, 2), (0, 3)], ious):
+        assert np.isclose(value, shapes[i].intersection(shapes[j]).area / shapes[i].union(shapes[j]).area)
+
+    pairs = iou_sparse(ragged, ragged, 0.1)
+    assert (0, 3) not in [(i, j) for i, j, _ in pairs]
+    assert all(v > 0.1 for _, _, v in pairs)
+
+    ragged.push_back([]) # empty polygons are never candidates
+    assert iou_sparse(ragged, ragged, 0.1) == pairs
+
+def test_kernel_dispatch():
+    assert kernel_isa() in ["baseline", "sse4.2", "avx2", "avx512"]
+
+    boxes1 = [poly2_from_xywhr(0, 0, 4, 2, 0.1), poly2_from_xywhr(10, 0, 2, 2, 0)]
+    boxes2 = [poly2_from_xywhr(0.5, 0, 4, 2, 0.2), poly2_from_xywhr(20, 0, 2, 2, 0), poly2_from_xywhr(10, 1, 2, 2, 0.3)]
+    pairs = iou_sparse(boxes1, boxes2)
+    assert [(i, j) for i, j, _ in pairs] == [(0, 0), (1, 2)]
+    assert np.allclose([v for _, _, v in pairs], [iou(boxes1[0], boxes2[0]), iou(boxes1[1], boxes2[2])])
+
+def test_async():
+    import asyncio
+    boxes1 = [poly2_from_xywhr(0, 0, 4, 2, 0.1), poly2_from_xywhr(10, 0, 2, 2, 0)]
+    boxes2 = [poly2_from_xywhr(0.5, 0, 4, 2, 0.2), poly2_from_xywhr(10, 1, 2, 2, 0.3)]
+
+    set_async_queue_depth(4)
+    futures = [iou_sparse_async(boxes1, boxes2) for _ in range(8)]
+    for f in futures:
+        assert f.result(timeout=10) == iou_sparse(boxes1, boxes2)
+
+    async def run():
+        return await asyncio.wrap_future(iou_batch_async(boxes1, boxes2))
+    ious = asyncio.run(run())
+    assert np.allclose(ious, [iou(b1, b2) for b1, b2 in zip(boxes1, boxes2)])
+
+    # a slow job completes after the result callback is registered, which then runs on a worker thread
+    slow = asyncio.run(asyncio.wait_for(asyncio.wrap_future(iou_batch_async(boxes1 * 100000, boxes2 * 100000)), 60))
+    assert np.allclose(slow[-2:], ious)
+
+def test_server(tmp_path):
+    import fcntl
+    import os
+    import socket
+    import struct
+    import threading
+    path = str(tmp_path / "dgal.sock")
+    server = GeometryServer(path, max_delay=1e-3)
+    assert server.listen()
+    thread = threading.Thread(target=server.run)
+    thread.start()
+    idle = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        idle.connect(path) # a client that never sends the hello shouldn't block the others
+        if hasattr(os, "memfd_create") and hasattr(socket, "send_fds"):
+            # a client that stops in the middle of a request shouldn't block the others either
+            shm = os.memfd_create("dgal", os.MFD_ALLOW_SEALING)
+            os.ftruncate(shm, 1 << 16)
+            fcntl.fcntl(shm, fcntl.F_ADD_SEALS, fcntl.F_SEAL_SHRINK)
+            stalled = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            stalled.connect(path)
+            socket.send_fds(stalled, [struct.pack("<IIQ", 0x4447414c, 8, 1 << 16)], [shm])
+            stalled.send(bytes(10))
+            os.close(shm)
+        boxes1 = [poly2_from_xywhr(0, 0, 4, 2, 0.1), poly2_from_xywhr(10, 0, 2, 2, 0)]
+        boxes2 = [poly2_from_xywhr(0.5, 0, 4, 2, 0.2), poly2_from_xywhr(10, 1, 2, 2, 0.3)]
+        clients = [GeometryClient() for _ in range(3)]
+        for client in clients:
+            assert client.connect(path, 1 << 16)
+            assert np.allclose(client.iou(boxes1, boxes2), [iou(b1, b2) for b1, b2 in zip(boxes1, boxes2)])
+            assert np.allclose(client.area(boxes1), [8, 4])
+    finally:
+        idle.close()
+        server.stop()
+        thread.join()
+
+def test_fused_expression():
+    b1, b2 = poly2_from_xywhr(0, 0, 4, 2, 0.3), poly2_from_xywhr(1, 0.5, 3, 2, 1.1)
+    assert np.isclose(intersection_area(b1, b2), area(intersect(b1, b2)))
+    assert np.isclose(merged_dimension(b1, b2), dimension(merge(b1, b2)))
+
+    # boxes sharing an edge
+    b3, b4 = poly2_from_xywhr(0, 0, 2, 2, 0), poly2_from_xywhr(1, 0, 2, 2, 0)
+    assert np.isclose(intersection_area(b3, b4), 2)
+
+    # random boxes, including ones with the same heading and ones sharing an edge after rotation
+    for k in range(300):
+        x, y, w1, h1, w2, h2 = np.random.rand(6) * 3 + 0.5
+        r = np.random.rand() * 2 * np.pi
+        if k % 3 == 0:
+            b1, b2 = poly2_from_xywhr(x, y, w1, h1, r), poly2_from_xywhr(y, x, w2, h2, np.random.rand() * 2 * np.pi)
+        elif k % 3 == 1:
+            b1, b2 = poly2_from_xywhr(x, y, w1, h1, r), poly2_from_xywhr(y, x, w2, h2, r)
+        else:
+            d = (w1 + w2) / 2 - np.random.rand() * min(w1, w2)
+            b1, b2 = poly2_from_xywhr(x, y, w1, h1, r), poly2_from_xywhr(x + d * np.cos(r), y + d * np.sin(r), w2, h1, r)
+        assert np.isclose(intersection_area(b1, b2), area(intersect(b1, b2)), atol=1e-9)
+
+def test_rectangle_frame():
+    for _ in range(100):
+        xs, ys = np.random.rand(2) * 4, np.random.rand(2) * 4
+        ws, hs = np.random.rand(2) * 3 + 0.5, np.random.rand(2) * 3 + 0.5
+        rs = np.random.rand(2) * 2 * np.pi
+        b1 = poly2_from_xywhr(xs[0], ys[0], ws[0], hs[0], rs[0])
+        b2 = poly2_from_xywhr(xs[1], ys[1], ws[1], hs[1], rs[1])
+
+        bi_sh, xflags_sh = intersect_(b1, b2, SutherlandHodgeman)
+        bi_rf, xflags_rf = intersect_(b1, b2, RectangleFrame)
+        assert np.isclose(area(bi_sh), area(bi_rf))
+        assert xflags_sh == xflags_rf
+
+        # the flags are accepted by the gradient functions unchanged
+        if len(xflags_rf) > 2:
+            grad_p1, grad_p2 = iou_grad(b1, b2, 1., xflags_rf)
+            grad_q1, grad_q2 = iou_grad(b1, b2, 1., xflags_sh)
+            assert np.allclose([[v.x, v.y] for v in grad_p1.vertices], [[v.x, v.y] for v in grad_q1.vertices])
+
+def test_edge_chasing():
+    for _ in range(100):
+        xs, ys = np.random.rand(2) * 4, np.random.rand(2) * 4
+        ws, hs = np.random.rand(2) * 3 + 0.5, np.random.rand(2) * 3 + 0.5
+        rs = np.random.rand(2) * 2 * np.pi
+        b1 = poly2_from_xywhr(xs[0], ys[0], ws[0], hs[0], rs[0])
+        b2 = poly2_from_xywhr(xs[1], ys[1], ws[1], hs[1], rs[1])
+
+        bi_sh, xflags_sh = intersect_(b1, b2, SutherlandHodgeman)
+        bi_ec, xflags_ec = intersect_(b1, b2, EdgeChasing)
+        assert np.isclose(area(bi_sh), area(bi_ec))
+
+        if len(xflags_ec) > 2:
+            grad_p1, grad_p2 = iou_grad(b1, b2, 1., xflags_ec)
+            grad_q1, grad_q2 = iou_grad(b1, b2, 1., xflags_sh)
+            assert np.allclose([[v.x, v.y] for v in grad_p2.vertices], [[v.x, v.y] for v in grad_q2.vertices])
+
+    # degenerate cases fall back to Sutherland-Hodgeman
+    b1 = poly2_from_xywhr(0, 0, 2, 2, 0)
+    b2 = poly2_from_xywhr(1, 0, 2, 2, 0)
+    assert np.isclose(area(intersect_(b1, b1, EdgeChasing)[0]), 4)
+    assert np.isclose(area(intersect_(b1, b2, EdgeChasing)[0]), 2)
+
+def test_sector_overlap():
+    box = poly2_from_xywhr(0, 0, 2, 2, 0)
+    assert np.isclose(intersection_area(box, Circle2(Point2(0, 0), 10)), 4)
+    assert np.isclose(intersection_area(box, Circle2(Point2(0, 0), 0.5)), np.pi / 4)
+    assert np.isclose(intersection_area(box, Sector2(Point2(0, 0), 10, 0, np.pi / 4)), 1)
+    assert np.isclose(intersection_area(box, Sector2(Point2(0, 0), 0.5, 0, np.pi / 4)), np.pi / 16)
+    assert not intersects(box, Sector2(Point2(3, 0), 10, 0, np.pi / 4))
+    assert intersects(box, Sector2(Point2(3, 0), 10, np.pi, 0.1))
+
+    # the nearest point of the polygon is an acute vertex
+    tri = Quad2([Point2(2.578, -0.643), Point2(2.921, -2.743), Point2(-1.264, -1.099)])
+    assert not intersects(tri, Circle2(Point2(-1.979, -1.322), 0.724))
+    assert not intersects(tri, Sector2(Point2(-1.979, -1.322), 0.724, 0, np.pi))
+    assert intersects(tri, Circle2(Point2(-1.979, -1.322), 0.75))
+    for _ in range(200):
+        tri = [Point2(*(np.random.rand(2) * 6 - 3)) for _ in range(3)]
+        if sg.Polygon([(p.x, p.y) for p in tri]).exterior.is_ccw is False:
+            tri.reverse()
+        tri = Quad2(tri)
+        circle = Circle2(Point2(*(np.random.rand(2) * 6 - 3)), np.random.rand() * 1.5 + 0.01)
+        assert intersects(tri, circle) == (intersection_area(tri, circle) > 1e-12)
+
+    # compare with a polygonized sector
+    for _ in range(20):
+        box = poly2_from_xywhr(*(np.random.rand(2) * 4 - 2), *(np.random.rand(2) * 3 + 0.5), np.random.rand() * 6)
+        heading, half_angle, radius = np.random.rand() * 6, np.random.rand() * 1.5, np.random.rand() * 3 + 1
+        angles = np.linspace(heading - half_angle, heading + half_angle, 500)
+        sector = sg.Polygon([(0, 0)] + list(zip(radius * np.cos(angles), radius * np.sin(angles))))
+        target = sector.intersection(sg.Polygon([(p.x, p.y) for p in box.vertices])).area
+        assert np.isclose(intersection_area(box, Sector2(Point2(0, 0), radius, heading, half_angle)), target, atol=1e-3)
+
+    # gradient by finite difference
+    sector = Sector2(Point2(0.2, -0.1), 1.5, 0.3, 0.6)
+    box = poly2_from_xywhr(1, 0.5, 1.5, 1, 0.4)
+    grad_box, grad_sector = intersection_area_grad(box, sector, 1.)
+    base, h = intersection_area(box, sector), 1e-6
+    sector.radius += h
+    assert np.isclose((intersection_area(box, sector) - base) / h, grad_sector.radius, atol=1e-4)
+
+    boxes = [poly2_from_xywhr(x, 0, 1, 1, 0) for x in np.linspace(-3, 3, 7)]
+    areas = intersection_area_batch(boxes, sector)
+    assert np.allclose(areas, [intersection_area(b, sector) for b in boxes])
+    assert intersects_batch(boxes, sector) == [intersects(b, sector) for b in boxes]
+
+def test_ellipse():
+    e = Ellipse2(Point2(1, 2), 2, 1, 0.5)
+    assert np.isclose(area(e), 2 * np.pi)
+    assert e.contains(Point2(1, 2)) and not e.contains(Point2(4, 2))
+    assert np.isclose(intersection_area(poly2_from_xywhr(1, 2, 10, 10, 0), e), 2 * np.pi)
+
+    cov = ellipse2_from_covariance(0, 0, 4, 0, 1, 2)
+    assert np.isclose(cov.a, 4) and np.isclose(cov.b, 2) and np.isclose(cov.rotation, 0)
+
+    # compare with polygonized ellipses
+    def polygon(e, n=400):
+        t = np.linspace(0, 2 * np.pi, n, endpoint=False)
+        x, y = e.a * np.cos(t), e.b * np.sin(t)
+        c, s = np.cos(e.rotation), np.sin(e.rotation)
+        return sg.Polygon(zip(e.center.x + c * x - s * y, e.center.y + s * x + c * y))
+
+    for _ in range(20):
+        e1 = Ellipse2(Point2(*(np.random.rand(2) * 2)), *(np.random.rand(2) * 2 + 0.3), np.random.rand() * 6)
+        e2 = Ellipse2(Point2(*(np.random.rand(2) * 2)), *(np.random.rand(2) * 2 + 0.3), np.random.rand() * 6)
+        box = poly2_from_xywhr(*(np.random.rand(2) * 2), *(np.random.rand(2) * 2 + 0.3), np.random.rand() * 6)
+        target = polygon(e1).intersection(polygon(e2)).area
+        assert np.isclose(intersection_area(e1, e2), target, atol=1e-3)
+        target = polygon(e1).intersection(sg.Polygon([(p.x, p.y) for p in box.vertices])).area
+        assert np.isclose(intersection_area(box, e1), target, atol=1e-3)
+
+    # disjoint shapes whose nearest points are close to a vertex of the (sheared) box
+    e = Ellipse2(Point2(0, 0), 2.1, 0.3, 4.3)
+    box = poly2_from_xywhr(2.5, 1.6, 0.6, 1, 1.5)
+    assert not intersects(box, e) and intersection_area(box, e) == 0
+    for _ in range(400):
+        e = Ellipse2(Point2(*(np.random.rand(2) * 4)), *(np.random.rand(2) * 2 + 0.2), np.random.rand() * 6)
+        box = poly2_from_xywhr(*(np.random.rand(2) * 4), *(np.random.rand(2) * 2 + 0.3), np.random.rand() * 6)
+        assert intersects(box, e) == (intersection_area(box, e) > 1e-12)
+
+    # gradient by finite difference
+    e1, e2 = Ellipse2(Point2(0, 0), 2, 1, 0.2), Ellipse2(Point2(1, 0.5), 1, 1.5, 0.7)
+    grad_e1, grad_e2 = iou_grad(e1, e2, 1.)
+    base, h = iou(e1, e2), 1e-6
+    e2.rotation += h
+    assert np.isclose((iou(e1, e2) - base) / h, grad_e2.rotation, atol=1e-4)
+    assert np.allclose(iou_batch([e1, e2], [e2, e1]), [iou(e1, e2)] * 2)
+
+def test_partition():
+    grid = TileGrid(Point2(0, 0), 2, 3)
+    box = poly2_from_xywhr(3, 4, 5, 4, 0.3)
+    pieces = partition(box, grid)
+    assert np.isclose(sum(area(p.polygon) for p in pieces), area(box))
+
+    for p in pieces:
+        tile = poly2_from_aabox2(grid.cell(p.tile_x, p.tile_y))
+        assert np.isclose(area(p.polygon), area(intersect(box, tile)))
+        assert len(p.xflags) == p.polygon.nvertices
+
+    boxes = [poly2_from_xywhr(x, x, 3, 2, x) for x in np.linspace(0, 10, 5)]
+    pieces = partition_batch(boxes, grid)
+    assert np.isclose(sum(area(p.polygon) for p in pieces), sum(area(b) for b in boxes))
+    tiles = [(p.tile_x, p.tile_y) for p in pieces]
+    assert tiles == sorted(tiles)
+
+def test_sharding(tmp_path):
+    rng = np.random.RandomState(0)
+    boxes1 = [poly2_from_xywhr(x, y, 3, 2, r) for x, y, r in rng.rand(200, 3) * [40, 40, 3]]
+    boxes2 = [poly2_from_xywhr(x, y, 2, 2, r) for x, y, r in rng.rand(200, 3) * [40, 40, 3]]
+    grid = TileGrid(Point2(0, 0), 7, 9)
+    expected = iou_sparse(boxes1, boxes2)
+    pairs = iou_sparse_sharded(boxes1, boxes2, grid, str(tmp_path / "job"), nprocs=2)
+    assert [(i, j) for i, j, _ in pairs] == [(i, j) for i, j, _ in expected]
+    assert np.allclose([v for _, _, v in pairs], [v for _, _, v in expected])
+
+    # run the steps separately, the shards without results are finished when merging
+    directory = str(tmp_path / "steps")
+    assert write_shards(directory, boxes1, boxes2, grid, 0.1)
+    assert run_shard_worker(directory)
+    merged = merge_shards(directory)
+    assert [(i, j) for i, j, _ in merged] == [(i, j) for i, j, v in expected if v > 0.1]
+    assert write_shards(directory, boxes1, boxes2, grid)
+    assert merge_shards(directory) == pairs
+
+def test_pair_cache():
+    boxes1 = [poly2_from_xywhr(0, 0, 4, 2, 0.1), poly2_from_xywhr(10, 0, 2, 2, 0)]
+    boxes2 = [poly2_from_xywhr(0.5, 0, 4, 2, 0.2), poly2_from_xywhr(10, 1, 2, 2, 0.3)]
+    keys = [PairKey(0, 0, 0, 0), PairKey(1, 0, 1, 0)]
+    cache = PairCache(64)
+    expected = iou_batch_(boxes1, boxes2)
+
+    ious, xflags, nhits = iou_batch_cached(cache, keys, boxes1, boxes2)
+    assert nhits == 0
+    assert np.allclose(ious, expected[0]) and xflags == expected[1]
+    cache.next_frame()
+    ious, xflags, nhits = iou_batch_cached(cache, keys, boxes1, boxes2)
+    assert nhits == 2
+    assert np.allclose(ious, expected[0]) and xflags == expected[1]
+
+    # the cached result of an old version is not used
+    boxes2[1] = poly2_from_xywhr(10, 0.5, 2, 2, 0.3)
+    keys[1].version2 += 1
+    ious, _, nhits = iou_batch_cached(cache, keys, boxes1, boxes2)
+    assert nhits == 1
+    assert np.isclose(ious[1], iou(boxes1[1], boxes2[1]))
+
+def test_canonicalize():
+    # clockwise square with a duplicate and a collinear vertex
+    p = Poly28([Point2(0, 0), Point2(0, 1), Point2(0, 1 + 1e-9), Point2(1, 1), Point2(1, 0), Point2(0.5, 0)])
+    p, status = canonicalize(p)
+    assert status == PolyStatus.Reversed | PolyStatus.DuplicatesRemoved | PolyStatus.CollinearRemoved
+    assert p.nvertices == 4 and np.isclose(area(p), 1)
+
+    star = Poly28([Point2(np.cos(a), np.sin(a)) for a in np.arange(5) * 4 * np.pi / 5])
+    concave = Poly28([Point2(0, 0), Point2(2, 0), Point2(1, 0.3), Point2(1, 2)])
+    line = Poly28([Point2(0, 0), Point2(1, 1), Point2(2, 2)])
+    box = poly2_from_xywhr(1, 2, 3, 4, 0.5)
+    polys, status = canonicalize_batch([star, concave, line, Poly28(box.vertices)])
+    assert status[0] & PolyStatus.NonConvex and status[1] & PolyStatus.NonConvex
+    assert status[2] & PolyStatus.Degenerate
+    assert status[3] == PolyStatus.Ok and np.isclose(area(polys[3]), 12)
+
+def test_pair_status():
+    a = poly2_from_xywhr(0, 0, 2, 2, 0)
+    flat = poly2_from_xywhr(0, 0, 0, 0, 0)
+    boxes1 = [a, a, a, flat]
+    boxes2 = [poly2_from_xywhr(0.5, 0.5, 2, 2, 0.3), poly2_from_xywhr(10, 0, 2, 2, 0),
+              poly2_from_xywhr(2, 0, 2, 2, 0), a]
+    ious, _, status = iou_batch_status(boxes1, boxes2)
+    assert status[0] == PairStatus.Ok and np.isclose(ious[0], iou(boxes1[0], boxes2[0]))
+    assert status[1] == PairStatus.Empty and ious[1] == 0
+    assert status[2] == PairStatus.FallbackUsed and ious[2] == 0
+    assert status[3] == PairStatus.Degenerate and ious[3] == 0
+
+    square = [Point2(0, 0), Point2(1, 0), Point2(1, 1), Point2(0, 1)]
+    shifted = [Point2(p.x + 0.5, p.y + 0.25) for p in square]
+    ragged = RaggedPoly2([[], square, [Point2(0, 0), Point2(1, 1)], shifted])
+    ious, status = iou_pairs_status(ragged, ragged, [(3, 1), (0, 1), (2, 1)])
+    assert np.isclose(ious[0], 0.375 / 1.625) and status[0] == PairStatus.Ok
+    assert ious[1] == 0 and status[1] == PairStatus.Degenerate
+    assert ious[2] == 0 and status[2] == PairStatus.Degenerate
+    assert iou_pairs(ragged, ragged, [(0, 1), (2, 1)]) == [0, 0]
+
+def test_polygon_store(tmp_path):
+    def ngon(x, y, r, k):
+        return [Point2(x + r * np.cos(a), y + r * np.sin(a)) for a in np.linspace(0, 2 * np.pi, k, endpoint=False)]
+    polys = [ngon(0, 0, 1, 4), ngon(1, 0, 1, 7), ngon(0.5, 0.5, 2, 20), ngon(10, 10, 1, 5)]
+    ragged = RaggedPoly2(polys)
+    path = str(tmp_path / "map.store")
+    assert write_polygon_store(path, ragged, [100, 101, 102, 103])
+
+    store = MappedPolygonStore(path)
+    assert store.is_open and len(store) == 4 and store.id(2) == 102
+    assert store.nvertices(2) == 20 and store.polygon(1)[3].x == polys[1][3].x
+    assert np.allclose(area_batch(store), area_batch(ragged))
+    assert np.allclose(iou_pairs(store, store, [(0, 1), (1, 2)]), iou_pairs(ragged, ragged, [(0, 1), (1, 2)]))
+    assert iou_sparse(ragged, store, 0.1) == iou_sparse(ragged, ragged, 0.1)
+
+    hits = find_containing(store, [Point2(0.1, 0.1), Point2(10, 10.5), Point2(50, 50)])
+    assert (0, 0) in hits and (0, 2) in hits and (1, 3) in hits
+    assert all(i != 2 for i, _ in hits)
+    assert not MappedPolygonStore(str(tmp_path / "missing.store")).is_open
+
+    ragged.push_back([])
+    assert write_polygon_store(path, ragged, [])
+    assert MappedPolygonStore(path).is_open and area_batch(MappedPolygonStore(path))[4] == 0
+    with open(path, "r+b") as f: # corrupt npolys in the header
+        f.seek(16)
+        f.write(np.uint64(1 << 40).tobytes())
+    assert not MappedPolygonStore(path).is_open
+
+def test_packed_flags():
+    boxes1 = [poly2_from_xywhr(0, 0, 4, 2, 0.1), poly2_from_xywhr(5, 5, 2, 2, 1), poly2_from_xywhr(0, 0, 1, 1, 0)]
+    boxes2 = [poly2_from_xywhr(0.6, -0.1, 4, 2, 0.2), poly2_from_xywhr(5.5, 5, 2, 3, 0.3), poly2_from_xywhr(9, 9, 1, 1, 0)]
+    coords = lambda p: [(v.x, v.y) for v in p.vertices]
+    grads = [1, 0.5, 2]
+
+    ious, xflags = iou_batch_(boxes1, boxes2)
+    packed_ious, state = iou_batch_packed(boxes1, boxes2)
+    assert packed_ious == ious and state[2] == 0xffffffff
+    expected, _ = iou_batch_grad(boxes1, boxes2, grads, xflags)
+    grad_p1, _ = iou_batch_grad_packed(boxes1, boxes2, grads, state)
+    assert all(coords(a) == coords(b) for a, b in zip(grad_p1, expected))
+
+    gious, state = giou_batch_packed(boxes1, boxes2)
+    assert np.allclose(gious, [giou(b1, b2) for b1, b2 in zip(boxes1, boxes2)])
+    grad_p1, grad_p2 = giou_batch_grad_packed(boxes1, boxes2, grads, state)
+    for k in range(3):
+        _, xf, mf = giou_(boxes1[k], boxes2[k])
+        g1, g2 = giou_grad(boxes1[k], boxes2[k], grads[k], xf, mf)
+        assert coords(grad_p1[k]) == coords(g1) and coords(grad_p2[k]) == coords(g2)
+
+    dious, state = diou_batch_packed(boxes1, boxes2)
+    assert np.allclose(dious, [diou(b1, b2) for b1, b2 in zip(boxes1, boxes2)])
+    grad_p1, _ = diou_batch_grad_packed(boxes1, boxes2, grads, state)
+    assert all(np.isfinite(coords(g)).all() for g in grad_p1)
+
+def test_moments():
+    box = poly2_from_xywhr(100, -50, 4, 2, 0.3)
+    m = moments(box)
+    c, s = np.cos(0.3), np.sin(0.3)
+    cov = np.array([[c, -s], [s, c]]) @ np.diag([16 / 12, 4 / 12]) @ np.array([[c, s], [-s, c]])
+    assert np.isclose(m.area, 8) and np.isclose(m.centroid.x, 100) and np.isclose(m.centroid.y, -50)
+    assert np.allclose([m.cxx, m.cxy, m.cyy], [cov[0, 0], cov[0, 1], cov[1, 1]])
+
+    poly = Poly28([Point2(0, 0), Point2(3, 0), Point2(4, 2), Point2(1, 3)])
+    shape = sg.Polygon([(p.x, p.y) for p in poly.vertices])
+    m = moments_batch([poly])[0]
+    assert np.isclose(m.area, shape.area)
+    assert np.isclose(m.centroid.x, shape.centroid.x) and np.isclose(m.centroid.y, shape.centroid.y)
+
+    grad = Moments2()
+    grad.area, grad.cxx, grad.cxy = 0.5, 1, -2
+    grad.centroid = Point2(0.3, 0.7)
+    loss = lambda m: 0.5 * m.area + 0.3 * m.centroid.x + 0.7 * m.centroid.y + m.cxx - 2 * m.cxy
+    grad_poly = moments_batch_grad([poly], [grad])[0]
+    eps = 1e-6
+    for i in range(4):
+        shifted = [Point2(p.x + eps * (k == i), p.y) for k, p in enumerate(poly.vertices)]
+        numeric = (loss(moments(Poly28(shifted))) - loss(m)) / eps
+        assert np.isclose(numeric, grad_poly.vertices[i].x, atol=1e-4)
+
+def test_boundary_distances():
+    p1 = Poly28([Point2(0, 0), Point2(2, 0), Point2(2, 2), Point2(0, 2)])
+    p2 = Poly28([Point2(1.2, 0.7), Point2(4, 1), Point2(4.2, 3.1), Point2(0.9, 2.6)])
+    shape1 = sg.Polygon([(p.x, p.y) for p in p1.vertices]).exterior
+    shape2 = sg.Polygon([(p.x, p.y) for p in p2.vertices]).exterior
+    d12 = [shape2.distance(sg.Point(p.x, p.y)) for p in p1.vertices]
+    d21 = [shape1.distance(sg.Point(p.x, p.y)) for p in p2.vertices]
+    assert np.isclose(hausdorff_distance(p1, p2), max(d12 + d21))
+    assert np.isclose(chamfer_distance(p1, p2), np.mean(d12) + np.mean(d21))
+
+    distances, hflags = hausdorff_distance_batch([p1, p1], [p2, p1])
+    assert np.isclose(distances[0], hausdorff_distance(p1, p2)) and distances[1] == 0
+    chamfers, cflags = chamfer_distance_batch([p1], [p2])
+    assert np.isclose(chamfers[0], chamfer_distance(p1, p2)) and len(cflags[0]) == 8
+
+    eps = 1e-6
+    grad_h, _ = hausdorff_distance_batch_grad([p1], [p2], [1], hflags[:2])
+    grad_c, _ = chamfer_distance_batch_grad([p1], [p2], [1], cflags)
+    for i in range(4):
+        shifted = Poly28([Point2(p.x, p.y + eps * (k == i)) for k, p in enumerate(p1.vertices)])
+        numeric = (hausdorff_distance(shifted, p2) - distances[0]) / eps
+        assert np.isclose(numeric, grad_h[0].vertices[i].y, atol=1e-4)
+        numeric = (chamfer_distance(shifted, p2) - chamfers[0]) / eps
+        assert np.isclose(numeric, grad_c[0].vertices[i].y, atol=1e-4)
+
 class TestWithShapely:
     def genboxes(self):
         # randomly generate boxes in [-5, 5] range
@@ -0,0 +1,283 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains the partition of convex polygons across the cells (tiles) of a regular grid.
+ *
+ * Instead of intersecting the polygon with every overlapped tile, each polygon is cut once per grid line: first
+ * by the vertical lines bounding a tile column, then swept upward by the horizontal lines inside the column, where
+ * each cut splits the remaining part into the finished tile piece and the rest. A crossing of a polygon edge with
+ * a grid line is always interpolated from the original edge and snapped onto the line, so neighboring tiles get
+ * bitwise identical vertices along their shared cut edges (the pieces are watertight).
+ *
+ * Each piece records its source polygon, its tile and an xflags array in the same format as
+ * intersect(poly, poly2_from_aabox2(grid.cell(tile_x, tile_y)), xflags), so intersect_grad applies directly.
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_TILING_HPP
+#define DGAL_TILING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "dgal/geometry.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+template <typename scalar_t> struct TileGrid // Regular grid with cells [x0 + i*w, x0 + (i+1)*w) x [y0 + j*h, y0 + (j+1)*h)
+{
+    // contract: cell_width > 0, cell_height > 0
+    Point2<scalar_t> origin;
+    scalar_t cell_width = 1, cell_height = 1;
+
+    inline int32_t column(const scalar_t &x) const { return (int32_t)std::floor((x - origin.x) / cell_width); }
+    inline int32_t row(const scalar_t &y) const { return (int32_t)std::floor((y - origin.y) / cell_height); }
+    inline scalar_t line_x(const int32_t &i) const { return origin.x + i * cell_width; }
+    inline scalar_t line_y(const int32_t &j) const { return origin.y + j * cell_height; }
+
+    inline AABox2<scalar_t> cell(const int32_t &i, const int32_t &j) const
+    {
+        return {.min_x = line_x(i), .max_x = line_x(i + 1), .min_y = line_y(j), .max_y = line_y(j + 1)};
+    }
+};
+
+template <typename scalar_t, uint8_t MaxPoints> struct TilePiece // Part of a polygon inside a tile
+{
+    int32_t tile_x = 0, tile_y = 0;
+    uint32_t source = 0; // index of the source polygon
+    Poly2<scalar_t, MaxPoints + 4> polygon;
+
+    // provenance of the edge starting at each vertex: (idx << 1 | 1) for edge idx of the source polygon,
+    // (side << 1) for the tile border (0 bottom, 1 right, 2 top, 3 left)
+    uint8_t xflags[MaxPoints + 4];
+};
+
+// Polygon being cut, with the flags of the outgoing edges
+template <typename scalar_t, uint8_t MaxPoints> struct _TileWorkPoly
+{
+    Poly2<scalar_t, MaxPoints + 4> polygon;
+    uint8_t xflags[MaxPoints + 4];
+};
+
+// Crossing of the edge starting at vertex i of the working polygon with grid line (axis = value),
+// axis 0 is a vertical line x = value and axis 1 is a horizontal line y = value
+template <typename scalar_t, uint8_t MaxPoints> inline
+Point2<scalar_t> _tile_crossing(const Poly2<scalar_t, MaxPoints> &source, const _TileWorkPoly<scalar_t, MaxPoints> &w,
+    const uint8_t i, const uint8_t axis, const scalar_t &value)
+{
+    Point2<scalar_t> result;
+    uint8_t flag = w.xflags[i];
+    if (flag & 1) // original edge, always interpolated in its own direction
+    {
+        const Point2<scalar_t> &a = source.vertices[flag >> 1];
+        const Point2<scalar_t> &b = source.vertices[_mod_inc<uint8_t>(flag >> 1, source.nvertices)];
+        if (axis == 0)
+        {
+            result.x = value;
+            result.y = a.y + (b.y - a.y) * ((value - a.x) / (b.x - a.x));
+        }
+        else
+        {
+            result.x = a.x + (b.x - a.x) * ((value - a.y) / (b.y - a.y));
+            result.y = value;
+        }
+    }
+    else // border of the tile, which is perpendicular to the line
+    {
+        const Point2<scalar_t> &a = w.polygon.vertices[i];
+        result.x = axis == 0 ? value : a.x;
+        result.y = axis == 0 ? a.y : value;
+    }
+    return result;
+}
+
+// Split the working polygon by a grid line into the parts below (coordinate <= value) and above
+template <typename scalar_t, uint8_t MaxPoints> inline
+void _tile_split(const Poly2<scalar_t, MaxPoints> &source, const _TileWorkPoly<scalar_t, MaxPoints> &w,
+    const uint8_t axis, const scalar_t &value, _TileWorkPoly<scalar_t, MaxPoints> &below,
+    _TileWorkPoly<scalar_t, MaxPoints> &above)
+{
+    // the sides of the cut edge w.r.t. the two parts
+    const uint8_t side_below = axis == 0 ? 1 : 2, side_above = axis == 0 ? 3 : 0;
+    uint8_t nb = 0, na = 0, n = w.polygon.nvertices;
+    for (uint8_t i = 0; i < n; i++)
+    {
+        uint8_t inext = _mod_inc(i, n);
+        const Point2<scalar_t> &p = w.polygon.vertices[i], &q = w.polygon.vertices[inext];
+        scalar_t d = (axis == 0 ? p.x : p.y) - value, dnext = (axis == 0 ? q.x : q.y) - value;
+
+        if (d <= 0)
+        {
+            below.polygon.vertices[nb] = p;
+            below.xflags[nb++] = w.xflags[i];
+        }
+        if (d >= 0)
+        {
+            above.polygon.vertices[na] = p;
+            above.xflags[na++] = w.xflags[i];
+        }
+
+        if ((d < 0 && dnext > 0) || (d > 0 && dnext < 0))
+        {
+            Point2<scalar_t> x = _tile_crossing(source, w, i, axis, value);
+            below.polygon.vertices[nb] = x;
+            above.polygon.vertices[na] = x;
+            if (d < 0) // leaving the lower part
+            {
+                below.xflags[nb++] = side_below << 1;
+                above.xflags[na++] = w.xflags[i];
+            }
+            else
+            {
+                below.xflags[nb++] = w.xflags[i];
+                above.xflags[na++] = side_above << 1;
+            }
+        }
+        else if (d == 0) // the vertex lies on the line, the outgoing edge may follow the line
+        {
+            if (dnext > 0) below.xflags[nb-1] = side_below << 1;
+            if (dnext < 0) above.xflags[na-1] = side_above << 1;
+        }
+    }
+    below.polygon.nvertices = nb;
+    above.polygon.nvertices = na;
+}
+
+// A valid piece has positive area
+template <typename scalar_t, uint8_t MaxPoints> inline
+bool _tile_piece_valid(const _TileWorkPoly<scalar_t, MaxPoints> &w)
+{
+    return w.polygon.nvertices >= 3 && area(w.polygon) > 0;
+}
+
+// Partition the polygon inside tile column i, the pieces are appended in ascending rows
+template <typename scalar_t, uint8_t MaxPoints> inline
+void _partition_column(const Poly2<scalar_t, MaxPoints> &p, const TileGrid<scalar_t> &grid, const int32_t i,
+    const uint32_t source, std::vector<TilePiece<scalar_t, MaxPoints>> &pieces)
+{
+    _TileWorkPoly<scalar_t, MaxPoints> rest, below, above;
+    rest.polygon = p;
+    for (uint8_t k = 0; k < p.nvertices; k++)
+        rest.xflags[k] = k << 1 | 1;
+
+    // cut by the lines bounding the column
+    _tile_split(p, rest, 0, grid.line_x(i), below, above);
+    rest = above;
+    _tile_split(p, rest, 0, grid.line_x(i + 1), below, above);
+    rest = below;
+    if (!_tile_piece_valid(rest))
+        return;
+
+    // sweep upward by the horizontal lines
+    AABox2<scalar_t> box = aabox2_from_poly2(rest.polygon);
+    int32_t jmin = grid.row(box.min_y), jmax = grid.row(box.max_y);
+    for (int32_t j = jmin; j <= jmax; j++)
+    {
+        if (j < jmax)
+        {
+            _tile_split(p, rest, 1, grid.line_y(j + 1), below, above);
+            rest = above;
+        }
+        else
+            below = rest;
+
+        if (!_tile_piece_valid(below))
+            continue;
+        TilePiece<scalar_t, MaxPoints> piece;
+        piece.tile_x = i; piece.tile_y = j; piece.source = source;
+        piece.polygon = below.polygon;
+        std::copy(below.xflags, below.xflags + below.polygon.nvertices, piece.xflags);
+        pieces.push_back(piece);
+    }
+}
+
+// Partition a polygon across the tile grid, the pieces are appended in ascending columns and rows
+template <typename scalar_t, uint8_t MaxPoints> inline
+void partition(const Poly2<scalar_t, MaxPoints> &p, const TileGrid<scalar_t> &grid,
+    std::vector<TilePiece<scalar_t, MaxPoints>> &pieces, const uint32_t source = 0)
+{
+    if (p.nvertices < 3)
+        return;
+    AABox2<scalar_t> box = aabox2_from_poly2(p);
+    for (int32_t i = grid.column(box.min_x); i <= grid.column(box.max_x); i++)
+        _partition_column(p, grid, i, source, pieces);
+}
+
+// Partition n polygons across the tile grid in parallel over the tile columns. The pieces are ordered by
+// tile (column, then row) and then by source polygon, which is independent of the number of threads.
+template <typename scalar_t, uint8_t MaxPoints> inline
+void partition_batch(const Poly2<scalar_t, MaxPoints> *polys, size_t n, const TileGrid<scalar_t> &grid,
+    std::vector<TilePiece<scalar_t, MaxPoints>> &pieces)
+{
+    pieces.clear();
+    if (n == 0)
+        return;
+
+    // assign the polygons to the columns they overlap
+    std::vector<int32_t> cmin(n), cmax(n);
+    int32_t lo = std::numeric_limits<int32_t>::max(), hi = std::numeric_limits<int32_t>::min();
+    for (size_t k = 0; k < n; k++)
+    {
+        if (polys[k].nvertices < 3) { cmin[k] = 0; cmax[k] = -1; continue; }
+        AABox2<scalar_t> box = aabox2_from_poly2(polys[k]);
+        cmin[k] = grid.column(box.min_x); cmax[k] = grid.column(box.max_x);
+        lo = std::min(lo, cmin[k]); hi = std::max(hi, cmax[k]);
+    }
+    if (lo > hi)
+        return;
+
+    size_t ncolumns = size_t(hi - lo) + 1;
+    std::vector<size_t> offsets(ncolumns + 1, 0);
+    for (size_t k = 0; k < n; k++)
+        for (int32_t i = cmin[k]; i <= cmax[k]; i++)
+            offsets[i - lo + 1]++;
+    for (size_t c = 0; c < ncolumns; c++)
+        offsets[c + 1] += offsets[c];
+    std::vector<uint32_t> members(offsets[ncolumns]);
+    std::vector<size_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t k = 0; k < n; k++)
+        for (int32_t i = cmin[k]; i <= cmax[k]; i++)
+            members[cursor[i - lo]++] = k;
+
+    // partition each column independently, then order the pieces by row
+    std::vector<std::vector<TilePiece<scalar_t, MaxPoints>>> columns(ncolumns);
+    parallel_for(0, ncolumns, [&](size_t c) {
+        std::vector<TilePiece<scalar_t, MaxPoints>> &out = columns[c];
+        for (size_t m = offsets[c]; m < offsets[c + 1]; m++)
+            _partition_column(polys[members[m]], grid, lo + int32_t(c), members[m], out);
+        std::stable_sort(out.begin(), out.end(), [](const TilePiece<scalar_t, MaxPoints> &l,
+            const TilePiece<scalar_t, MaxPoints> &r) { return l.tile_y < r.tile_y; });
+    });
+
+    size_t total = 0;
+    for (const auto &out : columns)
+        total += out.size();
+    pieces.reserve(total);
+    for (auto &out : columns)
+        pieces.insert(pieces.end(), out.begin(), out.end());
+}
+
+} // namespace dgal
+
+#endif // DGAL_TILING_HPP
@@ -0,0 +1,298 @@
+// Copyright (c) 2020 Jacob Zhong
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+
+/*
+ * This file contains visibility calculation of a set of convex polygons from a viewpoint, by an angular sweep
+ * over the edges facing the viewpoint. The edges are split into elementary angular intervals by their end
+ * points and by the crossings of the edges (only edges of overlapping polygons can cross), and the nearest edge
+ * in each interval is the visible one. The active edges are kept ordered by their distance along the sweeping ray
+ * and adjacent edges are swapped where they cross, so the sweep takes O((n + c) log n) for n edges with c crossings.
+ *
+ * Outputs:
+ *      .fractions: fraction of the angular extent of each polygon that is not occluded by other polygons
+ *      .polygon: the (star-shaped, generally not convex) visibility polygon around the viewpoint,
+ *          where rays that hit nothing are clipped at the given range. The range only applies to the polygon,
+ *          polygons beyond it still occlude each other and get their visible fractions
+ *
+ * Polygons containing the viewpoint are not considered as occluders and get a visible fraction of 1.
+ *
+ * Note that the functions in this file are only available in CPU.
+ */
+
+#ifndef DGAL_VISIBILITY_HPP
+#define DGAL_VISIBILITY_HPP
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <set>
+#include <vector>
+#include "dgal/geometry.hpp"
+#include "dgal/parallel.hpp"
+
+namespace dgal {
+
+// Edge facing the viewpoint, with vertices relative to the viewpoint
+template <typename scalar_t> struct _VisibleEdge
+{
+    Point2<scalar_t> a, b;
+    scalar_t angle_a, angle_b; // contract: angle_a < angle_b
+    uint32_t owner;
+};
+
+// distance from the viewpoint to the edge along a ray with given direction
+template <typename scalar_t> CUDA_CALLABLE_MEMBER inline
+scalar_t _ray_distance(const _VisibleEdge<scalar_t> &e, const scalar_t &dx, const scalar_t &dy)
+{
+    scalar_t ex = e.b.x - e.a.x, ey = e.b.y - e.a.y;
+    return (ex * e.a.y - ey * e.a.x) / (ex * dy - ey * dx);
+}
+
+// Order of the active edges by the distance along the current ray (ray[0], ray[1]). Distances equal up to the
+// rounding errors (edges starting from the same vertex) are compared along a ray slightly ahead (ray[2], ray[3]).
+// The edge in a slot is mutable so that two adjacent edges can be swapped at their crossing without rebuilding the set
+template <typename scalar_t> struct _ActiveEdge
+{
+    mutable const _VisibleEdge<scalar_t> *edge;
+};
+
+template <typename scalar_t> struct _ActiveEdgeLess
+{
+    const scalar_t *ray;
+
+    bool operator()(const _ActiveEdge<scalar_t> &l, const _ActiveEdge<scalar_t> &r) const
+    {
+        scalar_t dl = _ray_distance(*l.edge, ray[0], ray[1]), dr = _ray_distance(*r.edge, ray[0], ray[1]);
+        if (abs(dl - dr) > sqrt(Numeric<scalar_t>::eps()) * _max(dl, dr))
+            return dl < dr;
+        return _ray_distance(*l.edge, ray[2], ray[3]) < _ray_distance(*r.edge, ray[2], ray[3]);
+    }
+};
+
+// angle where edge u (nearer before) crosses edge v, return false if they don't cross in (from, the end of both)
+template <typename scalar_t> inline
+bool _edge_crossing(const _VisibleEdge<scalar_t> &u, const _VisibleEdge<scalar_t> &v, const scalar_t &from,
+    scalar_t &angle)
+{
+    scalar_t ux = u.b.x - u.a.x, uy = u.b.y - u.a.y, vx = v.b.x - v.a.x, vy = v.b.y - v.a.y;
+    scalar_t denom = ux * vy - uy * vx;
+    if (denom == 0) return false; // parallel
+    scalar_t wx = v.a.x - u.a.x, wy = v.a.y - u.a.y;
+    scalar_t s = (wx * vy - wy * vx) / denom, t = (wx * uy - wy * ux) / denom;
+    if (s <= 0 || s >= 1 || t <= 0 || t >= 1) return false;
+    angle = atan2(u.a.y + s * uy, u.a.x + s * ux);
+    return angle > from && angle < _min(u.angle_b, v.angle_b);
+}
+
+// Calculate visible fractions of the polygons, the visibility polygon is generated if polygon is not null
+template <typename scalar_t, uint8_t MaxPoints> inline
+void visibility(const Poly2<scalar_t, MaxPoints> *polys, size_t n, const Point2<scalar_t> &viewpoint,
+    scalar_t *fractions, std::vector<Point2<scalar_t>> *polygon = nullptr,
+    const scalar_t &max_range = std::numeric_limits<scalar_t>::max())
+{
+    // collect the edges facing the viewpoint, edges crossing the angle of pi are split into two
+    std::vector<_VisibleEdge<scalar_t>> edges;
+    std::vector<scalar_t> extent(n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        fractions[i] = 1;
+        if (polys[i].contains(viewpoint)) continue;
+
+        const Poly2<scalar_t, MaxPoints> &p = polys[i];
+        for (uint8_t j = 0; j < p.nvertices; j++)
+        {
+            const Point2<scalar_t> &va = p.vertices[j], &vb = p.vertices[_mod_inc(j, p.nvertices)];
+            if (_cross(va, vb, viewpoint) >= 0) continue; // back edge
+
+            // facing edges are clockwise when seen from the viewpoint
+            Point2<scalar_t> a {.x = vb.x - viewpoint.x, .y = vb.y - viewpoint.y};
+            Point2<scalar_t> b {.x = va.x - viewpoint.x, .y = va.y - viewpoint.y};
+            scalar_t ta = atan2(a.y, a.x), tb = atan2(b.y, b.x);
+            if (ta <= tb)
+                edges.push_back({a, b, ta, tb, (uint32_t)i});
+            else
+            {
+                edges.push_back({a, b, ta, scalar_t(_pi), (uint32_t)i});
+                edges.push_back({a, b, scalar_t(-_pi), tb, (uint32_t)i});
+            }
+            extent[i] += (ta <= tb) ? (tb - ta) : (tb - ta + 2 * _pi);
+        }
+    }
+
+    // elementary intervals
+    std::vector<scalar_t> events;
+    events.reserve(edges.size() * 2 + 2);
+    events.push_back(-_pi);
+    events.push_back(_pi);
+    for (const auto &e : edges)
+    {
+        events.push_back(e.angle_a);
+        events.push_back(e.angle_b);
+    }
+    std::sort(events.begin(), events.end());
+    events.erase(std::unique(events.begin(), events.end()), events.end());
+    std::sort(edges.begin(), edges.end(), [](const _VisibleEdge<scalar_t> &l, const _VisibleEdge<scalar_t> &r) {
+        return l.angle_a < r.angle_a;
+    });
+
+    std::vector<uint32_t> by_end(edges.size());
+    std::iota(by_end.begin(), by_end.end(), 0);
+    std::sort(by_end.begin(), by_end.end(), [&](uint32_t l, uint32_t r) {
+        return edges[l].angle_b < edges[r].angle_b;
+    });
+
+    // the active edges ordered along the current ray, and the crossings of adjacent edges ahead of it
+    typedef std::multiset<_ActiveEdge<scalar_t>, _ActiveEdgeLess<scalar_t>> ActiveSet;
+    typedef std::pair<scalar_t, std::pair<uint32_t, uint32_t>> Crossing; // (angle, (nearer edge, farther edge))
+    scalar_t ray[4] = {-1, 0, -1, 0};
+    ActiveSet active(_ActiveEdgeLess<scalar_t> {ray});
+    std::vector<typename ActiveSet::iterator> slots(edges.size(), active.end());
+    std::priority_queue<Crossing, std::vector<Crossing>, std::greater<Crossing>> crossings;
+    const auto index = [&](typename ActiveSet::iterator it) { return uint32_t(it->edge - edges.data()); };
+    const auto check_crossing = [&](typename ActiveSet::iterator it, const scalar_t &from) {
+        // check the slot and the one after it
+        if (it == active.end() || std::next(it) == active.end()) return;
+        scalar_t angle;
+        if (_edge_crossing(*it->edge, *std::next(it)->edge, from, angle))
+            crossings.push({angle, {index(it), index(std::next(it))}});
+    };
+    const auto swap_crossed = [&](const scalar_t &angle) { // swap the adjacent edges crossing up to the angle
+        while (!crossings.empty() && crossings.top().first <= angle)
+        {
+            Crossing c = crossings.top();
+            crossings.pop();
+            auto it = slots[c.second.first];
+            if (it == active.end() || std::next(it) == active.end() || std::next(it) != slots[c.second.second])
+                continue; // outdated
+            auto it_next = std::next(it);
+            std::swap(it->edge, it_next->edge);
+            std::swap(slots[c.second.first], slots[c.second.second]);
+            if (it != active.begin())
+                check_crossing(std::prev(it), c.first);
+            check_crossing(it_next, c.first);
+        }
+    };
+
+    std::vector<scalar_t> visible(n, 0);
+    const _VisibleEdge<scalar_t> *last = nullptr;
+    size_t next_edge = 0, next_end = 0;
+    if (polygon != nullptr) polygon->clear();
+
+    const auto emit = [&](const _VisibleEdge<scalar_t> *e, const scalar_t &angle, bool extend)
+    {
+        scalar_t dx = cos(angle), dy = sin(angle);
+        scalar_t d = (e == nullptr) ? max_range : _min(_ray_distance(*e, dx, dy), max_range);
+        Point2<scalar_t> p {.x = viewpoint.x + d * dx, .y = viewpoint.y + d * dy};
+        if (extend) polygon->back() = p;
+        else polygon->push_back(p);
+    };
+
+    // the nearest edge doesn't change in the interval
+    const auto visit = [&](const scalar_t &lo, const scalar_t &hi)
+    {
+        const _VisibleEdge<scalar_t> *nearest = active.empty() ? nullptr : active.begin()->edge;
+        if (nearest != nullptr)
+        {
+            visible[nearest->owner] += hi - lo;
+            scalar_t mid = (lo + hi) / 2;
+            if (_ray_distance(*nearest, cos(mid), sin(mid)) >= max_range)
+                nearest = nullptr; // show the range in the polygon
+        }
+
+        if (polygon == nullptr) return;
+        if (nearest == nullptr) // approximate the range arc
+        {
+            size_t nsteps = size_t((hi - lo) / (_pi / 16)) + 1;
+            if (last != nullptr || polygon->empty()) emit(nullptr, lo, false);
+            for (size_t s = 1; s <= nsteps; s++)
+                emit(nullptr, lo + (hi - lo) * s / nsteps, false);
+        }
+        else if (nearest == last || (last != nullptr && nearest->owner == last->owner
+                 && nearest->a.x == last->a.x && nearest->a.y == last->a.y))
+            emit(nearest, hi, true); // same edge, only extend the end point
+        else
+        {
+            emit(nearest, lo, false);
+            emit(nearest, hi, false);
+        }
+        last = nearest;
+    };
+
+    for (size_t k = 0; k + 1 < events.size(); k++)
+    {
+        scalar_t lo = events[k], end = events[k+1];
+
+        // remove the ended edges, their neighbors become adjacent
+        for (; next_end < by_end.size() && edges[by_end[next_end]].angle_b <= lo; next_end++)
+        {
+            auto &slot = slots[by_end[next_end]];
+            if (slot == active.end()) continue; // the edge is empty
+            auto after = active.erase(slot);
+            slot = active.end();
+            if (after != active.begin())
+                check_crossing(std::prev(after), lo);
+        }
+        swap_crossed(lo);
+
+        // insert the started edges, compared along the ray at the start of the interval
+        scalar_t ahead = (lo + end) / 2;
+        ray[0] = cos(lo); ray[1] = sin(lo);
+        ray[2] = cos(ahead); ray[3] = sin(ahead);
+        for (; next_edge < edges.size() && edges[next_edge].angle_a <= lo; next_edge++)
+        {
+            if (edges[next_edge].angle_b <= lo) continue; // the edge is empty
+            auto it = active.insert(_ActiveEdge<scalar_t> {&edges[next_edge]});
+            slots[next_edge] = it;
+            if (it != active.begin())
+                check_crossing(std::prev(it), lo);
+            check_crossing(it, lo);
+        }
+
+        // split the interval at the crossings
+        while (!crossings.empty() && crossings.top().first < end)
+        {
+            scalar_t angle = crossings.top().first;
+            visit(lo, angle);
+            swap_crossed(angle);
+            lo = angle;
+        }
+        visit(lo, end);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        if (extent[i] > 0)
+            fractions[i] = _min(visible[i] / extent[i], scalar_t(1));
+}
+
+// Calculate visible fractions for a batch of scenes in parallel. Polygons of scene k are
+// polys[offsets[k]] to polys[offsets[k+1]-1] and the fractions are stored in the same layout
+template <typename scalar_t, uint8_t MaxPoints> inline
+void visibility_batch(const Poly2<scalar_t, MaxPoints> *polys, const uint32_t *offsets, size_t nscenes,
+    const Point2<scalar_t> *viewpoints, scalar_t *fractions)
+{
+    parallel_for(0, nscenes, [&](size_t k) {
+        visibility(polys + offsets[k], offsets[k+1] - offsets[k], viewpoints[k], fractions + offsets[k]);
+    });
+}
+
+} // namespace dgal
+
+#endif // DGAL_VISIBILITY_HPP